@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "place.h"
+
+// a mapped chunk and its slots still in use (plus one while a filler is handing them out)
+typedef struct chunk{
+	char *base;		// NULL while the id is free
+	long live;
+}CHUNK;
+
+static CHUNK chunks[ARENA_MAX_CHUNKS+1];			// by id (0 is never used)
+static pthread_mutex_t chunks_lock=PTHREAD_MUTEX_INITIALIZER;	// held to map or unmap one
+static long mapped_bytes=0;
+
+
+
+// maps a chunk aligned to its size and gives it a free id (0 if there isn't one)
+static short map_chunk(int node){
+	int id;
+	char *raw, *base;
+	pthread_mutex_lock(&chunks_lock);
+	for(id=1;id<=ARENA_MAX_CHUNKS && chunks[id].base!=NULL;id++){}
+	if(id>ARENA_MAX_CHUNKS){
+		pthread_mutex_unlock(&chunks_lock);
+		return 0;
+	}
+
+	// maps twice the size and trims the ends off so it starts on a chunk boundary
+	raw=mmap(NULL,2*ARENA_CHUNK,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+	if(raw==MAP_FAILED){
+		pthread_mutex_unlock(&chunks_lock);
+		return 0;
+	}
+	base=(char *)(((uintptr_t)raw+ARENA_CHUNK-1)&~(uintptr_t)(ARENA_CHUNK-1));
+	if(base>raw){munmap(raw,base-raw);}
+	munmap(base+ARENA_CHUNK,raw+ARENA_CHUNK-base);
+
+	// placed before anything touches it (a huge page would put the whole chunk on one node)
+	if(node==ARENA_INTERLEAVE){place_interleave(base,ARENA_CHUNK);}
+	else{
+		if(node>=0){place_bind(base,ARENA_CHUNK,node);}
+#ifdef MADV_HUGEPAGE
+		madvise(base,ARENA_CHUNK,MADV_HUGEPAGE);
+#endif
+	}
+
+	chunks[id].live=1;	// the filler's
+	chunks[id].base=base;
+	mapped_bytes+=ARENA_CHUNK;
+	pthread_mutex_unlock(&chunks_lock);
+	return id;
+}
+
+// drops a use of a chunk, unmapping it and freeing its id if that was the last
+static void unuse(short id){
+	if(__atomic_sub_fetch(&(chunks[id].live),1,__ATOMIC_ACQ_REL)>0){return;}
+	pthread_mutex_lock(&chunks_lock);
+	munmap(chunks[id].base,ARENA_CHUNK);
+	chunks[id].base=NULL;
+	mapped_bytes-=ARENA_CHUNK;
+	pthread_mutex_unlock(&chunks_lock);
+}
+
+
+
+// starts handing out slots of size bytes
+void arena_open(ARENA *a, long size){
+	a->size=size;
+	a->node=ARENA_ANYWHERE;
+	a->chunk=0;
+	a->next=a->end=NULL;
+}
+
+// puts the chunks it maps from now on on a NUMA node (or ARENA_INTERLEAVE)
+void arena_place(ARENA *a, int node){
+	a->node=node;
+}
+
+// next slot in order and its chunk's id (NULL if every id is taken)
+void *arena_alloc(ARENA *a, short *chunk){
+	void *slot;
+	if(a->chunk==0 || a->next+a->size>a->end){
+		arena_close(a);
+		a->chunk=map_chunk(a->node);
+		if(a->chunk==0){return NULL;}
+		a->next=chunks[a->chunk].base;
+		a->end=a->next+ARENA_CHUNK;
+	}
+	slot=a->next;
+	a->next+=a->size;
+	__atomic_add_fetch(&(chunks[a->chunk].live),1,__ATOMIC_RELAXED);
+	*chunk=a->chunk;
+	return slot;
+}
+
+// stops handing out slots (the rest of the last chunk goes unused)
+void arena_close(ARENA *a){
+	if(a->chunk!=0){unuse(a->chunk);}
+	a->chunk=0;
+	a->next=a->end=NULL;
+}
+
+// releases a slot of a chunk, unmapping the chunk once every slot in it is released
+void arena_free(short chunk){
+	unuse(chunk);
+}
+
+// bytes mapped by every chunk still in use
+long arena_bytes(){
+	long bytes;
+	pthread_mutex_lock(&chunks_lock);
+	bytes=mapped_bytes;
+	pthread_mutex_unlock(&chunks_lock);
+	return bytes;
+}
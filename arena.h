@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Chunked arena that compact_tree() moves the lock coupled tree's nodes into
+// Slots are handed out strictly in order from ARENA_CHUNK sized chunks mapped
+// straight from the OS (aligned so the kernel can back each one with a huge page),
+// so nodes copied in the order a walk meets them end up next to each other in
+// memory. Slots are never reused. Each chunk counts the slots still in use and is
+// unmapped as soon as the last one is released, so the pages go straight back to
+// the OS once the nodes in them are deleted or moved on by a later compaction.
+// A node keeps the id of its chunk (0 for anything malloc gave out) to release it.
+// An arena can put the chunks it maps on one NUMA node or interleave them over all
+
+#define ARENA_CHUNK (2L<<20)		// bytes in a chunk (one huge page)
+#define ARENA_MAX_CHUNKS 32767		// chunks mapped at once (ids fit in a short)
+#define ARENA_ANYWHERE -1		// chunk pages go wherever they're first touched
+#define ARENA_INTERLEAVE -2		// chunk pages are spread over every NUMA node
+
+// where a filler has got to
+typedef struct arena{
+	long size;		// bytes a slot takes
+	int node;		// NUMA node its chunks go on (or ARENA_ANYWHERE or ARENA_INTERLEAVE)
+	short chunk;		// chunk being filled (0 before the first)
+	char *next;		// next free slot in it
+	char *end;
+}ARENA;
+
+void arena_open(ARENA *a, long size);						// starts handing out slots of size bytes
+void arena_place(ARENA *a, int node);						// puts the chunks it maps from now on on a NUMA node (or ARENA_INTERLEAVE)
+void *arena_alloc(ARENA *a, short *chunk);					// next slot in order and its chunk's id (NULL if every id is taken)
+void arena_close(ARENA *a);							// stops handing out slots (the rest of the last chunk goes unused)
+void arena_free(short chunk);							// releases a slot of a chunk, unmapping it once every slot in it is released
+long arena_bytes();								// bytes mapped by every chunk still in use
+
+#endif
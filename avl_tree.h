@@ -0,0 +1,512 @@
+// Lock coupled AVL tree as a specialisable header
+// Each include makes one tree type, so define these first:
+//	AVL_NAME	name of the tree type and prefix of its functions (e.g. avl64 gives avl64_put)
+//	AVL_KEY		key type (default long long)
+//	AVL_VALUE	value type, stored inline in the node (default long long)
+//	AVL_KEYS_ONLY	1 leaves the value out of the node, so puts and gets ignore it (default 0)
+//	AVL_CMP(a,b)	compares two keys giving <0, 0 or >0 (default uses < and >)
+//	AVL_LOCKING	0 compiles the locks out for single threaded use (default 1)
+// A tree that keeps more in its nodes (like the one pthreads.c runs as engine 0)
+// can hook into the updates too. Each hook does nothing unless it's defined:
+//	AVL_NODE_FIELDS			extra members declared in every node
+//	AVL_INIT_NODE(node)		sets them up in a node put has just made
+//	AVL_LINKED(parent,node,side)	put hung node on side (0 left, 1 right) of parent (NULL at the root), still locked
+//	AVL_BUSY(node)			nonzero if put finds its key in a node that's still changing (it waits and starts over)
+//	AVL_VISIBLE(node)		nonzero if get counts the node it finds as there (default 1)
+//	AVL_STEPPED(node)		put or del has locked node on its way down (the one above is still locked)
+//	AVL_PASSED(node)		del is passing a locked node on its way down
+//	AVL_UNLINKING(node)		del is about to unlink node (it and its parent are locked)
+//	AVL_GAP_PASSED(node,moved)	find_gap is passing a locked node on its way down to hang moved
+//	AVL_RETIRE(node)		gets rid of a node del has unlinked (default free)
+//	AVL_ROTATING(node,child,inner)	child is about to take node's place, node taking child's inner subtree
+//	AVL_MEASURED(node,height)	height() has measured a locked node's subtree
+// AVL_CMP and the hooks are macros rather than function pointers so they're
+// inlined into every step of the walk down. The tree does lock coupled
+// updates, deletes that graft the right subtree under the left, and a rebalance
+// pass that rotates nodes until no side is 2 higher. It keeps its root and
+// counters in a struct so there can be any number of them.
+// There's no include guard: it can be included again with another AVL_NAME.
+
+#ifndef AVL_NAME
+#error "define AVL_NAME before including avl_tree.h"
+#endif
+#ifndef AVL_KEY
+#define AVL_KEY long long
+#endif
+#ifndef AVL_VALUE
+#define AVL_VALUE long long
+#endif
+#ifndef AVL_CMP
+#define AVL_CMP(a,b) (((a)>(b))-((a)<(b)))
+#endif
+#ifndef AVL_LOCKING
+#define AVL_LOCKING 1
+#endif
+#ifndef AVL_KEYS_ONLY
+#define AVL_KEYS_ONLY 0
+#endif
+#ifndef AVL_NODE_FIELDS
+#define AVL_NODE_FIELDS
+#endif
+#ifndef AVL_INIT_NODE
+#define AVL_INIT_NODE(node)
+#endif
+#ifndef AVL_LINKED
+#define AVL_LINKED(parent,node,side)
+#endif
+#ifndef AVL_BUSY
+#define AVL_BUSY(node) 0
+#endif
+#ifndef AVL_VISIBLE
+#define AVL_VISIBLE(node) 1
+#endif
+#ifndef AVL_STEPPED
+#define AVL_STEPPED(node)
+#endif
+#ifndef AVL_PASSED
+#define AVL_PASSED(node)
+#endif
+#ifndef AVL_UNLINKING
+#define AVL_UNLINKING(node)
+#endif
+#ifndef AVL_GAP_PASSED
+#define AVL_GAP_PASSED(node,moved)
+#endif
+#ifndef AVL_RETIRE
+#define AVL_RETIRE(node) free(node)
+#endif
+#ifndef AVL_ROTATING
+#define AVL_ROTATING(node,child,inner)
+#endif
+#ifndef AVL_MEASURED
+#define AVL_MEASURED(node,height)
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#if AVL_LOCKING
+#include <pthread.h>
+#include <sched.h>
+#define AVL_LOCK(mutex) pthread_mutex_lock(mutex)
+#define AVL_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define AVL_LOCK_INIT(mutex) pthread_mutex_init(mutex,NULL)
+#define AVL_YIELD() sched_yield()
+#else
+// without locking the lock fields don't exist and these take their arguments with them
+#define AVL_LOCK(mutex)
+#define AVL_UNLOCK(mutex)
+#define AVL_LOCK_INIT(mutex)
+#define AVL_YIELD()
+#endif
+#if AVL_KEYS_ONLY
+#define AVL_SET_VALUE(node,v) ((void)(v))
+#define AVL_GET_VALUE(node,v) ((void)(v))
+#else
+#define AVL_SET_VALUE(node,v) ((node)->value=(v))
+#define AVL_GET_VALUE(node,v) (*(v)=(node)->value)
+#endif
+
+#define AVL_JOIN2(a,b) a##_##b
+#define AVL_JOIN(a,b) AVL_JOIN2(a,b)
+#define AVL_(name) AVL_JOIN(AVL_NAME,name)
+
+typedef struct AVL_(node){
+	AVL_KEY key;
+#if !AVL_KEYS_ONLY
+	AVL_VALUE value;		// kept in the node, so a get is one walk with no extra pointer
+#endif
+	AVL_NODE_FIELDS
+	struct AVL_(node) *left;	// child pointers
+	struct AVL_(node) *right;
+#if AVL_LOCKING
+	pthread_mutex_t lock;		// and individual lock
+#endif
+}AVL_(node);
+
+typedef struct AVL_(tree){
+	AVL_(node) *root;
+#if AVL_LOCKING
+	pthread_mutex_t root_lock;	// held to change (or get past) the root pointer
+#endif
+	long rotations;			// rotations done by rebalance passes
+}AVL_NAME;
+
+
+// sets up an empty tree
+static inline void AVL_(init)(AVL_NAME *tree){
+	tree->root=NULL;
+	AVL_LOCK_INIT(&(tree->root_lock));
+	tree->rotations=0;
+}
+
+// makes an unlinked node
+static inline AVL_(node) *AVL_(new_node)(AVL_KEY key, AVL_VALUE value){
+	AVL_(node) *node=malloc(sizeof(AVL_(node)));
+	node->key=key;
+	AVL_SET_VALUE(node,value);
+	node->left=NULL;
+	node->right=NULL;
+	AVL_LOCK_INIT(&(node->lock));
+	AVL_INIT_NODE(node);
+	return node;
+}
+
+// adds key with value, or replaces its value if it's already there
+// returns 1 if the key was added
+static inline int AVL_(put)(AVL_NAME *tree, AVL_KEY key, AVL_VALUE value){
+	AVL_(node) *new_node=AVL_(new_node)(key,value), *parent, *child, **link;
+	int cmp;
+
+	// starts over from the root while the key is in a node that's still changing
+	while(1){
+		AVL_LOCK(&(tree->root_lock));
+		if(tree->root==NULL){
+			tree->root=new_node;
+			AVL_LINKED(NULL,new_node,0);
+			AVL_UNLOCK(&(tree->root_lock));
+			return 1;
+		}
+		parent=tree->root;
+		AVL_LOCK(&(parent->lock));
+		AVL_STEPPED(parent);
+		AVL_UNLOCK(&(tree->root_lock));
+
+		// lock couples down until it finds the key or a gap for it
+		while((cmp=AVL_CMP(key,parent->key))!=0){
+			link=(cmp<0)?&(parent->left):&(parent->right);
+			if(*link==NULL){
+				*link=new_node;
+				AVL_LINKED(parent,new_node,cmp>0);
+				AVL_UNLOCK(&(parent->lock));
+				return 1;
+			}
+			child=*link;
+			AVL_LOCK(&(child->lock));
+			AVL_STEPPED(child);
+			AVL_UNLOCK(&(parent->lock));
+			parent=child;
+		}
+		if(!AVL_BUSY(parent)){break;}
+		AVL_UNLOCK(&(parent->lock));
+		AVL_YIELD();
+	}
+	AVL_SET_VALUE(parent,value);
+	AVL_UNLOCK(&(parent->lock));
+	free(new_node);
+	return 0;
+}
+
+// copies key's value into *value unless value is NULL, returns 0 if the key isn't in the tree
+static inline int AVL_(get)(AVL_NAME *tree, AVL_KEY key, AVL_VALUE *value){
+	AVL_(node) *parent, *child;
+	int cmp, found;
+
+	AVL_LOCK(&(tree->root_lock));
+	if(tree->root==NULL){
+		AVL_UNLOCK(&(tree->root_lock));
+		return 0;
+	}
+	parent=tree->root;
+	AVL_LOCK(&(parent->lock));
+	AVL_UNLOCK(&(tree->root_lock));
+
+	while((cmp=AVL_CMP(key,parent->key))!=0){
+		child=(cmp<0)?parent->left:parent->right;
+		if(child==NULL){
+			AVL_UNLOCK(&(parent->lock));
+			return 0;
+		}
+		AVL_LOCK(&(child->lock));
+		AVL_UNLOCK(&(parent->lock));
+		parent=child;
+	}
+	found=AVL_VISIBLE(parent);
+	if(found && value!=NULL){AVL_GET_VALUE(parent,value);}
+	AVL_UNLOCK(&(parent->lock));
+	return found;
+}
+
+// hangs new in the first gap going dir (0 left, 1 right) from start
+// start and new must be locked, both are unlocked once it's placed
+static inline void AVL_(find_gap)(AVL_(node) *start, AVL_(node) *new_node, int dir){
+	AVL_(node) *parent=start, *child, **link;
+	while(1){
+		AVL_GAP_PASSED(parent,new_node);	// everything it passes ends up above new_node
+		link=(dir==0)?&(parent->left):&(parent->right);
+		if(*link==NULL){
+			*link=new_node;
+			AVL_UNLOCK(&(parent->lock));
+			AVL_UNLOCK(&(new_node->lock));
+			return;
+		}
+		child=*link;
+		AVL_LOCK(&(child->lock));
+		AVL_UNLOCK(&(parent->lock));
+		parent=child;
+	}
+}
+
+// deletes key, copying its value into *value unless value is NULL
+// returns 1 if it was deleted
+static inline int AVL_(del)(AVL_NAME *tree, AVL_KEY key, AVL_VALUE *value){
+	AVL_(node) *parent=NULL, *node, **link;
+	int cmp;
+
+	AVL_LOCK(&(tree->root_lock));
+	if(tree->root==NULL){
+		AVL_UNLOCK(&(tree->root_lock));
+		return 0;
+	}
+	link=&(tree->root);
+	node=tree->root;
+	AVL_LOCK(&(node->lock));
+	AVL_STEPPED(node);
+
+	// lock couples down keeping the node's parent (or the root lock) locked too
+	while((cmp=AVL_CMP(key,node->key))!=0){
+		AVL_(node) **next=(cmp<0)?&(node->left):&(node->right);
+		AVL_PASSED(node);
+		if(*next==NULL){
+			AVL_UNLOCK(&(node->lock));
+			if(parent==NULL){AVL_UNLOCK(&(tree->root_lock));}
+			else{AVL_UNLOCK(&(parent->lock));}
+			return 0;
+		}
+		AVL_LOCK(&((*next)->lock));
+		AVL_STEPPED(*next);
+		if(parent==NULL){AVL_UNLOCK(&(tree->root_lock));}
+		else{AVL_UNLOCK(&(parent->lock));}
+		parent=node;
+		link=next;
+		node=*next;
+	}
+	if(value!=NULL){AVL_GET_VALUE(node,value);}
+	AVL_UNLINKING(node);
+
+	// the left subtree takes the node's place with the right one hung under its rightmost node
+	if(node->left!=NULL){
+		AVL_LOCK(&(node->left->lock));
+		*link=node->left;
+		if(node->right!=NULL){
+			AVL_LOCK(&(node->right->lock));
+			AVL_(find_gap)(node->left,node->right,1);
+		}
+		else{
+			AVL_UNLOCK(&(node->left->lock));
+		}
+	}
+	else{
+		*link=node->right;
+	}
+
+	AVL_UNLOCK(&(node->lock));
+	if(parent==NULL){AVL_UNLOCK(&(tree->root_lock));}
+	else{AVL_UNLOCK(&(parent->lock));}
+	AVL_RETIRE(node);
+	return 1;
+}
+
+// height of a subtree whose parent is locked
+static inline int AVL_(height)(AVL_(node) *tree){
+	int left, right, height;
+	if(tree==NULL){return 0;}
+	AVL_LOCK(&(tree->lock));
+	left=AVL_(height)(tree->left);
+	right=AVL_(height)(tree->right);
+	height=(left>right)?left+1:right+1;
+	AVL_MEASURED(tree,height);
+	AVL_UNLOCK(&(tree->lock));
+	return height;
+}
+
+// lifts the child on side (0 left, 1 right) of the node at *link into its place
+// the node, the child and whatever owns link must be locked, and stay locked
+static inline void AVL_(rotate_up)(AVL_(node) **link, int side){
+	AVL_(node) *node=*link, *child=(side)?node->right:node->left;
+	AVL_(node) **inner=(side)?&(child->left):&(child->right);
+	AVL_ROTATING(node,child,*inner);
+	if(side){node->right=*inner;}
+	else{node->left=*inner;}
+	*inner=node;
+	*link=child;
+}
+
+// rotates the locked node at *link, whose owner (parent or root lock) is also locked,
+// until no side is 2 higher. Whatever ends up at *link is left locked, with the
+// height of its left side in *left. Returns how many rotations it did
+static inline long AVL_(balance_at)(AVL_(node) **link, int *left){
+	AVL_(node) *node=*link, *child, *grand;
+	int l=AVL_(height)(node->left), r=AVL_(height)(node->right), side;
+	long counter=0;
+
+	// rotates the higher child up into the node's place until no side is 2 higher
+	while(l-r>1 || r-l>1){
+		side=(r>l);
+		child=(side)?node->right:node->left;
+		AVL_LOCK(&(child->lock));
+		// a child leaning the other way is rotated first (a double rotation)
+		if(AVL_(height)((side)?child->left:child->right)>AVL_(height)((side)?child->right:child->left)){
+			grand=(side)?child->left:child->right;
+			AVL_LOCK(&(grand->lock));
+			AVL_(rotate_up)((side)?&(node->right):&(node->left),!side);
+			AVL_UNLOCK(&(child->lock));
+			child=grand;
+			counter++;
+		}
+		AVL_(rotate_up)(link,side);
+		AVL_UNLOCK(&(node->lock));
+		node=child;
+		l=AVL_(height)(node->left);
+		r=AVL_(height)(node->right);
+		counter++;
+	}
+	*left=l;
+	return counter;
+}
+
+// rebalances the locked node at *link, whose owner (parent or root lock) is also locked
+// returns how many rotations it did, and unlocks the node
+static inline long AVL_(rebalance_at)(AVL_(node) **link){
+	int l;
+	long counter=AVL_(balance_at)(link,&l);
+	AVL_(node) *node=*link;
+
+	// then does both subtrees
+	if(node->left!=NULL){
+		AVL_LOCK(&(node->left->lock));
+		counter+=AVL_(rebalance_at)(&(node->left));
+	}
+	if(node->right!=NULL){
+		AVL_LOCK(&(node->right->lock));
+		counter+=AVL_(rebalance_at)(&(node->right));
+	}
+	AVL_UNLOCK(&(node->lock));
+	return counter;
+}
+
+// rebalances the whole tree, passing over it until nothing moves
+// returns how many rotations it did
+static inline long AVL_(rebalance)(AVL_NAME *tree){
+	long n, total=0;
+	do{
+		n=0;
+		AVL_LOCK(&(tree->root_lock));
+		if(tree->root!=NULL){
+			AVL_LOCK(&(tree->root->lock));
+			n=AVL_(rebalance_at)(&(tree->root));
+			tree->rotations+=n;
+			total+=n;
+		}
+		AVL_UNLOCK(&(tree->root_lock));
+	}while(n>0);
+	return total;
+}
+
+// height of a subtree without locks, or -1 if any node in it has one side 2 higher
+static inline int AVL_(check)(AVL_(node) *tree){
+	int left, right;
+	if(tree==NULL){return 0;}
+	left=AVL_(check)(tree->left);
+	right=AVL_(check)(tree->right);
+	if(left<0 || right<0 || left-right>1 || right-left>1){return -1;}
+	return (left>right)?left+1:right+1;
+}
+
+// counts the nodes in a subtree without locks
+static inline long AVL_(count_nodes)(AVL_(node) *tree){
+	if(tree==NULL){return 0;}
+	return 1+AVL_(count_nodes)(tree->left)+AVL_(count_nodes)(tree->right);
+}
+
+// number of keys in the tree (no other threads should be updating it)
+static inline long AVL_(count)(AVL_NAME *tree){
+	return AVL_(count_nodes)(tree->root);
+}
+
+// prints one level of the tree, every key gap digits wide (empty where there's no node)
+static inline void AVL_(print_line)(AVL_(node) *tree, int start, int inc, int num, int gap, char *empty){
+	int i, j, k, found;
+	AVL_(node) *temp;
+
+	for(i=0;i<start*gap;i++){printf(" ");}
+	// loops through how many keys are on the line
+	for(j=0;j<num;j++){
+		found=1;
+		temp=tree;
+		// uses j as binary representation of directions it travels (0 for left, 1 for right)
+		for(k=num/2;k>=1 && found;k/=2){
+			if((k&j)==0){temp=temp->left;}
+			else{temp=temp->right;}
+			if(temp==NULL){found=0;}
+		}
+		if(found){printf("%0*lld",gap,(long long)temp->key);}
+		else{printf("%s",empty);}
+		for(i=0;i<inc*gap;i++){printf(" ");}
+	}
+	printf("\n\n");
+}
+
+// prints the tree a level per line if it's 6 high or less (no other threads updating)
+static inline void AVL_(print)(AVL_NAME *tree, int gap, char *empty){
+	int height, i;
+	if(tree->root==NULL){
+		printf("Tree is empty, can't print\n");
+		return;
+	}
+	height=AVL_(height)(tree->root);
+	if(height>6){
+		printf("Tree too large to print\n");
+		return;
+	}
+	// loops through the layers (setting values to print_line accordingly)
+	for(i=height;i>0;i--){
+		AVL_(print_line)(tree->root,1<<(i-1),(1<<i)-1,1<<(height-i),gap,empty);
+	}
+}
+
+// frees the tree (no other threads may be using it)
+static inline void AVL_(destroy)(AVL_NAME *tree){
+	AVL_(node) *node=tree->root, *next;
+	// rotates left children up so it never needs a stack
+	while(node!=NULL){
+		if(node->left!=NULL){
+			next=node->left;
+			node->left=next->right;
+			next->right=node;
+		}
+		else{
+			next=node->right;
+			free(node);
+		}
+		node=next;
+	}
+	tree->root=NULL;
+}
+
+#undef AVL_LOCK
+#undef AVL_UNLOCK
+#undef AVL_LOCK_INIT
+#undef AVL_YIELD
+#undef AVL_SET_VALUE
+#undef AVL_GET_VALUE
+#undef AVL_
+#undef AVL_JOIN
+#undef AVL_JOIN2
+#undef AVL_NAME
+#undef AVL_KEY
+#undef AVL_VALUE
+#undef AVL_CMP
+#undef AVL_LOCKING
+#undef AVL_KEYS_ONLY
+#undef AVL_NODE_FIELDS
+#undef AVL_INIT_NODE
+#undef AVL_LINKED
+#undef AVL_BUSY
+#undef AVL_VISIBLE
+#undef AVL_STEPPED
+#undef AVL_PASSED
+#undef AVL_UNLINKING
+#undef AVL_GAP_PASSED
+#undef AVL_RETIRE
+#undef AVL_ROTATING
+#undef AVL_MEASURED
@@ -0,0 +1,65 @@
+#include <stdlib.h>
+#include "avlmap.h"
+#include "avltree.h"
+#include "engine.h"
+
+// spreads the driver's small ints over the whole key range (odd multiplier, so no two collide)
+#define KEY(val) ((long long)((unsigned long long)(val)*0x9E3779B97F4A7C15ULL))
+
+static AVLTREE *map;
+
+
+
+// sets up an empty map
+void avlmap_init(){
+	map=avltree_create();
+}
+
+// adds a key for val, returns 1 if added
+int avlmap_add(int val){
+	return avltree_put(map,KEY(val),val);
+}
+
+// deletes val's key, returns 1 if deleted
+int avlmap_delete(int val){
+	return avltree_del(map,KEY(val),NULL);
+}
+
+// returns 1 if val's key is there with the right value
+int avlmap_lookup(int val){
+	long long value;
+	return avltree_get(map,KEY(val),&value) && value==val;
+}
+
+// rebalances the whole map
+void avlmap_balance(){
+	avltree_rebalance(map);
+}
+
+// number of keys in the map
+long avlmap_count(){
+	return avltree_count(map);
+}
+
+// bytes used by the map's nodes
+long avlmap_bytes(){
+	return avlmap_count()*avltree_node_bytes();
+}
+
+// rotations done by rebalancing so far
+long avlmap_rotations(){
+	return avltree_rotations(map);
+}
+
+// height of the map (no other threads updating)
+int avlmap_height(){
+	return avltree_height(map);
+}
+
+// frees the map (no other threads may be running)
+void avlmap_destroy(){
+	avltree_destroy(map);
+}
+
+
+ENGINE avlmap_engine={"AVL map (libavl, 64-bit keys and values)",avlmap_init,avlmap_add,avlmap_delete,avlmap_lookup,avlmap_balance,NULL,avlmap_count,avlmap_bytes,avlmap_rotations,avlmap_destroy,avlmap_height};
@@ -0,0 +1,20 @@
+#ifndef AVLMAP_H
+#define AVLMAP_H
+
+// Lock coupled AVL tree from libavl (avltree.h) with 64-bit keys and 64-bit values
+// Shows the library used as a map: each int from the driver is spread
+// over the 64-bit key range and carries its own value in the node, which
+// lookups check. Balanced by a rebalance pass like engine 0.
+
+void avlmap_init();								// sets up an empty map
+int avlmap_add(int val);							// adds a key for val, returns 1 if added
+int avlmap_delete(int val);							// deletes val's key, returns 1 if deleted
+int avlmap_lookup(int val);							// returns 1 if val's key is there with the right value
+void avlmap_balance();								// rebalances the whole map
+long avlmap_count();								// number of keys in the map
+long avlmap_bytes();								// bytes used by the map's nodes
+long avlmap_rotations();							// rotations done by rebalancing so far
+int avlmap_height();								// height of the map (no other threads updating)
+void avlmap_destroy();								// frees the map (no other threads may be running)
+
+#endif
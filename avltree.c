@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "avltree.h"
+
+// build with -DAVL_LOCKING=0 for the single threaded library
+#define AVL_NAME avltree_core
+#define AVL_KEY long long
+#define AVL_VALUE long long
+#include "avl_tree.h"
+
+
+
+// makes an empty tree
+AVLTREE *avltree_create(){
+	AVLTREE *tree=malloc(sizeof(AVLTREE));
+	avltree_core_init(tree);
+	return tree;
+}
+
+// adds key (or replaces its value), returns 1 if added
+int avltree_put(AVLTREE *tree, long long key, long long value){
+	return avltree_core_put(tree,key,value);
+}
+
+// copies key's value, returns 0 if it isn't there
+int avltree_get(AVLTREE *tree, long long key, long long *value){
+	return avltree_core_get(tree,key,value);
+}
+
+// deletes key (copying its value unless NULL), returns 1 if deleted
+int avltree_del(AVLTREE *tree, long long key, long long *value){
+	return avltree_core_del(tree,key,value);
+}
+
+// rebalances until nothing moves, returns rotations done
+long avltree_rebalance(AVLTREE *tree){
+	return avltree_core_rebalance(tree);
+}
+
+// number of keys (no other threads updating)
+long avltree_count(AVLTREE *tree){
+	return avltree_core_count(tree);
+}
+
+// height of the tree (0 if it's empty)
+int avltree_height(AVLTREE *tree){
+	return avltree_core_height(tree->root);
+}
+
+// 1 if no node has one side 2 higher (no other threads updating)
+int avltree_balanced(AVLTREE *tree){
+	return avltree_core_check(tree->root)>=0;
+}
+
+// rotations done by rebalancing so far
+long avltree_rotations(AVLTREE *tree){
+	return tree->rotations;
+}
+
+// size of one node
+long avltree_node_bytes(){
+	return sizeof(avltree_core_node);
+}
+
+// frees the tree (no other threads may be using it)
+void avltree_destroy(AVLTREE *tree){
+	avltree_core_destroy(tree);
+	free(tree);
+}
+
+
+// prints the tree a level per line (if it's 6 high or less)
+void avltree_print(AVLTREE *tree, int gap, char *empty){
+	avltree_core_print(tree,gap,empty);
+}
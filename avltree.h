@@ -0,0 +1,24 @@
+#ifndef AVLTREE_H
+#define AVLTREE_H
+
+// The tree library shared by the drivers (avl_tree.h made into one tree type)
+// Built twice from avltree.c: libavl.a with the locks in for pthreads.out, and
+// libavl_serial.a with AVL_LOCKING=0 for serial.out, where the nodes have no
+// mutex and nothing locks. Keys and values are long long.
+
+typedef struct avltree_core_tree AVLTREE;
+
+AVLTREE *avltree_create();							// makes an empty tree
+int avltree_put(AVLTREE *tree, long long key, long long value);			// adds key (or replaces its value), returns 1 if added
+int avltree_get(AVLTREE *tree, long long key, long long *value);		// copies key's value, returns 0 if it isn't there
+int avltree_del(AVLTREE *tree, long long key, long long *value);		// deletes key (copying its value unless NULL), returns 1 if deleted
+long avltree_rebalance(AVLTREE *tree);						// rebalances until nothing moves, returns rotations done
+long avltree_count(AVLTREE *tree);						// number of keys (no other threads updating)
+int avltree_height(AVLTREE *tree);						// height of the tree (0 if it's empty)
+int avltree_balanced(AVLTREE *tree);						// 1 if no node has one side 2 higher (no other threads updating)
+long avltree_rotations(AVLTREE *tree);						// rotations done by rebalancing so far
+long avltree_node_bytes();							// size of one node
+void avltree_print(AVLTREE *tree, int gap, char *empty);			// prints the tree a level per line (if it's 6 high or less)
+void avltree_destroy(AVLTREE *tree);						// frees the tree (no other threads may be using it)
+
+#endif
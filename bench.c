@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "bench.h"
+
+int compare_long(const void *a, const void *b);					// qsort comparison for longs
+long percentile(long *sorted, long n, double p);				// value p of the way up a sorted array
+
+
+
+// makes n random adds and deletes of keys in [0,max) (free it after)
+// half are adds, so the tree stays about as full as bench_fill leaves it
+BENCH_OP *bench_ops(int seed, long n, int max){
+	BENCH_OP *ops=malloc(n*sizeof(BENCH_OP));
+	unsigned int state=seed;
+	long i;
+	for(i=0;i<n;i++){
+		ops[i].type=(rand_r(&state)&1)?BENCH_DEL:BENCH_ADD;
+		ops[i].key=rand_r(&state)%max;
+	}
+	return ops;
+}
+
+// every other key in [0,max) in a random order, to fill the tree with first
+// (shuffled so the unbalanced adds don't build a list)
+int *bench_fill(int seed, int max, long *n){
+	int *keys, temp;
+	unsigned int state=seed-101;
+	long i, j;
+
+	*n=(max+1)/2;
+	keys=malloc(*n*sizeof(int));
+	for(i=0;i<*n;i++){keys[i]=2*i;}
+	for(i=*n-1;i>0;i--){
+		j=rand_r(&state)%(i+1);
+		temp=keys[i];
+		keys[i]=keys[j];
+		keys[j]=temp;
+	}
+	return keys;
+}
+
+// n keys in [0,max) where the key of rank r comes up about 1/(r+1)^skew as often as the hottest
+// (Gray et al's generator, skew in (0,1), with the ranks scattered over the range)
+int *bench_zipf(int seed, long n, int max, double skew){
+	int *keys=malloc(n*sizeof(int));
+	unsigned int state=seed+101;
+	double zetan=0, zeta2=1+pow(0.5,skew), alpha=1/(1-skew), eta, u, uz;
+	long i, rank;
+
+	for(i=1;i<=max;i++){zetan+=1/pow(i,skew);}
+	eta=(1-pow(2.0/max,1-skew))/(1-zeta2/zetan);
+	for(i=0;i<n;i++){
+		u=rand_r(&state)/(RAND_MAX+1.0);
+		uz=u*zetan;
+		if(uz<1){rank=0;}
+		else if(uz<zeta2){rank=1;}
+		else{rank=(long)(max*pow(eta*u-eta+1,alpha));}
+		if(rank>=max){rank=max-1;}
+		keys[i]=(int)(((unsigned long)rank*2654435761UL)%max);	// so the hot keys aren't all at the bottom
+	}
+	return keys;
+}
+
+// monotonic clock in nanoseconds
+long bench_now(){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return now.tv_sec*1000000000L+now.tv_nsec;
+}
+
+// resident memory of the process in bytes (0 if /proc isn't there)
+long bench_rss(){
+	long size, resident=0;
+	FILE *statm=fopen("/proc/self/statm","r");
+	if(statm==NULL){return 0;}
+	if(fscanf(statm,"%ld %ld",&size,&resident)!=2){resident=0;}
+	fclose(statm);
+	return resident*sysconf(_SC_PAGESIZE);
+}
+
+// adds 2*i for i in [lo,hi] medians first, so even a plain BST comes out balanced
+// (recurses on halves so it needs no array, only log n of stack)
+void bench_fill_balanced(long lo, long hi, int (*add)(int val)){
+	long mid;
+	while(lo<=hi){
+		mid=lo+(hi-lo)/2;
+		add(2*mid);
+		bench_fill_balanced(lo,mid-1,add);
+		lo=mid+1;
+	}
+}
+
+// qsort comparison for longs
+int compare_long(const void *a, const void *b){
+	long x=*(const long *)a, y=*(const long *)b;
+	return (x>y)-(x<y);
+}
+
+// value p of the way up a sorted array
+long percentile(long *sorted, long n, double p){
+	long i=(long)(p*n);
+	if(n==0){return 0;}
+	if(i>=n){i=n-1;}
+	return sorted[i];
+}
+
+// prints the CSV header and a row for the run (sorts the latencies)
+// bench.sh keeps the first header and drops the rest
+void bench_csv(FILE *out, BENCH_RESULT *r){
+	long *l=r->latency, n=r->ops;
+	qsort(l,n,sizeof(long),compare_long);
+
+	fprintf(out,"driver,engine,threads,max,ops,seed,seconds,ops_per_sec,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,keys,height,bytes_per_node,pinning,numa_nodes\n");
+	fprintf(out,"%s,\"%s\",%d,%d,%ld,%d,%.6f,%.0f,%ld,%ld,%ld,%ld,%ld,%ld,",r->driver,r->engine,r->threads,r->max,n,r->seed,r->seconds,(r->seconds>0)?n/r->seconds:0.0,
+		percentile(l,n,0.5),percentile(l,n,0.9),percentile(l,n,0.99),percentile(l,n,0.999),(n>0)?l[n-1]:0,r->keys);
+	if(r->height>=0){fprintf(out,"%d",r->height);}
+	fprintf(out,",%.1f,%s,%d\n",(r->keys>0)?(double)r->bytes/r->keys:0.0,r->pinning,r->nodes);
+}
@@ -0,0 +1,45 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+
+// Shared benchmark workload for serial.out and pthreads.out (-b)
+// Both drivers build the same op sequence from the same seed and key range, fill
+// the tree with the same keys first, time every op and print one CSV row, so a
+// serial run and a run at any thread count do exactly the same work
+
+#define BENCH_ADD 0
+#define BENCH_DEL 1
+#define BENCH_BALANCE_EVERY 1000	// ops between rebalances (inline in serial, by the balancer thread in pthreads)
+
+typedef struct bench_op{
+	int type;		// BENCH_ADD or BENCH_DEL
+	int key;
+}BENCH_OP;
+
+// what a run gets up to, for the CSV row
+typedef struct bench_result{
+	char *driver;		// "serial" or "pthreads"
+	char *engine;
+	int threads;		// threads running the ops (not counting the balancer)
+	int max;		// keys are in [0,max)
+	long ops;
+	int seed;
+	double seconds;
+	long *latency;		// nanoseconds taken by each op
+	long keys;		// keys in the tree at the end
+	int height;		// height at the end (-1 if the engine can't say)
+	long bytes;		// bytes used by the nodes at the end
+	char *pinning;		// how the threads were pinned ("none" if they weren't)
+	int nodes;		// NUMA nodes the threads ran on
+}BENCH_RESULT;
+
+BENCH_OP *bench_ops(int seed, long n, int max);					// makes n random adds and deletes of keys in [0,max) (free it after)
+int *bench_fill(int seed, int max, long *n);					// every other key in [0,max) in a random order, to fill the tree with first
+int *bench_zipf(int seed, long n, int max, double skew);			// n keys in [0,max) with zipfian skew in (0,1) (free it after)
+long bench_now();								// monotonic clock in nanoseconds
+long bench_rss();								// resident memory of the process in bytes
+void bench_fill_balanced(long lo, long hi, int (*add)(int val));		// adds 2*i for i in [lo,hi] medians first, so even a plain BST comes out balanced
+void bench_csv(FILE *out, BENCH_RESULT *result);				// prints the CSV header and a row for the run (sorts the latencies)
+
+#endif
@@ -0,0 +1,37 @@
+#!/bin/sh
+# Runs serial.out and pthreads.out in bench mode (-b) over a sweep of key ranges,
+# thread counts and engines, all on the same seed, and prints one CSV (make bench)
+# Override the sweep with BENCH_SIZES, BENCH_THREADS, BENCH_ENGINES, BENCH_OPS and BENCH_SEED
+# BENCH_RATES (ops/sec) adds open loop pthreads rows at each of those rates too
+# BENCH_WAL (a log file) adds engine 0 rows with every op logged and waited on until durable
+# BENCH_PINS (-P policies, e.g. "compact scatter") adds pthreads rows with the threads pinned each way
+
+sizes=${BENCH_SIZES:-"1000 10000 100000"}
+threads=${BENCH_THREADS:-"1 2 4 8"}
+engines=${BENCH_ENGINES:-"0 1 2 3 4 5 7"}
+ops=${BENCH_OPS:-100000}
+seed=${BENCH_SEED:-1}
+rates=${BENCH_RATES:-""}
+wal=${BENCH_WAL:-""}
+pins=${BENCH_PINS:-""}
+
+{
+	for max in $sizes; do
+		./serial.out -b -n "$ops" -s "$seed" -m "$max"
+		for engine in $engines; do
+			for t in $threads; do
+				./pthreads.out -b -n "$ops" -s "$seed" -m "$max" -e "$engine" -t "$t"
+				for rate in $rates; do
+					./pthreads.out -b -n "$ops" -s "$seed" -m "$max" -e "$engine" -t "$t" -o "$rate"
+				done
+				for pin in $pins; do
+					./pthreads.out -b -n "$ops" -s "$seed" -m "$max" -e "$engine" -t "$t" -P "$pin"
+				done
+				if [ -n "$wal" ] && [ "$engine" = 0 ]; then
+					./pthreads.out -b -n "$ops" -s "$seed" -m "$max" -e "$engine" -t "$t" -a "$wal"
+				fi
+			done
+		done
+	done
+} | awk 'NR==1 || !/^driver,/'
+if [ -n "$wal" ]; then rm -f "$wal"; fi
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "bptree.h"
+#include "engine.h"
+
+// version lock bits (the rest of the word counts writes)
+#define OBSOLETE ((uint64_t)1)
+#define LOCKED ((uint64_t)2)
+
+#define BP_LINE 64		// nodes are allocated on cache line boundaries
+
+// set up node structure
+// leaves are allocated without the children array
+typedef struct bp_node{
+	uint64_t version;			// optimistic lock
+	int leaf;				// 1 for leaves, 0 for inner nodes
+	int count;				// keys in use
+	int keys[BP_KEYS];			// sorted keys (unused slots hold INT_MAX)
+	struct bp_node *children[BP_KEYS+1];	// inner nodes only, child i holds keys below keys[i]
+}BP_NODE;
+
+#define LEAF_SIZE (offsetof(BP_NODE,children))
+#define INNER_SIZE (sizeof(BP_NODE))
+
+
+static BP_NODE *bp_root;
+static long bp_counter=0;		// number of values in the tree
+static long bp_mem=0;			// bytes allocated to nodes
+static int bp_avx2=0;			// set by bp_init if the cpu running it has AVX2
+
+
+
+// allocates an empty node
+static BP_NODE *new_node(int leaf){
+	size_t size=leaf?LEAF_SIZE:INNER_SIZE;
+	size=(size+BP_LINE-1)/BP_LINE*BP_LINE;
+	BP_NODE *node=(BP_NODE *)aligned_alloc(BP_LINE,size);
+	int i;
+
+	node->version=0;
+	node->leaf=leaf;
+	node->count=0;
+	for(i=0;i<BP_KEYS;i++){node->keys[i]=INT_MAX;}
+	__sync_fetch_and_add(&bp_mem,size);
+	return node;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// count_less with AVX2, compiled for it whatever the build targets and only called if the cpu has it
+__attribute__((target("avx2"))) static int count_less_avx2(BP_NODE *node, int val){
+	int n=0, i;
+	__m256i v=_mm256_set1_epi32(val);
+	for(i=0;i<BP_KEYS;i+=8){
+		__m256i k=_mm256_loadu_si256((__m256i *)&(node->keys[i]));
+		n+=__builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(v,k))));
+	}
+	return n;
+}
+#endif
+
+// number of keys in the node smaller than val (unused slots hold INT_MAX so never count)
+static int count_less(BP_NODE *node, int val){
+	int n=0, i;
+#if defined(__x86_64__) || defined(__i386__)
+	if(bp_avx2){return count_less_avx2(node,val);}
+#endif
+#if defined(__SSE2__)
+	__m128i v=_mm_set1_epi32(val);
+	for(i=0;i<BP_KEYS;i+=4){
+		__m128i k=_mm_loadu_si128((__m128i *)&(node->keys[i]));
+		n+=__builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v,k))));
+	}
+#else
+	for(i=0;i<BP_KEYS;i++){
+		n+=(node->keys[i]<val);
+	}
+#endif
+	return n;
+}
+
+// index of the child of an inner node that covers val
+static int child_index(BP_NODE *node, int val){
+	// every key in use is <= INT_MAX (and val+1 would wrap), so it goes right of them all
+	if(val==INT_MAX){return node->count;}
+	return count_less(node,val+1);		// keys equal to a separator go right
+}
+
+
+// optimistic lock helpers, each sets *restart if the node can't be used as seen
+
+// returns the version to validate against later (restarts if a writer holds the node)
+static uint64_t read_lock(BP_NODE *node, int *restart){
+	uint64_t version=__atomic_load_n(&(node->version),__ATOMIC_ACQUIRE);
+	if(version&(LOCKED|OBSOLETE)){
+		*restart=1;
+	}
+	return version;
+}
+
+// checks nothing has changed the node since version was read
+static void check(BP_NODE *node, uint64_t version, int *restart){
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&(node->version),__ATOMIC_RELAXED)!=version){
+		*restart=1;
+	}
+}
+
+// turns a read into a write lock if nothing has changed the node since version was read
+static void upgrade(BP_NODE *node, uint64_t version, int *restart){
+	if(!__atomic_compare_exchange_n(&(node->version),&version,version+LOCKED,0,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED)){
+		*restart=1;
+	}
+}
+
+// releases a write lock (bumping the version)
+static void write_unlock(BP_NODE *node){
+	__atomic_fetch_add(&(node->version),LOCKED,__ATOMIC_RELEASE);
+}
+
+
+// moves the top half of a full node into a new right sibling, returns the separator
+// both nodes and the parent must be write locked
+static int split(BP_NODE *node, BP_NODE **right){
+	BP_NODE *new=new_node(node->leaf);
+	int mid=BP_KEYS/2, sep, i;
+
+	if(node->leaf){
+		// leaves copy the separator up and keep it on the right
+		sep=node->keys[mid];
+		for(i=mid;i<BP_KEYS;i++){
+			new->keys[i-mid]=node->keys[i];
+			node->keys[i]=INT_MAX;
+		}
+		new->count=BP_KEYS-mid;
+	}
+	else{
+		// inner nodes move the separator up
+		sep=node->keys[mid];
+		for(i=mid+1;i<BP_KEYS;i++){
+			new->keys[i-mid-1]=node->keys[i];
+			new->children[i-mid-1]=node->children[i];
+		}
+		new->children[BP_KEYS-mid-1]=node->children[BP_KEYS];
+		for(i=mid;i<BP_KEYS;i++){node->keys[i]=INT_MAX;}
+		new->count=BP_KEYS-mid-1;
+	}
+	node->count=mid;
+	*right=new;
+	return sep;
+}
+
+// puts a separator and the child to its right into a (write locked, non full) inner node
+static void insert_child(BP_NODE *node, int sep, BP_NODE *child){
+	int pos=count_less(node,sep), i;
+	for(i=node->count;i>pos;i--){
+		node->keys[i]=node->keys[i-1];
+		node->children[i+1]=node->children[i];
+	}
+	node->keys[pos]=sep;
+	node->children[pos+1]=child;
+	node->count++;
+}
+
+// splits a full node (write locked, as is parent if not NULL)
+static void split_node(BP_NODE *parent, BP_NODE *node){
+	BP_NODE *right, *new_root;
+	int sep=split(node,&right);
+
+	// a split root gets a new root above it
+	if(parent==NULL){
+		new_root=new_node(0);
+		new_root->keys[0]=sep;
+		new_root->children[0]=node;
+		new_root->children[1]=right;
+		new_root->count=1;
+		__atomic_store_n(&bp_root,new_root,__ATOMIC_RELEASE);
+	}
+	else{
+		insert_child(parent,sep,right);
+	}
+}
+
+// locks a full node and its parent and splits it
+// gives up if either changed since it was read (the caller restarts either way)
+static void lock_and_split(BP_NODE *parent, uint64_t parent_version, BP_NODE *node, uint64_t version){
+	int restart=0;
+
+	if(parent!=NULL){
+		upgrade(parent,parent_version,&restart);
+		if(restart){return;}
+	}
+	upgrade(node,version,&restart);
+	if(restart){
+		if(parent!=NULL){write_unlock(parent);}
+		return;
+	}
+	// the root may have been split by someone else while we weren't holding anything
+	if(parent==NULL && node!=__atomic_load_n(&bp_root,__ATOMIC_ACQUIRE)){
+		write_unlock(node);
+		return;
+	}
+
+	split_node(parent,node);
+	write_unlock(node);
+	if(parent!=NULL){write_unlock(parent);}
+}
+
+// walks down to the leaf for val, splitting full nodes on the way if split is set
+// returns the leaf and its version and parent, or NULL to restart
+static BP_NODE *find_leaf(int val, int split, uint64_t *leaf_version, BP_NODE **leaf_parent, uint64_t *parent_version){
+	BP_NODE *parent=NULL, *node;
+	uint64_t pv=0, v;
+	int restart=0;
+
+	node=__atomic_load_n(&bp_root,__ATOMIC_ACQUIRE);
+	v=read_lock(node,&restart);
+	if(restart || node!=__atomic_load_n(&bp_root,__ATOMIC_ACQUIRE)){return NULL;}
+
+	while(!node->leaf){
+		// full inner nodes are split on the way down so there's always room for a separator
+		if(split && node->count==BP_KEYS){
+			lock_and_split(parent,pv,node,v);
+			return NULL;
+		}
+		if(parent!=NULL){
+			check(parent,pv,&restart);
+			if(restart){return NULL;}
+		}
+		parent=node;
+		pv=v;
+
+		node=parent->children[child_index(parent,val)];
+		check(parent,pv,&restart);	// makes sure the child pointer read was valid
+		if(restart){return NULL;}
+		v=read_lock(node,&restart);
+		if(restart){return NULL;}
+	}
+	// makes sure the leaf wasn't split between reading the pointer and its version
+	if(parent!=NULL){
+		check(parent,pv,&restart);
+		if(restart){return NULL;}
+	}
+
+	*leaf_version=v;
+	*leaf_parent=parent;
+	*parent_version=pv;
+	return node;
+}
+
+
+
+// sets up an empty tree
+void bp_init(){
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	bp_avx2=__builtin_cpu_supports("avx2");
+#endif
+	bp_mem=0;
+	bp_root=new_node(1);
+	bp_counter=0;
+}
+
+// adds a value to the tree, returns 1 if added
+int bp_add(int new_val){
+	BP_NODE *leaf, *parent;
+	uint64_t v, pv;
+	int restart, pos, i;
+
+	// loops until it gets through without another thread changing something it used
+	while(1){
+		restart=0;
+		leaf=find_leaf(new_val,1,&v,&parent,&pv);
+		if(leaf==NULL){continue;}
+
+		pos=count_less(leaf,new_val);
+		// value is already in the tree
+		if(pos<leaf->count && leaf->keys[pos]==new_val){
+			check(leaf,v,&restart);
+			if(restart){continue;}
+			return 0;
+		}
+
+		// a full leaf is split and the add starts again
+		if(leaf->count==BP_KEYS){
+			lock_and_split(parent,pv,leaf,v);
+			continue;
+		}
+
+		upgrade(leaf,v,&restart);
+		if(restart){continue;}
+
+		// shifts the bigger keys up and slots in the new one
+		for(i=leaf->count;i>pos;i--){
+			leaf->keys[i]=leaf->keys[i-1];
+		}
+		leaf->keys[pos]=new_val;
+		leaf->count++;
+		write_unlock(leaf);
+
+		__sync_fetch_and_add(&bp_counter,1);
+		return 1;
+	}
+}
+
+// deletes a value from the tree, returns 1 if deleted
+// (leaves are never merged, an empty leaf just stays empty until something lands in it)
+int bp_delete(int del_val){
+	BP_NODE *leaf, *parent;
+	uint64_t v, pv;
+	int restart, pos, i;
+
+	while(1){
+		restart=0;
+		leaf=find_leaf(del_val,0,&v,&parent,&pv);
+		if(leaf==NULL){continue;}
+
+		pos=count_less(leaf,del_val);
+		// value isn't in the tree
+		if(pos>=leaf->count || leaf->keys[pos]!=del_val){
+			check(leaf,v,&restart);
+			if(restart){continue;}
+			return 0;
+		}
+
+		upgrade(leaf,v,&restart);
+		if(restart){continue;}
+
+		// shifts the bigger keys down over it
+		for(i=pos;i<leaf->count-1;i++){
+			leaf->keys[i]=leaf->keys[i+1];
+		}
+		leaf->count--;
+		leaf->keys[leaf->count]=INT_MAX;
+		write_unlock(leaf);
+
+		__sync_fetch_and_sub(&bp_counter,1);
+		return 1;
+	}
+}
+
+// returns 1 if val is in the tree
+int bp_lookup(int val){
+	BP_NODE *leaf, *parent;
+	uint64_t v, pv;
+	int restart, pos, found;
+
+	while(1){
+		restart=0;
+		leaf=find_leaf(val,0,&v,&parent,&pv);
+		if(leaf==NULL){continue;}
+
+		pos=count_less(leaf,val);
+		found=(pos<leaf->count && leaf->keys[pos]==val);
+		check(leaf,v,&restart);
+		if(!restart){return found;}
+	}
+}
+
+// number of values in the tree
+long bp_count(){
+	return __atomic_load_n(&bp_counter,__ATOMIC_ACQUIRE);
+}
+
+// bytes used by the tree's nodes
+long bp_bytes(){
+	return __atomic_load_n(&bp_mem,__ATOMIC_ACQUIRE);
+}
+
+// levels in the tree, leaves included (no other threads updating)
+int bp_height(){
+	BP_NODE *node=bp_root;
+	int levels=0;
+	// every leaf is at the same depth, so the leftmost path will do
+	while(node!=NULL){
+		levels++;
+		node=node->leaf?NULL:node->children[0];
+	}
+	return levels;
+}
+
+// frees a subtree
+static void free_node(BP_NODE *node){
+	int i;
+	if(!node->leaf){
+		for(i=0;i<=node->count;i++){
+			free_node(node->children[i]);
+		}
+	}
+	free(node);
+}
+
+// frees the tree (no other threads may be running)
+void bp_destroy(){
+	free_node(bp_root);
+	bp_root=NULL;
+	bp_mem=0;
+}
+
+
+ENGINE bp_engine={"OLC B+-tree",bp_init,bp_add,bp_delete,bp_lookup,NULL,NULL,bp_count,bp_bytes,NULL,bp_destroy,bp_height};
@@ -0,0 +1,24 @@
+#ifndef BPTREE_H
+#define BPTREE_H
+
+// Cache conscious B+-tree with optimistic lock coupling (Leis et al., DaMoN 2016)
+// Each node holds up to BP_KEYS sorted ints, so a search costs one or two cache
+// lines per level instead of one miss per key compared. The in-node search is
+// a branch free SIMD count of the keys below the one wanted (AVX2 if the cpu
+// running it has it, otherwise SSE2).
+// Readers never write to shared memory: they remember each node's version and
+// restart if it changed by the time they are done with it. Writers only lock
+// the nodes they change, and full nodes are split on the way down.
+
+#define BP_KEYS 32								// keys per node (multiple of 8)
+
+void bp_init();									// sets up an empty tree
+int bp_add(int new_val);							// adds a value, returns 1 if added
+int bp_delete(int del_val);							// deletes a value, returns 1 if deleted
+int bp_lookup(int val);								// returns 1 if val is in the tree
+long bp_count();								// number of values in the tree
+long bp_bytes();								// bytes used by the tree's nodes
+int bp_height();								// levels in the tree, leaves included (no other threads updating)
+void bp_destroy();								// frees the tree (no other threads may be running)
+
+#endif
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "cache.h"
+
+// a slot's word: the key in the low 32 bits, then valid and present bits, then the version
+#define VALID (1UL<<32)
+#define PRESENT (1UL<<33)
+#define VERSION_ONE (1UL<<34)
+#define VERSIONS (~(VERSION_ONE-1))
+#define KEY_OF(word) ((int)(unsigned int)(word))
+
+// a thread's counters, a cache line each so the owner never shares its line
+struct cache_counts{
+	long hits;
+	long misses;
+	CACHE_COUNTS *next;	// next thread's counters
+}__attribute__((aligned(64)));
+
+static int generations=0;				// caches made so far
+static __thread CACHE_COUNTS *my_counts=NULL;		// calling thread's counters
+static __thread int my_generation=-1;			// and the cache they belong to
+
+
+
+// slot a key goes in (Fibonacci hashing, so runs of keys spread out)
+static unsigned long *slot(CACHE *c, int key){
+	return &(c->slots[(((unsigned int)key*0x9E3779B97F4A7C15UL)>>32)&c->mask]);
+}
+
+// finds (or adds) the calling thread's counters for c
+static CACHE_COUNTS *counts(CACHE *c){
+	if(my_generation==c->generation){return my_counts;}
+	my_counts=aligned_alloc(64,sizeof(CACHE_COUNTS));
+	memset(my_counts,0,sizeof(CACHE_COUNTS));
+	pthread_mutex_lock(&(c->counts_lock));
+	my_counts->next=c->counts;
+	c->counts=my_counts;
+	pthread_mutex_unlock(&(c->counts_lock));
+	my_generation=c->generation;
+	return my_counts;
+}
+
+// adds one to a counter only its thread writes (so no locked instruction)
+static void count(long *n){
+	__atomic_store_n(n,__atomic_load_n(n,__ATOMIC_RELAXED)+1,__ATOMIC_RELAXED);
+}
+
+// moves a slot's version on, dropping its key if that's in [lo,hi]
+// (another key sharing the slot stays, but no walk that started before this can fill it)
+static void bump(unsigned long *s, int lo, int hi){
+	unsigned long old=__atomic_load_n(s,__ATOMIC_RELAXED), word;
+	do{
+		word=old+VERSION_ONE;
+		if(KEY_OF(old)>=lo && KEY_OF(old)<=hi){word&=~(VALID|PRESENT);}
+	}while(!__atomic_compare_exchange_n(s,&old,word,1,__ATOMIC_ACQ_REL,__ATOMIC_RELAXED));
+}
+
+
+
+// a cache with at least that many slots (a power of two)
+CACHE *cache_create(long slots){
+	CACHE *c=malloc(sizeof(CACHE));
+	long n=1;
+	while(n<slots && n<CACHE_MAX_SLOTS){n*=2;}
+	c->slots=calloc(n,sizeof(unsigned long));
+	c->mask=n-1;
+	c->generation=__atomic_fetch_add(&generations,1,__ATOMIC_RELAXED);
+	c->counts=NULL;
+	pthread_mutex_init(&(c->counts_lock),NULL);
+	return c;
+}
+
+// CACHE_ABSENT, CACHE_PRESENT or CACHE_MISS (with the word read as a ticket for cache_fill)
+int cache_check(CACHE *c, int key, unsigned long *ticket){
+	CACHE_COUNTS *mine=counts(c);
+	unsigned long word=__atomic_load_n(slot(c,key),__ATOMIC_ACQUIRE);
+	if((word&VALID) && KEY_OF(word)==key){
+		count(&(mine->hits));
+		return (word&PRESENT)?CACHE_PRESENT:CACHE_ABSENT;
+	}
+	count(&(mine->misses));
+	*ticket=word;
+	return CACHE_MISS;
+}
+
+// puts a walk's answer in unless the key's slot changed since the ticket was read
+void cache_fill(CACHE *c, int key, int present, unsigned long ticket){
+	unsigned long word=(ticket&VERSIONS)|VALID|((present)?PRESENT:0)|(unsigned int)key;
+	__atomic_compare_exchange_n(slot(c,key),&ticket,word,0,__ATOMIC_RELEASE,__ATOMIC_RELAXED);
+}
+
+// drops a key whose add or delete just took effect (its node still locked)
+void cache_invalidate(CACHE *c, int key){
+	bump(slot(c,key),key,key);
+}
+
+// drops every key in [lo,hi] once they've all been cut out
+void cache_invalidate_range(CACHE *c, int lo, int hi){
+	long i;
+	if(lo>hi){return;}
+	if((long)hi-lo<=c->mask){
+		for(i=lo;i<=hi;i++){
+			cache_invalidate(c,(int)i);
+		}
+		return;
+	}
+	// a range with more keys than there are slots bumps every slot instead
+	for(i=0;i<=c->mask;i++){
+		bump(&(c->slots[i]),lo,hi);
+	}
+}
+
+// empties it (no other threads may be using it)
+void cache_reset(CACHE *c){
+	memset(c->slots,0,(c->mask+1)*sizeof(unsigned long));
+}
+
+// adds up every thread's hits and misses
+void cache_stats(CACHE *c, long *hits, long *misses){
+	CACHE_COUNTS *n;
+	*hits=*misses=0;
+	pthread_mutex_lock(&(c->counts_lock));
+	for(n=c->counts;n!=NULL;n=n->next){
+		*hits+=__atomic_load_n(&(n->hits),__ATOMIC_RELAXED);
+		*misses+=__atomic_load_n(&(n->misses),__ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&(c->counts_lock));
+}
+
+// bytes the slots take up
+long cache_bytes(CACHE *c){
+	return (c->mask+1)*sizeof(unsigned long);
+}
+
+// frees it (no other threads may be using it)
+void cache_destroy(CACHE *c){
+	CACHE_COUNTS *n, *next;
+	for(n=c->counts;n!=NULL;n=next){
+		next=n->next;
+		free(n);
+	}
+	pthread_mutex_destroy(&(c->counts_lock));
+	free(c->slots);
+	free(c);
+}
@@ -0,0 +1,42 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+
+// Hot key cache the lock coupled tree checks before it walks down for a lookup
+// A power of two number of slots, each a single word holding a key, whether it's in
+// the tree and a version, so a lookup that hits reads one word and never touches a
+// node or a lock. A miss keeps the word it read as a ticket, walks the tree and then
+// compare-and-swaps its answer in over the ticket. An add or delete bumps the version
+// of its key's slot where it takes effect (while the node is still locked), dropping
+// the key if it's there, so an answer from a walk that started before the update no
+// longer matches its ticket and is thrown away instead of going in stale. Keys that
+// share a slot just push each other out.
+// Hits and misses are counted per thread (the counters are only added up for stats)
+
+#define CACHE_ABSENT 0			// the key isn't in the tree
+#define CACHE_PRESENT 1			// the key is in the tree
+#define CACHE_MISS 2			// the cache doesn't have it, so the tree has to be walked
+#define CACHE_MAX_SLOTS (1L<<26)	// most slots a cache is given (512MB)
+
+typedef struct cache_counts CACHE_COUNTS;
+
+typedef struct hot_cache{
+	unsigned long *slots;		// key, present and valid bits and a version in each word
+	long mask;			// number of slots less one
+	int generation;			// tells a thread's counters for an old cache from this one's
+	CACHE_COUNTS *counts;		// every thread's hit and miss counters
+	pthread_mutex_t counts_lock;	// held to add a thread's counters to the list
+}CACHE;
+
+CACHE *cache_create(long slots);						// a cache with at least that many slots (a power of two)
+int cache_check(CACHE *c, int key, unsigned long *ticket);			// CACHE_ABSENT, CACHE_PRESENT or CACHE_MISS (with a ticket for cache_fill)
+void cache_fill(CACHE *c, int key, int present, unsigned long ticket);	// puts a walk's answer in unless the key's slot changed since the ticket
+void cache_invalidate(CACHE *c, int key);					// drops a key whose add or delete just took effect
+void cache_invalidate_range(CACHE *c, int lo, int hi);				// drops every key in [lo,hi] once they've all been cut out
+void cache_reset(CACHE *c);							// empties it (no other threads may be using it)
+void cache_stats(CACHE *c, long *hits, long *misses);				// adds up every thread's hits and misses
+long cache_bytes(CACHE *c);							// bytes the slots take up
+void cache_destroy(CACHE *c);							// frees it (no other threads may be using it)
+
+#endif
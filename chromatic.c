@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "chromatic.h"
+#include "engine.h"
+#include "ebr.h"
+
+// set up node structure
+typedef struct ch_node{
+	int val;			// leaf's value, or in an internal node the smallest value that goes right
+	int weight;			// 0 is red, 1 black, more than 1 overweight
+	pthread_mutex_t lock;		// individual lock
+	struct ch_node *left;		// child pointers (both NULL in a leaf)
+	struct ch_node *right;
+}CH_NODE;
+
+
+static CH_NODE *ch_root=NULL;
+static pthread_mutex_t root_lock=PTHREAD_MUTEX_INITIALIZER;	// guards the root pointer
+
+static long ch_counter=0;		// number of values in the tree
+static long ch_rots=0;			// rotations done by the balancer
+
+// values the updates left a violation on the search path to, for the balancer
+static int *pending=NULL;
+static long num_pending=0, pending_cap=0;
+static pthread_mutex_t pending_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t balance_lock=PTHREAD_MUTEX_INITIALIZER;	// one balancer at a time
+
+
+
+// allocates a node
+static CH_NODE *new_node(int val, int weight, CH_NODE *left, CH_NODE *right){
+	CH_NODE *node=(CH_NODE *)malloc(sizeof(CH_NODE));
+	node->val=val;
+	node->weight=weight;
+	pthread_mutex_init(&(node->lock),NULL);
+	node->left=left;
+	node->right=right;
+	return node;
+}
+
+// queues a value for the balancer to walk towards
+static void queue_fix(int val){
+	pthread_mutex_lock(&pending_lock);
+	if(num_pending==pending_cap){
+		pending_cap=(pending_cap==0)?1024:2*pending_cap;
+		pending=realloc(pending,pending_cap*sizeof(int));
+	}
+	pending[num_pending++]=val;
+	pthread_mutex_unlock(&pending_lock);
+}
+
+// fixes a red-red pair, x red under red p, where g is black and linked from *glink
+// g, p and x are locked, returns how many of them it replaced with copies (put in old)
+static int fix_red(CH_NODE **glink, CH_NODE *g, CH_NODE *p, CH_NODE *x, CH_NODE **old){
+	CH_NODE *uncle, *ng, *np, *nx;
+	int left=(p==g->left);
+
+	// red uncle: g passes its black down to both children
+	uncle=(left)?g->right:g->left;
+	pthread_mutex_lock(&(uncle->lock));
+	if(uncle->weight==0){
+		if(glink!=&ch_root){g->weight=0;}
+		p->weight=1;
+		uncle->weight=1;
+		pthread_mutex_unlock(&(uncle->lock));
+		return 0;
+	}
+	pthread_mutex_unlock(&(uncle->lock));
+
+	// black uncle, x on the outside: single rotation, p takes g's place
+	if((x==p->left)==left){
+		if(left){
+			ng=new_node(g->val,0,p->right,uncle);
+			np=new_node(p->val,g->weight,x,ng);
+		}
+		else{
+			ng=new_node(g->val,0,uncle,p->left);
+			np=new_node(p->val,g->weight,ng,x);
+		}
+		__atomic_store_n(glink,np,__ATOMIC_RELEASE);
+		ch_rots++;
+		old[0]=g;
+		old[1]=p;
+		return 2;
+	}
+
+	// black uncle, x on the inside: double rotation, x takes g's place
+	if(left){
+		np=new_node(p->val,0,p->left,x->left);
+		ng=new_node(g->val,0,x->right,uncle);
+		nx=new_node(x->val,g->weight,np,ng);
+	}
+	else{
+		ng=new_node(g->val,0,uncle,x->left);
+		np=new_node(p->val,0,x->right,p->right);
+		nx=new_node(x->val,g->weight,ng,np);
+	}
+	__atomic_store_n(glink,nx,__ATOMIC_RELEASE);
+	ch_rots+=2;
+	old[0]=g;
+	old[1]=p;
+	old[2]=x;
+	return 3;
+}
+
+// moves one unit of x's excess weight up or across, x is overweight under p (which isn't)
+// path[1..3] is g, p, x (g is NULL if p is the root), all locked along with whatever *links[1] hangs off
+// returns how many nodes it replaced with copies (put in old)
+static int fix_heavy(CH_NODE **path, CH_NODE ***links, CH_NODE **old){
+	CH_NODE *g=path[1], *p=path[2], *x=path[3];
+	CH_NODE *s, *near, *far, *np, *ns, *nn;
+	int left=(x==p->left), n=0;
+
+	s=(left)?p->right:p->left;
+	pthread_mutex_lock(&(s->lock));
+
+	// overweight sibling: both give one to p
+	if(s->weight>1){
+		x->weight--;
+		s->weight--;
+		if(links[2]!=&ch_root){p->weight++;}
+	}
+	// red sibling under a red p is a red-red pair one level up, fixed first
+	else if(s->weight==0 && p->weight==0){
+		n=fix_red(links[1],g,p,s,old);
+	}
+	// red sibling under a black p: rotates it up so x has a black sibling
+	else if(s->weight==0){
+		if(left){
+			np=new_node(p->val,0,x,s->left);
+			ns=new_node(s->val,p->weight,np,s->right);
+		}
+		else{
+			np=new_node(p->val,0,s->right,x);
+			ns=new_node(s->val,p->weight,s->left,np);
+		}
+		__atomic_store_n(links[2],ns,__ATOMIC_RELEASE);
+		ch_rots++;
+		old[0]=p;
+		old[1]=s;
+		n=2;
+	}
+	// black sibling (never a leaf, its side needs as much weight below p as x's)
+	else{
+		near=(left)?s->left:s->right;
+		far=(left)?s->right:s->left;
+		pthread_mutex_lock(&(near->lock));
+		pthread_mutex_lock(&(far->lock));
+
+		// black nephews: s turns red and both give one to p
+		if(near->weight>0 && far->weight>0){
+			x->weight--;
+			s->weight=0;
+			if(links[2]!=&ch_root){p->weight++;}
+		}
+		// red far nephew: single rotation, s takes p's place
+		else if(far->weight==0){
+			if(left){
+				np=new_node(p->val,1,x,near);
+				ns=new_node(s->val,p->weight,np,far);
+			}
+			else{
+				np=new_node(p->val,1,near,x);
+				ns=new_node(s->val,p->weight,far,np);
+			}
+			x->weight--;
+			far->weight=1;
+			__atomic_store_n(links[2],ns,__ATOMIC_RELEASE);
+			ch_rots++;
+			old[0]=p;
+			old[1]=s;
+			n=2;
+		}
+		// red near nephew: double rotation, it takes p's place
+		else{
+			if(left){
+				np=new_node(p->val,1,x,near->left);
+				ns=new_node(s->val,1,near->right,far);
+				nn=new_node(near->val,p->weight,np,ns);
+			}
+			else{
+				ns=new_node(s->val,1,far,near->left);
+				np=new_node(p->val,1,near->right,x);
+				nn=new_node(near->val,p->weight,ns,np);
+			}
+			x->weight--;
+			__atomic_store_n(links[2],nn,__ATOMIC_RELEASE);
+			ch_rots+=2;
+			old[0]=p;
+			old[1]=s;
+			old[2]=near;
+			n=3;
+		}
+		pthread_mutex_unlock(&(far->lock));
+		pthread_mutex_unlock(&(near->lock));
+	}
+	pthread_mutex_unlock(&(s->lock));
+	return n;
+}
+
+// walks down towards val and fixes the first violation it meets, returns 1 if it found one
+// keeps the last four nodes locked (and the root pointer while any of them is missing),
+// so every fix has the link it swings and the nodes it changes locked top down like the updates
+static int fix_path(int val){
+	CH_NODE *path[4]={NULL,NULL,NULL,NULL}, **links[4]={NULL,NULL,NULL,&ch_root};
+	CH_NODE *old[3], *x, *p, *next;
+	int i, n=0, found=0;
+
+	pthread_mutex_lock(&root_lock);
+	path[3]=ch_root;
+	if(path[3]==NULL){
+		pthread_mutex_unlock(&root_lock);
+		return 0;
+	}
+	pthread_mutex_lock(&(path[3]->lock));
+	while(1){
+		x=path[3];
+		p=path[2];
+
+		// a red under a red or an overweight node (the root doesn't count)
+		if(p!=NULL && x->weight==0 && p->weight==0){
+			n=fix_red(links[1],path[1],p,x,old);
+			found=1;
+			break;
+		}
+		if(p!=NULL && x->weight>1){
+			n=fix_heavy(path,links,old);
+			found=1;
+			break;
+		}
+		if(x->left==NULL){break;}
+
+		// moves the window down a level
+		next=(val<x->val)?x->left:x->right;
+		pthread_mutex_lock(&(next->lock));
+		if(path[0]!=NULL){pthread_mutex_unlock(&(path[0]->lock));}
+		else if(path[1]!=NULL){pthread_mutex_unlock(&root_lock);}
+		for(i=0;i<3;i++){
+			path[i]=path[i+1];
+			links[i]=links[i+1];
+		}
+		links[3]=(val<x->val)?&(x->left):&(x->right);
+		path[3]=next;
+	}
+
+	for(i=0;i<4;i++){
+		if(path[i]!=NULL){pthread_mutex_unlock(&(path[i]->lock));}
+	}
+	if(path[0]==NULL){pthread_mutex_unlock(&root_lock);}
+
+	// nothing waits on a replaced node's lock (that takes its parent's), but lookups may still be on it
+	for(i=0;i<n;i++){
+		ebr_retire(old[i]);
+	}
+	return found;
+}
+
+// checks the weights and order below node, returns the weight from node to its leaves (-1 if broken)
+static int check_subtree(CH_NODE *node, int parent_weight, long low, long high){
+	int left, right;
+	if(node->weight<0 || node->weight>1 || (node->weight==0 && parent_weight==0)){return -1;}
+	if(node->left==NULL){
+		return (node->weight==1 && node->val>=low && node->val<high)?1:-1;
+	}
+	left=check_subtree(node->left,node->weight,low,node->val);
+	right=check_subtree(node->right,node->weight,node->val,high);
+	if(left<0 || left!=right){return -1;}
+	return left+node->weight;
+}
+
+// height of a subtree
+static int subtree_height(CH_NODE *node){
+	int left, right;
+	if(node==NULL){return 0;}
+	left=subtree_height(node->left);
+	right=subtree_height(node->right);
+	return (left>right)?left+1:right+1;
+}
+
+// frees a subtree
+static void free_subtree(CH_NODE *node){
+	if(node==NULL){return;}
+	free_subtree(node->left);
+	free_subtree(node->right);
+	free(node);
+}
+
+
+
+// sets up an empty tree
+void ch_init(){
+	ch_root=NULL;
+	ch_counter=0;
+	ch_rots=0;
+}
+
+// adds a value to the tree, returns 1 if added
+int ch_add(int new_val){
+	CH_NODE *node, *parent=NULL, *next, *leaf, *internal;
+	CH_NODE **link=&ch_root;
+	pthread_mutex_t *owner=&root_lock;
+
+	pthread_mutex_lock(&root_lock);
+	node=ch_root;
+	if(node==NULL){
+		__atomic_store_n(&ch_root,new_node(new_val,1,NULL,NULL),__ATOMIC_RELEASE);
+		pthread_mutex_unlock(&root_lock);
+		__sync_fetch_and_add(&ch_counter,1);
+		return 1;
+	}
+
+	// lock couples down to the leaf, keeping what links to it locked too
+	pthread_mutex_lock(&(node->lock));
+	while(node->left!=NULL){
+		link=(new_val<node->val)?&(node->left):&(node->right);
+		next=*link;
+		pthread_mutex_lock(&(next->lock));
+		pthread_mutex_unlock(owner);
+		owner=&(node->lock);
+		parent=node;
+		node=next;
+	}
+	if(node->val==new_val){
+		pthread_mutex_unlock(&(node->lock));
+		pthread_mutex_unlock(owner);
+		return 0;
+	}
+
+	// an internal node takes the leaf's place with one less weight, over two black leaves
+	leaf=new_node(new_val,1,NULL,NULL);
+	if(new_val<node->val){internal=new_node(node->val,0,leaf,node);}
+	else{internal=new_node(new_val,0,node,leaf);}
+	internal->weight=(parent==NULL)?1:node->weight-1;
+	node->weight=1;
+	__atomic_store_n(link,internal,__ATOMIC_RELEASE);
+
+	// a red under a red is left for the balancer
+	if(parent!=NULL && internal->weight==0 && parent->weight==0){queue_fix(new_val);}
+	pthread_mutex_unlock(&(node->lock));
+	pthread_mutex_unlock(owner);
+	__sync_fetch_and_add(&ch_counter,1);
+	return 1;
+}
+
+// deletes a value from the tree, returns 1 if deleted
+int ch_delete(int del_val){
+	CH_NODE *parent, *node, *next, *sibling;
+	CH_NODE **link, **parent_link=&ch_root;
+	pthread_mutex_t *owner=&root_lock;
+
+	pthread_mutex_lock(&root_lock);
+	parent=ch_root;
+	if(parent==NULL){
+		pthread_mutex_unlock(&root_lock);
+		return 0;
+	}
+	pthread_mutex_lock(&(parent->lock));
+
+	// the last value goes with the root
+	if(parent->left==NULL){
+		if(parent->val!=del_val){
+			pthread_mutex_unlock(&(parent->lock));
+			pthread_mutex_unlock(&root_lock);
+			return 0;
+		}
+		__atomic_store_n(&ch_root,NULL,__ATOMIC_RELEASE);
+		pthread_mutex_unlock(&(parent->lock));
+		pthread_mutex_unlock(&root_lock);
+		ebr_retire(parent);
+		__sync_fetch_and_sub(&ch_counter,1);
+		return 1;
+	}
+
+	// lock couples down to the leaf, keeping its parent and what links to the parent locked
+	link=(del_val<parent->val)?&(parent->left):&(parent->right);
+	node=*link;
+	pthread_mutex_lock(&(node->lock));
+	while(node->left!=NULL){
+		next=(del_val<node->val)?node->left:node->right;
+		pthread_mutex_lock(&(next->lock));
+		pthread_mutex_unlock(owner);
+		owner=&(parent->lock);
+		parent_link=link;
+		parent=node;
+		link=(del_val<node->val)?&(node->left):&(node->right);
+		node=next;
+	}
+	if(node->val!=del_val){
+		pthread_mutex_unlock(&(node->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		pthread_mutex_unlock(owner);
+		return 0;
+	}
+
+	// the sibling takes the parent's place and its weight too, so the paths through it keep theirs
+	sibling=(link==&(parent->left))?parent->right:parent->left;
+	pthread_mutex_lock(&(sibling->lock));
+	sibling->weight=(parent_link==&ch_root)?1:sibling->weight+parent->weight;
+	__atomic_store_n(parent_link,sibling,__ATOMIC_RELEASE);
+
+	// an overweight node is left for the balancer
+	if(sibling->weight>1){queue_fix(del_val);}
+	pthread_mutex_unlock(&(sibling->lock));
+	pthread_mutex_unlock(&(node->lock));
+	pthread_mutex_unlock(&(parent->lock));
+	pthread_mutex_unlock(owner);
+
+	// nothing can wait on their locks now (that needs the grandparent's), but lookups may be on them
+	ebr_retire(node);
+	ebr_retire(parent);
+	__sync_fetch_and_sub(&ch_counter,1);
+	return 1;
+}
+
+// returns 1 if val is in the tree
+int ch_lookup(int val){
+	CH_NODE *node, *left;
+	int found=0;
+
+	ebr_enter();
+	node=__atomic_load_n(&ch_root,__ATOMIC_ACQUIRE);
+	if(node!=NULL){
+		while((left=__atomic_load_n(&(node->left),__ATOMIC_ACQUIRE))!=NULL){
+			node=(val<node->val)?left:__atomic_load_n(&(node->right),__ATOMIC_ACQUIRE);
+		}
+		found=(node->val==val);
+	}
+	ebr_exit();
+	return found;
+}
+
+// fixes every violation queued so far (what the updates queue meanwhile waits for the next call)
+void ch_balance(){
+	int *vals;
+	long n, i;
+
+	pthread_mutex_lock(&balance_lock);
+	pthread_mutex_lock(&pending_lock);
+	vals=pending;
+	n=num_pending;
+	pending=NULL;
+	num_pending=pending_cap=0;
+	pthread_mutex_unlock(&pending_lock);
+
+	// each value's path is walked until it's clean, a few nodes changed per fix
+	for(i=0;i<n;i++){
+		while(fix_path(vals[i]));
+	}
+	free(vals);
+	pthread_mutex_unlock(&balance_lock);
+}
+
+// number of values in the tree
+long ch_count(){
+	return __atomic_load_n(&ch_counter,__ATOMIC_ACQUIRE);
+}
+
+// bytes used by the tree's nodes (a leaf for every value and one less internal node)
+long ch_bytes(){
+	long n=ch_count();
+	return (n>0)?(2*n-1)*sizeof(CH_NODE):0;
+}
+
+// rotations done by the balancer so far
+long ch_rotations(){
+	return ch_rots;
+}
+
+// height of the tree (no other threads updating)
+int ch_height(){
+	return subtree_height(ch_root);
+}
+
+// black height if the tree has no violations left, -1 otherwise (no other threads updating)
+int ch_check(){
+	if(ch_root==NULL){return 0;}
+	if(ch_root->weight!=1){return -1;}
+	return check_subtree(ch_root,1,(long)INT_MIN,(long)INT_MAX+1);
+}
+
+// frees the tree (no other threads may be running)
+void ch_destroy(){
+	free_subtree(ch_root);
+	ebr_flush();	// and everything waiting to be reclaimed
+	ch_root=NULL;
+	free(pending);
+	pending=NULL;
+	num_pending=pending_cap=0;
+}
+
+
+ENGINE chromatic_engine={"chromatic tree",ch_init,ch_add,ch_delete,ch_lookup,ch_balance,NULL,ch_count,ch_bytes,ch_rotations,ch_destroy,ch_height};
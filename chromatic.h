@@ -0,0 +1,25 @@
+#ifndef CHROMATIC_H
+#define CHROMATIC_H
+
+// Chromatic tree engine, a red-black tree with relaxed balance (Nurmi and
+// Soisalon-Soininen, 1991; rebalancing from Boyar, Fagerberg and Larsen, 1997)
+// Values live in the leaves and every node has a weight instead of a colour
+// (0 is red, 1 is black, more than 1 is overweight). Adds and deletes lock couple
+// down to the leaf, change at most three nodes and never rotate; a red-red pair
+// or an overweight node they leave behind is queued for the balancer thread,
+// which fixes it a few nodes at a time. Lookups never lock: rotations swap in
+// copies of the nodes they change so a lookup part way down still finds its way.
+
+void ch_init();									// sets up an empty tree
+int ch_add(int new_val);							// adds a value, returns 1 if added
+int ch_delete(int del_val);							// deletes a value, returns 1 if deleted
+int ch_lookup(int val);								// returns 1 if val is in the tree
+void ch_balance();								// fixes every violation queued so far
+long ch_count();								// number of values in the tree
+long ch_bytes();								// bytes used by the tree's nodes
+long ch_rotations();								// rotations done by the balancer so far
+int ch_height();								// height of the tree (no other threads updating)
+int ch_check();									// black height if the tree has no violations left, -1 otherwise (no other threads updating)
+void ch_destroy();								// frees the tree (no other threads may be running)
+
+#endif
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "cow.h"
+#include "ebr.h"
+#include "snapshot.h"
+#include "engine.h"
+
+#define COW_MAX_HEIGHT 64	// more levels than an AVL tree of every int can have (about 45)
+
+// set up node structure (never changed once it's in a published version)
+struct cow_node{
+	int val;			// node's value
+	int height;			// levels in this subtree
+	long size;			// values in this subtree
+	unsigned long stamp;		// update that made it (which can change it until it publishes)
+	struct cow_node *left;		// child pointers
+	struct cow_node *right;
+};
+
+
+static COW_NODE *cow_root=NULL;					// current version (swapped with an atomic store)
+static pthread_mutex_t cow_lock=PTHREAD_MUTEX_INITIALIZER;	// serialises the updates (readers never take it)
+
+// writer state, only touched under cow_lock
+static unsigned long stamp=0;		// number of the update in progress
+static COW_NODE **stale=NULL;		// nodes the update replaced, retired once it's published
+static int stale_count=0;
+static int stale_cap=0;
+static long cow_rots=0;			// rotations so far
+
+
+
+static int height(COW_NODE *node){
+	return (node==NULL)?0:node->height;
+}
+
+static long size(COW_NODE *node){
+	return (node==NULL)?0:node->size;
+}
+
+// recomputes a writable node's height and size from its children
+static void update(COW_NODE *node){
+	int l=height(node->left), r=height(node->right);
+	node->height=((l>r)?l:r)+1;
+	node->size=size(node->left)+size(node->right)+1;
+}
+
+// makes a leaf for the update in progress
+static COW_NODE *new_node(int val){
+	COW_NODE *node=malloc(sizeof(COW_NODE));
+	node->val=val;
+	node->height=1;
+	node->size=1;
+	node->stamp=stamp;
+	node->left=NULL;
+	node->right=NULL;
+	return node;
+}
+
+// takes a node out of the version being built (freed now if no reader can have seen it)
+static void drop(COW_NODE *node){
+	if(node->stamp==stamp){
+		free(node);
+		return;
+	}
+	if(stale_count==stale_cap){
+		stale_cap=(stale_cap>0)?2*stale_cap:2*COW_MAX_HEIGHT;
+		stale=realloc(stale,stale_cap*sizeof(COW_NODE *));
+	}
+	stale[stale_count++]=node;
+}
+
+// returns a version of node the update in progress can change (a copy unless it made node)
+static COW_NODE *writable(COW_NODE *node){
+	if(node->stamp==stamp){return node;}
+	COW_NODE *copy=malloc(sizeof(COW_NODE));
+	*copy=*node;
+	copy->stamp=stamp;
+	drop(node);
+	return copy;
+}
+
+// rotates a writable node's left child up into its place, returns the child
+static COW_NODE *rotate_right(COW_NODE *node){
+	COW_NODE *pivot=writable(node->left);
+	node->left=pivot->right;
+	update(node);
+	pivot->right=node;
+	update(pivot);
+	cow_rots++;
+	return pivot;
+}
+
+// rotates a writable node's right child up into its place, returns the child
+static COW_NODE *rotate_left(COW_NODE *node){
+	COW_NODE *pivot=writable(node->right);
+	node->right=pivot->left;
+	update(node);
+	pivot->left=node;
+	update(pivot);
+	cow_rots++;
+	return pivot;
+}
+
+// rebalances a writable node whose subtrees differ in height by at most 2, returns the subtree's new root
+static COW_NODE *fix(COW_NODE *node){
+	int balance=height(node->left)-height(node->right);
+	if(balance>1){
+		if(height(node->left->left)<height(node->left->right)){node->left=rotate_left(writable(node->left));}
+		return rotate_right(node);
+	}
+	if(balance<-1){
+		if(height(node->right->right)<height(node->right->left)){node->right=rotate_right(writable(node->right));}
+		return rotate_left(node);
+	}
+	update(node);
+	return node;
+}
+
+// copies the path down to where val goes and adds it there (val must not be in the tree)
+static COW_NODE *insert(COW_NODE *node, int val){
+	if(node==NULL){return new_node(val);}
+	node=writable(node);
+	if(val<node->val){node->left=insert(node->left,val);}
+	else{node->right=insert(node->right,val);}
+	return fix(node);
+}
+
+// copies the path down to the smallest value under node and takes it out into *min
+static COW_NODE *remove_min(COW_NODE *node, int *min){
+	if(node->left==NULL){
+		COW_NODE *right=node->right;
+		*min=node->val;
+		drop(node);
+		return right;
+	}
+	node=writable(node);
+	node->left=remove_min(node->left,min);
+	return fix(node);
+}
+
+// copies the path down to val and takes it out (val must be in the tree)
+static COW_NODE *remove_val(COW_NODE *node, int val){
+	if(val!=node->val){
+		node=writable(node);
+		if(val<node->val){node->left=remove_val(node->left,val);}
+		else{node->right=remove_val(node->right,val);}
+		return fix(node);
+	}
+
+	// a missing child lets the other take its place
+	if(node->left==NULL || node->right==NULL){
+		COW_NODE *child=(node->left!=NULL)?node->left:node->right;
+		drop(node);
+		return child;
+	}
+	// otherwise its successor moves up into a copy of it
+	node=writable(node);
+	node->right=remove_min(node->right,&(node->val));
+	return fix(node);
+}
+
+// returns 1 if val is in the version under node
+static int contains(COW_NODE *node, int val){
+	while(node!=NULL){
+		if(val==node->val){return 1;}
+		node=(val<node->val)?node->left:node->right;
+	}
+	return 0;
+}
+
+// swaps the new version in and retires the nodes only older versions used
+static void publish(COW_NODE *root){
+	int i;
+	__atomic_store_n(&cow_root,root,__ATOMIC_RELEASE);
+	for(i=0;i<stale_count;i++){
+		ebr_retire(stale[i]);
+	}
+	stale_count=0;
+}
+
+static void put_key(int val, void *arg){
+	snap_put((SNAP_WRITER *)arg,val);
+}
+
+
+
+// sets up an empty tree
+void cow_init(){
+	cow_root=NULL;
+	stamp=0;
+	cow_rots=0;
+}
+
+// adds a value, returns 1 if added
+int cow_add(int new_val){
+	int added=0;
+	pthread_mutex_lock(&cow_lock);
+	if(!contains(cow_root,new_val)){
+		stamp++;
+		publish(insert(cow_root,new_val));
+		added=1;
+	}
+	pthread_mutex_unlock(&cow_lock);
+	return added;
+}
+
+// deletes a value, returns 1 if deleted
+int cow_delete(int del_val){
+	int deleted=0;
+	pthread_mutex_lock(&cow_lock);
+	if(contains(cow_root,del_val)){
+		stamp++;
+		publish(remove_val(cow_root,del_val));
+		deleted=1;
+	}
+	pthread_mutex_unlock(&cow_lock);
+	return deleted;
+}
+
+// returns 1 if val is in the tree
+int cow_lookup(int val){
+	int found;
+	ebr_enter();
+	found=contains(__atomic_load_n(&cow_root,__ATOMIC_ACQUIRE),val);
+	ebr_exit();
+	return found;
+}
+
+// pins the current version and returns it (release on the same thread)
+COW_NODE *cow_snapshot(){
+	ebr_enter();
+	return __atomic_load_n(&cow_root,__ATOMIC_ACQUIRE);
+}
+
+// unpins the calling thread's snapshot
+void cow_release(){
+	ebr_exit();
+}
+
+// number of values in a snapshot
+long cow_snap_count(COW_NODE *snap){
+	return size(snap);
+}
+
+// calls callback on the keys of a snapshot in [lo,hi] in order, with a stack instead of recursion
+void cow_scan(COW_NODE *snap, int lo, int hi, void (*callback)(int val, void *arg), void *arg){
+	COW_NODE *stack[COW_MAX_HEIGHT], *node=snap;
+	int top=0;
+
+	while(node!=NULL || top>0){
+		// goes down the left of anything that could be in range
+		while(node!=NULL){
+			if(node->val<lo){node=node->right;}
+			else{
+				stack[top++]=node;
+				node=node->left;
+			}
+		}
+		node=stack[--top];
+		if(node->val>hi){return;}
+		callback(node->val,arg);
+		node=node->right;
+	}
+}
+
+// writes a snapshot of the tree to a snapshot file, returns the count (-1 on error)
+long cow_save(char *path){
+	SNAP_WRITER *writer=snap_create(path);
+	if(writer==NULL){return -1;}
+
+	// the updates carry on, the file just gets the version that was current here
+	COW_NODE *snap=cow_snapshot();
+	cow_scan(snap,INT_MIN,INT_MAX,put_key,writer);
+	cow_release();
+	return snap_finish(writer);
+}
+
+// prints the current version a level to a line (if it's 6 or fewer levels)
+void cow_print(){
+	COW_NODE *snap=cow_snapshot(), *node;
+	int levels=height(snap), d, i, j;
+
+	if(snap==NULL){printf("Tree is empty, can't print\n");}
+	else if(levels>6){printf("Tree too large to print\n");}
+	else{
+		for(d=0;d<levels;d++){
+			for(i=0;i<(1<<d);i++){
+				// follows the bits of i down from the root
+				node=snap;
+				for(j=d-1;j>=0 && node!=NULL;j--){
+					node=((i>>j)&1)?node->right:node->left;
+				}
+				if(node!=NULL){printf("%-*d",4<<(levels-1-d),node->val);}
+				else{printf("%-*s",4<<(levels-1-d),"-");}
+			}
+			printf("\n");
+		}
+	}
+	cow_release();
+}
+
+// number of values in the tree
+long cow_count(){
+	long count=cow_snap_count(cow_snapshot());
+	cow_release();
+	return count;
+}
+
+// bytes used by the current version's nodes
+long cow_bytes(){
+	return cow_count()*sizeof(COW_NODE);
+}
+
+// rotations done by updates so far
+long cow_rotations(){
+	return cow_rots;
+}
+
+// height of the current version
+int cow_height(){
+	int levels=height(cow_snapshot());
+	cow_release();
+	return levels;
+}
+
+// frees the tree (no other threads may be running)
+void cow_destroy(){
+	COW_NODE *stack[2*COW_MAX_HEIGHT], *node;
+	int top=0;
+
+	// walks the current version with an explicit stack
+	if(cow_root!=NULL){stack[top++]=cow_root;}
+	while(top>0){
+		node=stack[--top];
+		if(node->left!=NULL){stack[top++]=node->left;}
+		if(node->right!=NULL){stack[top++]=node->right;}
+		free(node);
+	}
+	ebr_flush();	// and the older versions' nodes still waiting
+	free(stale);
+	stale=NULL;
+	stale_cap=0;
+	cow_root=NULL;
+}
+
+
+ENGINE cow_engine={"copy-on-write AVL tree (path copying)",cow_init,cow_add,cow_delete,cow_lookup,NULL,cow_print,cow_count,cow_bytes,cow_rotations,cow_destroy,cow_height};
@@ -0,0 +1,35 @@
+#ifndef COW_H
+#define COW_H
+
+// Copy-on-write (path copying) AVL tree for consistent lock-free readers
+// Nodes are never changed once they're reachable from the root. An update copies
+// the nodes on the path down to where it lands (and any it rotates), rebalances
+// the copies on the way back up and publishes the new root with one atomic store,
+// so every root ever published is a complete, balanced, unchanging version of the
+// tree. A reader takes a snapshot by loading the root, which costs the same
+// however big the tree is, and can then walk, count, print or save that version
+// with no locks while the updates carry on around it. Updates are serialised by
+// one lock that readers never touch, and the nodes they replace go through ebr,
+// so a snapshot keeps every version since it was taken alive until it's released
+// (a long scan holds back reclamation, not the writers).
+
+typedef struct cow_node COW_NODE;
+
+void cow_init();								// sets up an empty tree
+int cow_add(int new_val);							// adds a value, returns 1 if added
+int cow_delete(int del_val);							// deletes a value, returns 1 if deleted
+int cow_lookup(int val);							// returns 1 if val is in the tree
+void cow_print();								// prints the current version (if it's small enough)
+long cow_count();								// number of values in the tree
+long cow_bytes();								// bytes used by the current version's nodes
+long cow_rotations();								// rotations done by updates so far
+int cow_height();								// height of the current version
+void cow_destroy();								// frees the tree (no other threads may be running)
+
+COW_NODE *cow_snapshot();							// pins the current version and returns it (release on the same thread)
+void cow_release();								// unpins the calling thread's snapshot
+long cow_snap_count(COW_NODE *snap);						// number of values in a snapshot
+void cow_scan(COW_NODE *snap, int lo, int hi, void (*callback)(int val, void *arg), void *arg);	// calls callback on the keys in [lo,hi] in order
+long cow_save(char *path);							// writes a snapshot of the tree to a snapshot file, returns the count (-1 on error)
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "ebr.h"
+
+#define EBR_BATCH 64		// number of retires between attempts to advance the epoch
+
+// a retired pointer and what frees it
+typedef struct retired{
+	void *ptr;
+	void (*release)(void *ptr);
+}RETIRED;
+
+// list of pointers retired in the same epoch
+typedef struct bag{
+	unsigned long epoch;	// global epoch when the pointers were retired
+	RETIRED *items;		// retired pointers
+	int count;
+	int cap;
+}BAG;
+
+// per thread record
+typedef struct ebr_rec{
+	unsigned long epoch;	// global epoch seen when the thread entered
+	int active;		// set while the thread is inside a critical section
+	int used;		// set while a thread owns this record
+	int nest;		// depth of nested ebr_enter calls
+	int retired;		// retires since the last advance attempt
+	BAG bags[3];		// one bag for each of the last three epochs
+}__attribute__((aligned(64))) EBR_REC;
+
+
+static EBR_REC recs[EBR_MAX_THREADS];
+static unsigned long global_epoch=0;
+static int num_recs=0;					// high water mark of records in use
+
+static __thread EBR_REC *my_rec=NULL;			// calling thread's record
+static pthread_key_t rec_key;				// used to release a record when its thread exits
+static pthread_once_t key_once=PTHREAD_ONCE_INIT;
+
+
+
+// releases a thread's record when the thread exits (its bags are kept for the next owner)
+static void release_rec(void *arg){
+	EBR_REC *rec=(EBR_REC *)arg;
+	rec->nest=0;
+	__atomic_store_n(&rec->active,0,__ATOMIC_RELEASE);
+	__atomic_store_n(&rec->used,0,__ATOMIC_RELEASE);
+}
+
+static void make_key(){
+	pthread_key_create(&rec_key,release_rec);
+}
+
+// finds (or claims) the calling thread's record
+static EBR_REC *get_rec(){
+	if(my_rec!=NULL){return my_rec;}
+	pthread_once(&key_once,make_key);
+
+	int i, old;
+	for(i=0;i<EBR_MAX_THREADS;i++){
+		// claims the first unused record
+		if(__atomic_load_n(&recs[i].used,__ATOMIC_ACQUIRE)==0 && __sync_bool_compare_and_swap(&recs[i].used,0,1)){
+			my_rec=&recs[i];
+			pthread_setspecific(rec_key,my_rec);
+
+			// bumps the high water mark so advance() scans this record
+			old=__atomic_load_n(&num_recs,__ATOMIC_ACQUIRE);
+			while(old<i+1 && !__sync_bool_compare_and_swap(&num_recs,old,i+1)){
+				old=__atomic_load_n(&num_recs,__ATOMIC_ACQUIRE);
+			}
+			return my_rec;
+		}
+	}
+	fprintf(stderr,"ebr: more than %d threads\n",EBR_MAX_THREADS);
+	exit(EXIT_FAILURE);
+}
+
+// frees everything in a bag
+static void empty_bag(BAG *bag){
+	int i;
+	for(i=0;i<bag->count;i++){
+		bag->items[i].release(bag->items[i].ptr);
+	}
+	bag->count=0;
+}
+
+// tries to move the global epoch on (only possible once every active thread has seen it)
+static void advance(){
+	unsigned long e=__atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST);
+	int i, n=__atomic_load_n(&num_recs,__ATOMIC_ACQUIRE);
+
+	for(i=0;i<n;i++){
+		if(__atomic_load_n(&recs[i].active,__ATOMIC_SEQ_CST) && __atomic_load_n(&recs[i].epoch,__ATOMIC_SEQ_CST)!=e){
+			return;
+		}
+	}
+	__sync_bool_compare_and_swap(&global_epoch,e,e+1);
+}
+
+
+
+// marks the calling thread as reading shared nodes
+void ebr_enter(){
+	EBR_REC *rec=get_rec();
+	if(rec->nest++>0){return;}	// only the outermost enter publishes
+
+	__atomic_store_n(&rec->epoch,__atomic_load_n(&global_epoch,__ATOMIC_ACQUIRE),__ATOMIC_RELAXED);
+	__atomic_store_n(&rec->active,1,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);	// publishes before any shared pointer is read
+}
+
+// marks the calling thread as quiescent
+void ebr_exit(){
+	EBR_REC *rec=my_rec;
+	if(--rec->nest>0){return;}
+	__atomic_store_n(&rec->active,0,__ATOMIC_RELEASE);
+}
+
+// frees ptr once no thread can reach it (ptr must already be unlinked)
+void ebr_retire(void *ptr){
+	ebr_retire_with(ptr,free);
+}
+
+// hands ptr to release once no thread can reach it, for memory malloc didn't give out
+void ebr_retire_with(void *ptr, void (*release)(void *ptr)){
+	EBR_REC *rec=get_rec();
+	unsigned long e=__atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST);
+	BAG *bag=&(rec->bags[e%3]);
+
+	// a bag from three or more epochs ago is safe to empty before reusing it
+	if(bag->epoch!=e){
+		empty_bag(bag);
+		bag->epoch=e;
+	}
+	if(bag->count==bag->cap){
+		bag->cap=(bag->cap==0)?EBR_BATCH:2*bag->cap;
+		bag->items=realloc(bag->items,bag->cap*sizeof(RETIRED));
+	}
+	bag->items[bag->count].ptr=ptr;
+	bag->items[bag->count++].release=release;
+
+	// every so often tries to advance the epoch and frees any bag two epochs old
+	if(++rec->retired>=EBR_BATCH){
+		rec->retired=0;
+		advance();
+		e=__atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST);
+		int i;
+		for(i=0;i<3;i++){
+			if(rec->bags[i].count>0 && rec->bags[i].epoch+2<=e){
+				empty_bag(&(rec->bags[i]));
+			}
+		}
+	}
+}
+
+// tries to move the epoch on now and frees what the calling thread retired that nothing can reach
+// any more, returns how many it's still holding (for a thread that retired a lot in one go)
+long ebr_collect(){
+	EBR_REC *rec=get_rec();
+	unsigned long e;
+	long left=0;
+	int i;
+
+	advance();
+	e=__atomic_load_n(&global_epoch,__ATOMIC_SEQ_CST);
+	for(i=0;i<3;i++){
+		if(rec->bags[i].count>0 && rec->bags[i].epoch+2<=e){
+			empty_bag(&(rec->bags[i]));
+		}
+		left+=rec->bags[i].count;
+	}
+	return left;
+}
+
+// frees everything retired (only call when no other threads are running)
+void ebr_flush(){
+	int i, j;
+	for(i=0;i<EBR_MAX_THREADS;i++){
+		for(j=0;j<3;j++){
+			empty_bag(&(recs[i].bags[j]));
+			free(recs[i].bags[j].items);
+			recs[i].bags[j].items=NULL;
+			recs[i].bags[j].cap=0;
+		}
+	}
+}
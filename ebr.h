@@ -0,0 +1,18 @@
+#ifndef EBR_H
+#define EBR_H
+
+// Epoch based reclamation for the non-blocking engines
+// A thread brackets every access to shared nodes with ebr_enter()/ebr_exit()
+// and hands unlinked nodes to ebr_retire(); they are freed once every thread
+// that could still hold a pointer to them has left its critical section
+
+#define EBR_MAX_THREADS 256							// max number of threads that can use ebr at once
+
+void ebr_enter();								// marks the calling thread as reading shared nodes
+void ebr_exit();								// marks the calling thread as quiescent
+void ebr_retire(void *ptr);							// frees ptr once no thread can reach it
+void ebr_retire_with(void *ptr, void (*release)(void *ptr));			// hands ptr to release instead of free once no thread can reach it
+long ebr_collect();								// frees what the calling thread retired that's safe now, returns how many are left
+void ebr_flush();								// frees everything retired (only call when no other threads are running)
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+// Interface the pthreads driver uses so different concurrent trees can be run
+// with the same threads, arguments and stats
+typedef struct engine{
+	char *name;			// printed in the stats
+	void (*init)();			// sets up an empty tree
+	int (*add)(int val);		// adds val, returns 1 if it was added
+	int (*del)(int val);		// deletes val, returns 1 if it was deleted
+	int (*lookup)(int val);		// returns 1 if val is in the tree
+	void (*balance)();		// rebalances the whole tree (NULL if the tree needs no balancer thread)
+	void (*print)();		// prints the tree (NULL if not supported)
+	long (*count)();		// number of values in the tree
+	long (*bytes)();		// bytes used by the tree's nodes
+	long (*rotations)();		// restructurings done to keep it balanced (NULL if none are done)
+	void (*destroy)();		// frees the tree (no other threads may be running)
+	int (*height)();		// levels from the root to the deepest node (NULL if not supported)
+}ENGINE;
+
+extern ENGINE avl_engine;		// lock coupled AVL tree (pthreads.c)
+extern ENGINE lfbst_engine;		// lock-free external BST (lfbst.c)
+extern ENGINE sl_engine;		// lazy skip list (skiplist.c)
+extern ENGINE bp_engine;		// OLC B+-tree (bptree.c)
+extern ENGINE rb_engine;		// red-black tree under one global lock (rbtree.c)
+extern ENGINE avlmap_engine;		// AVL map from libavl with 64-bit keys (avlmap.c)
+extern ENGINE cow_engine;		// copy-on-write AVL tree with lock-free snapshots (cow.c)
+extern ENGINE chromatic_engine;		// relaxed balance red-black tree (chromatic.c)
+
+#endif
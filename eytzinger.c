@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "eytzinger.h"
+
+#define EYTZ_LINE 64
+
+// a subtree of the layout for one thread to fill
+typedef struct fill_job{
+	int *keys;
+	int *sorted;
+	long n;
+	long k;			// index of the subtree's root
+	long offset;		// position in sorted of the subtree's smallest key
+}FILL_JOB;
+
+
+
+// number of indices in the subtree rooted at k that are no bigger than n
+static long subtree_size(long k, long n){
+	long size=0, first, width=1, level;
+	// each level down doubles the width of the subtree
+	for(first=k;first<=n;first=first*2){
+		level=n-first+1;
+		size+=(level<width)?level:width;
+		width*=2;
+	}
+	return size;
+}
+
+// fills the subtree rooted at k in order from sorted[offset], returns the next offset
+static long fill(int *keys, int *sorted, long n, long k, long offset){
+	if(k>n){return offset;}
+	offset=fill(keys,sorted,n,2*k,offset);
+	keys[k]=sorted[offset++];
+	return fill(keys,sorted,n,2*k+1,offset);
+}
+
+// pthreads function to fill one subtree
+static void *p_fill(void *arg){
+	FILL_JOB *job=(FILL_JOB *)arg;
+	fill(job->keys,job->sorted,job->n,job->k,job->offset);
+	return NULL;
+}
+
+// fills the top depth levels and hands out a job for each subtree below them
+static long plan_fill(int *keys, int *sorted, long n, long k, long offset, int depth, FILL_JOB *jobs, int *num_jobs){
+	if(k>n){return offset;}
+	if(depth==0){
+		jobs[*num_jobs].keys=keys;
+		jobs[*num_jobs].sorted=sorted;
+		jobs[*num_jobs].n=n;
+		jobs[*num_jobs].k=k;
+		jobs[*num_jobs].offset=offset;
+		(*num_jobs)++;
+		return offset+subtree_size(k,n);
+	}
+	offset=plan_fill(keys,sorted,n,2*k,offset,depth-1,jobs,num_jobs);
+	keys[k]=sorted[offset++];
+	return plan_fill(keys,sorted,n,2*k+1,offset,depth-1,jobs,num_jobs);
+}
+
+
+
+// lays out a sorted array using num_threads threads (free() the result)
+EYTZ *eytz_build(int *sorted, long n, int num_threads){
+	size_t size=sizeof(EYTZ)+(n+1)*sizeof(int);
+	EYTZ *e=(EYTZ *)aligned_alloc(EYTZ_LINE,(size+EYTZ_LINE-1)/EYTZ_LINE*EYTZ_LINE);
+	e->n=n;
+	e->keys[0]=0;
+
+	// one subtree per thread below the top depth levels
+	int depth=0, num_jobs=0, i;
+	while((1<<depth)<num_threads){depth++;}
+	FILL_JOB *jobs=malloc((1<<depth)*sizeof(FILL_JOB));
+	pthread_t *handles=malloc((1<<depth)*sizeof(pthread_t));
+
+	plan_fill(e->keys,sorted,n,1,0,depth,jobs,&num_jobs);
+	for(i=1;i<num_jobs;i++){
+		pthread_create(&handles[i],NULL,p_fill,(void *)&jobs[i]);
+	}
+	if(num_jobs>0){p_fill(&jobs[0]);}	// does the first one itself
+	for(i=1;i<num_jobs;i++){
+		pthread_join(handles[i],NULL);
+	}
+
+	free(jobs);
+	free(handles);
+	return e;
+}
+
+// returns 1 if val is in the set
+int eytz_search(EYTZ *e, int val){
+	long k=1, n=e->n;
+	int *keys=e->keys;
+
+	// goes right whenever the key is too small, so k ends up encoding the path taken
+	while(k<=n){
+		__builtin_prefetch(keys+(k<<EYTZ_PREFETCH));
+		k=2*k+(keys[k]<val);
+	}
+	// the last left turn was at the smallest key not below val
+	k>>=__builtin_ffsl(~k);
+	return (k!=0 && keys[k]==val);
+}
@@ -0,0 +1,21 @@
+#ifndef EYTZINGER_H
+#define EYTZINGER_H
+
+// Read only sorted set laid out in Eytzinger (BFS) order
+// keys[1] is the root and keys[k] has children keys[2k] and keys[2k+1], so a
+// search is index arithmetic with no pointers to chase and no branches to
+// mispredict. The 16 descendants four levels down share one cache line, so
+// each step prefetches the line it will need four steps later.
+
+#define EYTZ_PREFETCH 4								// levels ahead to prefetch
+
+typedef struct eytz{
+	long n;					// number of keys
+	char pad[56];				// keeps keys on a cache line boundary
+	int keys[];				// keys[1..n] in BFS order (keys[0] unused)
+}EYTZ;
+
+EYTZ *eytz_build(int *sorted, long n, int num_threads);			// lays out a sorted array using num_threads threads (free() the result)
+int eytz_search(EYTZ *e, int val);						// returns 1 if val is in the set
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include "filter.h"
+
+#define BIT(key) (1UL<<((key)&63))
+
+
+
+// spreads a key over 64 bits (splitmix64's finaliser)
+static unsigned long mix(int key){
+	unsigned long h=(unsigned int)key;
+	h=(h^(h>>30))*0xBF58476D1CE4E5B9UL;
+	h=(h^(h>>27))*0x94D049BB133111EBUL;
+	return h^(h>>31);
+}
+
+// counter probe i of a key (double hashing from the two halves of its mix)
+static unsigned char *counter(FILTER *f, unsigned long h, int i){
+	return &(f->counts[((h&0xFFFFFFFFUL)+i*((h>>32)|1))&f->mask]);
+}
+
+// adds one to a counter unless it's stuck at 255
+static void count_up(unsigned char *c){
+	unsigned char old=__atomic_load_n(c,__ATOMIC_RELAXED);
+	while(old<255 && !__atomic_compare_exchange_n(c,&old,old+1,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED)){}
+}
+
+// takes one off a counter unless it's stuck at 255 (it can't know how many it stands for)
+static void count_down(unsigned char *c){
+	unsigned char old=__atomic_load_n(c,__ATOMIC_RELAXED);
+	while(old>0 && old<255 && !__atomic_compare_exchange_n(c,&old,old-1,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED)){}
+}
+
+
+
+// a bitmap for keys in [0,range), or a Bloom filter if that's too many
+FILTER *filter_create(long range){
+	FILTER *f=malloc(sizeof(FILTER));
+	f->bits=NULL;
+	f->counts=NULL;
+	f->range=range;
+	f->mask=0;
+	if(range<=FILTER_BITMAP_KEYS){f->bits=calloc((range+63)/64,sizeof(unsigned long));}
+	else{
+		f->counts=calloc(FILTER_BLOOM_COUNTERS,1);
+		f->mask=FILTER_BLOOM_COUNTERS-1;
+	}
+	return f;
+}
+
+// FILTER_ABSENT, FILTER_PRESENT or FILTER_MAYBE
+int filter_check(FILTER *f, int key){
+	int i;
+	if(f->bits!=NULL){
+		if(key<0 || key>=f->range){return FILTER_MAYBE;}
+		return (__atomic_load_n(&(f->bits[key/64]),__ATOMIC_ACQUIRE)&BIT(key))?FILTER_PRESENT:FILTER_ABSENT;
+	}
+	unsigned long h=mix(key);
+	for(i=0;i<FILTER_PROBES;i++){
+		if(__atomic_load_n(counter(f,h,i),__ATOMIC_ACQUIRE)==0){return FILTER_ABSENT;}
+	}
+	return FILTER_MAYBE;
+}
+
+// counts a key in (where its add takes effect)
+void filter_add(FILTER *f, int key){
+	int i;
+	if(f->bits!=NULL){
+		if(key>=0 && key<f->range){__atomic_fetch_or(&(f->bits[key/64]),BIT(key),__ATOMIC_RELEASE);}
+		return;
+	}
+	unsigned long h=mix(key);
+	for(i=0;i<FILTER_PROBES;i++){
+		count_up(counter(f,h,i));
+	}
+}
+
+// counts a key out (where its delete takes effect)
+void filter_remove(FILTER *f, int key){
+	int i;
+	if(f->bits!=NULL){
+		if(key>=0 && key<f->range){__atomic_fetch_and(&(f->bits[key/64]),~BIT(key),__ATOMIC_RELEASE);}
+		return;
+	}
+	unsigned long h=mix(key);
+	for(i=0;i<FILTER_PROBES;i++){
+		count_down(counter(f,h,i));
+	}
+}
+
+// clears [lo,hi] from a bitmap once every key in it has been cut out
+// a Bloom filter can't tell which counters the cut keys had, so it waits for filter_forget
+void filter_remove_range(FILTER *f, int lo, int hi){
+	long first, last, w;
+	if(f->bits==NULL){return;}
+	first=(lo<0)?0:lo;
+	last=(hi>=f->range)?f->range-1:hi;
+	if(first>last){return;}
+
+	// the partial words at each end keep their other bits, whole words in between are just zeroed
+	for(w=first/64;w<=last/64;w++){
+		unsigned long keep=0;
+		if(w==first/64){keep|=BIT(first)-1;}
+		if(w==last/64 && (last&63)!=63){keep|=~((BIT(last)<<1)-1);}
+		if(keep==0){__atomic_store_n(&(f->bits[w]),0,__ATOMIC_RELEASE);}
+		else{__atomic_fetch_and(&(f->bits[w]),keep,__ATOMIC_RELEASE);}
+	}
+}
+
+// counts a cut out key out of a Bloom filter as its node is freed (nothing for a bitmap, whose range was cleared)
+void filter_forget(FILTER *f, int key){
+	if(f->counts!=NULL){filter_remove(f,key);}
+}
+
+// empties it (no other threads may be using it)
+void filter_reset(FILTER *f){
+	if(f->bits!=NULL){memset(f->bits,0,((f->range+63)/64)*sizeof(unsigned long));}
+	else{memset(f->counts,0,FILTER_BLOOM_COUNTERS);}
+}
+
+// returns 1 for a bitmap
+int filter_exact(FILTER *f){
+	return f->bits!=NULL;
+}
+
+// bytes it takes up
+long filter_bytes(FILTER *f){
+	if(f->bits!=NULL){return ((f->range+63)/64)*sizeof(unsigned long);}
+	return FILTER_BLOOM_COUNTERS;
+}
+
+// frees it
+void filter_destroy(FILTER *f){
+	free(f->bits);
+	free(f->counts);
+	free(f);
+}
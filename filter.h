@@ -0,0 +1,42 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+// Membership filter the lock coupled tree checks before it walks down
+// For a bounded key range it's a bitmap with a bit per key, set where an add links
+// its node and cleared where a delete unlinks one (while the node is still locked, so
+// anything that locks its way down sees the bit and the tree agree). A clear bit then
+// means the key isn't there and a set bit that it is, so deletes of missing keys,
+// duplicate adds and lookups are answered from one word without a node lock. Keys
+// outside the range aren't covered.
+// A range too big for a bitmap gets a counting Bloom filter instead (FILTER_PROBES
+// byte counters per key), where a zero counter means the key isn't there and anything
+// else that it might be, so only misses are answered. Counters stick at 255 and keys
+// cut out by delete_range are counted out as they're freed, which only ever makes the
+// filter less sure, never wrong
+
+#define FILTER_ABSENT 0			// the key isn't in the tree
+#define FILTER_PRESENT 1		// the key is in the tree
+#define FILTER_MAYBE 2			// the filter can't tell, so the tree has to be walked
+#define FILTER_BITMAP_KEYS (1L<<28)	// biggest range given a bitmap (32MB), anything bigger gets a Bloom filter
+#define FILTER_BLOOM_COUNTERS (1L<<24)	// counters in a Bloom filter (16MB)
+#define FILTER_PROBES 3			// counters each key maps to in a Bloom filter
+
+typedef struct filter{
+	unsigned long *bits;		// a bit per key in [0,range) (NULL for a Bloom filter)
+	long range;
+	unsigned char *counts;		// Bloom filter counters (NULL for a bitmap)
+	long mask;			// number of counters less one
+}FILTER;
+
+FILTER *filter_create(long range);						// a bitmap for keys in [0,range), or a Bloom filter if that's too many
+int filter_check(FILTER *f, int key);						// FILTER_ABSENT, FILTER_PRESENT or FILTER_MAYBE
+void filter_add(FILTER *f, int key);						// counts a key in (where its add takes effect)
+void filter_remove(FILTER *f, int key);						// counts a key out (where its delete takes effect)
+void filter_remove_range(FILTER *f, int lo, int hi);				// clears [lo,hi] from a bitmap once it's all cut out (Bloom filters wait for filter_forget)
+void filter_forget(FILTER *f, int key);						// counts a cut out key out of a Bloom filter as its node is freed (nothing for a bitmap)
+void filter_reset(FILTER *f);							// empties it (no other threads may be using it)
+int filter_exact(FILTER *f);							// returns 1 for a bitmap
+long filter_bytes(FILTER *f);							// bytes it takes up
+void filter_destroy(FILTER *f);							// frees it
+
+#endif
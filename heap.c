@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "heap.h"
+
+
+// sets up an empty heap
+void heap_init(HEAP *h){
+	pthread_mutex_init(&(h->lock),NULL);
+	h->cap=1024;
+	h->keys=malloc(h->cap*sizeof(int));
+	h->n=0;
+}
+
+// adds a key (duplicates are kept)
+void heap_push(HEAP *h, int key){
+	long i, up;
+
+	pthread_mutex_lock(&(h->lock));
+	if(h->n==h->cap){
+		h->cap*=2;
+		h->keys=realloc(h->keys,h->cap*sizeof(int));
+	}
+
+	// sifts the key up from the end until its parent is smaller
+	i=h->n++;
+	while(i>0){
+		up=(i-1)/2;
+		if(h->keys[up]<=key){break;}
+		h->keys[i]=h->keys[up];
+		i=up;
+	}
+	h->keys[i]=key;
+	pthread_mutex_unlock(&(h->lock));
+}
+
+// takes the smallest key, returns 0 if the heap is empty
+int heap_pop(HEAP *h, int *key){
+	long i, down;
+	int last;
+
+	pthread_mutex_lock(&(h->lock));
+	if(h->n==0){
+		pthread_mutex_unlock(&(h->lock));
+		return 0;
+	}
+	*key=h->keys[0];
+
+	// sifts the last key down from the top until both children are bigger
+	last=h->keys[--h->n];
+	i=0;
+	while((down=2*i+1)<h->n){
+		if(down+1<h->n && h->keys[down+1]<h->keys[down]){down++;}
+		if(last<=h->keys[down]){break;}
+		h->keys[i]=h->keys[down];
+		i=down;
+	}
+	h->keys[i]=last;
+	pthread_mutex_unlock(&(h->lock));
+	return 1;
+}
+
+// frees the heap's keys
+void heap_destroy(HEAP *h){
+	free(h->keys);
+	h->keys=NULL;
+	h->n=h->cap=0;
+	pthread_mutex_destroy(&(h->lock));
+}
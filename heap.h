@@ -0,0 +1,23 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <pthread.h>
+
+// Binary min heap behind one lock
+// The usual concurrent priority queue, kept as the baseline to time the
+// tree's pop_min against. Every push and pop sifts under the same lock, so
+// it's as fast as one thread can go no matter how many use it.
+
+typedef struct heap{
+	pthread_mutex_t lock;
+	int *keys;				// keys[0] is the smallest
+	long n;
+	long cap;
+}HEAP;
+
+void heap_init(HEAP *h);							// sets up an empty heap
+void heap_push(HEAP *h, int key);						// adds a key (duplicates are kept)
+int heap_pop(HEAP *h, int *key);						// takes the smallest key, returns 0 if the heap is empty
+void heap_destroy(HEAP *h);							// frees the heap's keys
+
+#endif
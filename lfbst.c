@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include "lfbst.h"
+#include "engine.h"
+#include "ebr.h"
+
+// edge marks stored in the low bits of the child pointers
+#define FLAG ((uintptr_t)1)		// the leaf at the end of the edge is being deleted
+#define TAG ((uintptr_t)2)		// the edge is frozen because its sibling leaf is being deleted
+#define ADDR(e) ((LF_NODE *)((e)&~(FLAG|TAG)))
+
+// sentinel values (bigger than any int, so every int can be added)
+#define INF0 ((int64_t)INT_MAX+1)
+#define INF1 ((int64_t)INT_MAX+2)
+#define INF2 ((int64_t)INT_MAX+3)
+
+// set up node structure (leaves have both children 0)
+typedef struct lf_node{
+	int64_t val;		// leaf's value or internal node's routing value (wide enough for the sentinels, and no bigger padded)
+	uintptr_t left;		// child pointers with their marks
+	uintptr_t right;
+}LF_NODE;
+
+// nodes found on the way to a leaf
+typedef struct seek_record{
+	LF_NODE *ancestor;	// last node whose edge into successor is untagged
+	LF_NODE *successor;
+	LF_NODE *parent;	// leaf's parent
+	LF_NODE *leaf;		// leaf the search ended at
+}SEEK_RECORD;
+
+
+// sentinel internal nodes (the real tree hangs off the left of root_s)
+static LF_NODE *root_r, *root_s;
+static long lf_count=0;
+
+
+
+// allocates a node and sets up its values
+static LF_NODE *new_node(int64_t val, uintptr_t left, uintptr_t right){
+	LF_NODE *node=(LF_NODE *)malloc(sizeof(LF_NODE));
+	node->val=val;
+	node->left=left;
+	node->right=right;
+	return node;
+}
+
+// returns the address of the child pointer to follow for val
+static uintptr_t *child_addr(LF_NODE *node, int val){
+	if(val<node->val){return &(node->left);}
+	return &(node->right);
+}
+
+// walks from the root to the leaf where val is or would be, filling in s
+static void seek(int val, SEEK_RECORD *s){
+	uintptr_t parent_field, current_field;
+	LF_NODE *current;
+
+	s->ancestor=root_r;
+	s->successor=root_s;
+	s->parent=root_s;
+	parent_field=__atomic_load_n(&(root_s->left),__ATOMIC_ACQUIRE);
+	s->leaf=ADDR(parent_field);
+
+	current_field=__atomic_load_n(&(s->leaf->left),__ATOMIC_ACQUIRE);
+	current=ADDR(current_field);
+
+	// loops until it steps off a leaf
+	while(current!=NULL){
+		// moves ancestor down whenever the edge just taken isn't frozen
+		if((parent_field&TAG)==0){
+			s->ancestor=s->parent;
+			s->successor=s->leaf;
+		}
+		s->parent=s->leaf;
+		s->leaf=current;
+		parent_field=current_field;
+
+		current_field=__atomic_load_n(child_addr(current,val),__ATOMIC_ACQUIRE);
+		current=ADDR(current_field);
+	}
+}
+
+// hands the nodes unlinked by a cleanup to the reclaimer
+// every node from successor down to parent goes, along with its flagged leaf
+static void retire_removed(int val, LF_NODE *successor, LF_NODE *parent, LF_NODE *leaf){
+	LF_NODE *node=successor, *next;
+	uintptr_t path, other;
+
+	// nodes above parent have a frozen edge along the path and a flagged leaf off it
+	while(node!=parent){
+		if(val<node->val){path=node->left;other=node->right;}
+		else{path=node->right;other=node->left;}
+		next=ADDR(path);
+		ebr_retire(ADDR(other));
+		ebr_retire(node);
+		node=next;
+	}
+	ebr_retire(leaf);
+	ebr_retire(parent);
+}
+
+// removes a flagged leaf and its parent by swinging the ancestor's edge to the leaf's sibling
+// returns 1 if this thread's CAS did the removal
+static int cleanup(int val, SEEK_RECORD *s){
+	LF_NODE *ancestor=s->ancestor, *successor=s->successor, *parent=s->parent;
+	uintptr_t *succ_addr, *child, *sibling, field;
+
+	succ_addr=child_addr(ancestor,val);
+	if(val<parent->val){child=&(parent->left);sibling=&(parent->right);}
+	else{child=&(parent->right);sibling=&(parent->left);}
+
+	// if the leaf on val's side isn't flagged then it's the other one being deleted
+	if((__atomic_load_n(child,__ATOMIC_ACQUIRE)&FLAG)==0){
+		uintptr_t *temp=child;
+		child=sibling;
+		sibling=temp;
+	}
+
+	// freezes the sibling's edge and moves it up to the ancestor (keeping its flag)
+	field=__atomic_or_fetch(sibling,TAG,__ATOMIC_SEQ_CST);
+	if(__sync_bool_compare_and_swap(succ_addr,(uintptr_t)successor,field&~TAG)){
+		retire_removed(val,successor,parent,ADDR(*child));
+		return 1;
+	}
+	return 0;
+}
+
+
+
+// sets up the sentinel nodes of an empty tree
+void lfbst_init(){
+	LF_NODE *leaf0=new_node(INF0,0,0), *leaf1=new_node(INF1,0,0), *leaf2=new_node(INF2,0,0);
+	root_s=new_node(INF1,(uintptr_t)leaf0,(uintptr_t)leaf1);
+	root_r=new_node(INF2,(uintptr_t)root_s,(uintptr_t)leaf2);
+	lf_count=0;
+}
+
+// adds a value to the tree, returns 1 if added
+int lfbst_add(int new_val){
+	SEEK_RECORD s;
+	LF_NODE *new_leaf=new_node(new_val,0,0), *new_internal=new_node(0,0,0);
+	LF_NODE *leaf;
+	uintptr_t *addr, field;
+
+	ebr_enter();
+	while(1){
+		seek(new_val,&s);
+		leaf=s.leaf;
+
+		// value is already in the tree so free up the new nodes
+		if(leaf->val==new_val){
+			ebr_exit();
+			free(new_leaf);
+			free(new_internal);
+			return 0;
+		}
+
+		// the new internal node routes between the new leaf and the old one
+		if(new_val<leaf->val){
+			new_internal->val=leaf->val;
+			new_internal->left=(uintptr_t)new_leaf;
+			new_internal->right=(uintptr_t)leaf;
+		}
+		else{
+			new_internal->val=new_val;
+			new_internal->left=(uintptr_t)leaf;
+			new_internal->right=(uintptr_t)new_leaf;
+		}
+
+		// swaps it in for the leaf if the edge is still clean
+		addr=child_addr(s.parent,new_val);
+		if(__sync_bool_compare_and_swap(addr,(uintptr_t)leaf,(uintptr_t)new_internal)){
+			__sync_fetch_and_add(&lf_count,1);
+			ebr_exit();
+			return 1;
+		}
+
+		// helps a delete that got in the way before trying again
+		field=__atomic_load_n(addr,__ATOMIC_ACQUIRE);
+		if(ADDR(field)==leaf && (field&(FLAG|TAG))!=0){
+			cleanup(new_val,&s);
+		}
+	}
+}
+
+// deletes a value from the tree, returns 1 if deleted
+int lfbst_delete(int del_val){
+	SEEK_RECORD s;
+	LF_NODE *leaf=NULL;
+	uintptr_t *addr, field;
+	int injecting=1;
+
+	ebr_enter();
+	while(1){
+		seek(del_val,&s);
+		addr=child_addr(s.parent,del_val);
+
+		// first flags the edge to the leaf (this is where the delete takes effect)
+		if(injecting){
+			leaf=s.leaf;
+			if(leaf->val!=del_val){
+				ebr_exit();
+				return 0;
+			}
+			if(__sync_bool_compare_and_swap(addr,(uintptr_t)leaf,(uintptr_t)leaf|FLAG)){
+				injecting=0;
+				if(cleanup(del_val,&s)){break;}
+			}
+			else{
+				// helps whichever delete got in the way
+				field=__atomic_load_n(addr,__ATOMIC_ACQUIRE);
+				if(ADDR(field)==leaf && (field&(FLAG|TAG))!=0){
+					cleanup(del_val,&s);
+				}
+			}
+		}
+		// then keeps trying to unlink it until it's gone (possibly removed by another thread)
+		else{
+			if(s.leaf!=leaf){break;}
+			if(cleanup(del_val,&s)){break;}
+		}
+	}
+	__sync_fetch_and_sub(&lf_count,1);
+	ebr_exit();
+	return 1;
+}
+
+// returns 1 if val is in the tree
+int lfbst_lookup(int val){
+	SEEK_RECORD s;
+	int found;
+
+	ebr_enter();
+	seek(val,&s);
+	found=(s.leaf->val==val);
+	ebr_exit();
+	return found;
+}
+
+// number of values in the tree
+long lfbst_count(){
+	return __atomic_load_n(&lf_count,__ATOMIC_ACQUIRE);
+}
+
+// bytes used by the tree's nodes (every value has a leaf and an internal node, plus 5 sentinels)
+long lfbst_bytes(){
+	return (2*lfbst_count()+5)*sizeof(LF_NODE);
+}
+
+// frees the tree (no other threads may be running)
+void lfbst_destroy(){
+	LF_NODE **stack, *node;
+	int top=0, cap=64;
+
+	// walks the tree with an explicit stack
+	stack=malloc(cap*sizeof(LF_NODE *));
+	stack[top++]=root_r;
+	while(top>0){
+		node=stack[--top];
+		if(top+2>cap){
+			cap*=2;
+			stack=realloc(stack,cap*sizeof(LF_NODE *));
+		}
+		if(ADDR(node->left)!=NULL){stack[top++]=ADDR(node->left);}
+		if(ADDR(node->right)!=NULL){stack[top++]=ADDR(node->right);}
+		free(node);
+	}
+	free(stack);
+	ebr_flush();	// and everything waiting to be reclaimed
+	root_r=root_s=NULL;
+}
+
+
+ENGINE lfbst_engine={"lock-free BST",lfbst_init,lfbst_add,lfbst_delete,lfbst_lookup,NULL,NULL,lfbst_count,lfbst_bytes,NULL,lfbst_destroy,NULL};
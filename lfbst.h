@@ -0,0 +1,18 @@
+#ifndef LFBST_H
+#define LFBST_H
+
+// Lock-free external binary search tree (Natarajan and Mittal, PPoPP 2014)
+// Values live in the leaves, internal nodes only route. Deletes flag the edge
+// to the leaf and tag the sibling's edge so neither can change, then any thread
+// that runs into the marked edges swings the grandparent past them. No thread
+// ever waits on another, so a preempted thread can't stall the rest.
+
+void lfbst_init();								// sets up the sentinel nodes of an empty tree
+int lfbst_add(int new_val);							// adds a value, returns 1 if added
+int lfbst_delete(int del_val);							// deletes a value, returns 1 if deleted
+int lfbst_lookup(int val);							// returns 1 if val is in the tree
+long lfbst_count();								// number of values in the tree
+long lfbst_bytes();								// bytes used by the tree's nodes
+void lfbst_destroy();								// frees the tree (no other threads may be running)
+
+#endif
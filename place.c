@@ -0,0 +1,272 @@
+#define _GNU_SOURCE		// for the cpu set macros and pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "place.h"
+
+// the kernel's mbind modes (as in numaif.h, so libnuma isn't needed)
+#define MODE_BIND 2
+#define MODE_INTERLEAVE 3
+
+// what it knows about a cpu
+typedef struct cpu_info{
+	int cpu;
+	int node;		// NUMA node it's in
+	int package;		// socket
+	int core;		// core id within the socket
+	int sibling;		// which hyperthread of its core it is (0 for the first)
+}CPU_INFO;
+
+static CPU_INFO cpus[PLACE_MAX_CPUS];			// cpus this process can run on, in id order
+static int num_cpus=0;
+static int node_of[PLACE_MAX_CPUS];			// NUMA node of every cpu by id
+static int memory_nodes[PLACE_MAX_NODES];		// nodes with memory
+static int num_memory_nodes=0;
+static int order[PLACE_MAX_CPUS];			// cpus in the order slots get them
+static int num_order=0;
+static int policy=PLACE_NONE;
+static pthread_once_t topology_once=PTHREAD_ONCE_INIT;
+
+
+
+// reads the first line of a file into buf, returns 0 if it isn't there
+static int read_line(char *path, char *buf, int size){
+	FILE *in=fopen(path,"r");
+	if(in==NULL){return 0;}
+	if(fgets(buf,size,in)==NULL){buf[0]='\0';}
+	fclose(in);
+	return 1;
+}
+
+// reads a file holding one number (fallback if it isn't there)
+static int read_int(char *path, int fallback){
+	char buf[32];
+	if(!read_line(path,buf,sizeof(buf))){return fallback;}
+	return atoi(buf);
+}
+
+// calls add on every number in a list like "0-3,8,10-11", returns 0 if it isn't one
+static int parse_list(char *list, void (*add)(int n, void *arg), void *arg){
+	char *p=list, *end;
+	long lo, hi, n;
+	while(*p!='\0' && *p!='\n'){
+		lo=strtol(p,&end,10);
+		if(end==p || lo<0){return 0;}
+		hi=lo;
+		p=end;
+		if(*p=='-'){
+			hi=strtol(p+1,&end,10);
+			if(end==p+1 || hi<lo){return 0;}
+			p=end;
+		}
+		for(n=lo;n<=hi;n++){
+			add((int)n,arg);
+		}
+		if(*p==','){p++;}
+		else if(*p!='\0' && *p!='\n'){return 0;}
+	}
+	return 1;
+}
+
+// parse_list callbacks
+static void mark_node(int cpu, void *arg){
+	if(cpu<PLACE_MAX_CPUS){node_of[cpu]=*(int *)arg;}
+}
+
+static void add_memory_node(int node, void *arg){
+	(void)arg;
+	if(num_memory_nodes<PLACE_MAX_NODES && node<PLACE_MAX_NODES){memory_nodes[num_memory_nodes++]=node;}
+}
+
+static void add_listed(int cpu, void *arg){
+	(void)arg;
+	if(num_order<PLACE_MAX_CPUS){order[num_order++]=cpu;}
+}
+
+// reads the topology from /sys (once)
+static void load_topology(){
+	cpu_set_t allowed;
+	char path[128], buf[4096];
+	int cpu, node, j;
+
+	for(node=0;node<PLACE_MAX_NODES;node++){
+		snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",node);
+		if(read_line(path,buf,sizeof(buf))){parse_list(buf,mark_node,&node);}
+	}
+	if(read_line("/sys/devices/system/node/has_memory",buf,sizeof(buf))){parse_list(buf,add_memory_node,NULL);}
+	if(num_memory_nodes==0){memory_nodes[num_memory_nodes++]=0;}
+
+	// only the cpus this process is allowed on
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0,sizeof(allowed),&allowed)!=0){CPU_SET(0,&allowed);}
+	for(cpu=0;cpu<PLACE_MAX_CPUS && cpu<CPU_SETSIZE;cpu++){
+		if(!CPU_ISSET(cpu,&allowed)){continue;}
+		CPU_INFO *c=&cpus[num_cpus++];
+		c->cpu=cpu;
+		c->node=node_of[cpu];
+		snprintf(path,sizeof(path),"/sys/devices/system/cpu/cpu%d/topology/physical_package_id",cpu);
+		c->package=read_int(path,0);
+		snprintf(path,sizeof(path),"/sys/devices/system/cpu/cpu%d/topology/core_id",cpu);
+		c->core=read_int(path,cpu);
+		c->sibling=0;
+		for(j=0;j<num_cpus-1;j++){
+			if(cpus[j].package==c->package && cpus[j].core==c->core){c->sibling++;}
+		}
+	}
+}
+
+// qsort comparison putting cpus in compact order (node, then first hyperthreads before second ones, then socket and core)
+static int compare_compact(const void *a, const void *b){
+	const CPU_INFO *x=(const CPU_INFO *)a, *y=(const CPU_INFO *)b;
+	if(x->node!=y->node){return x->node-y->node;}
+	if(x->sibling!=y->sibling){return x->sibling-y->sibling;}
+	if(x->package!=y->package){return x->package-y->package;}
+	if(x->core!=y->core){return x->core-y->core;}
+	return x->cpu-y->cpu;
+}
+
+// the cpu's info (NULL if this process can't run on it)
+static CPU_INFO *find_cpu(int cpu){
+	int i;
+	for(i=0;i<num_cpus;i++){
+		if(cpus[i].cpu==cpu){return &cpus[i];}
+	}
+	return NULL;
+}
+
+// calls mbind on a range with a mask of nodes
+static void bind_range(void *addr, long bytes, int mode, int *nodes, int n){
+	unsigned long mask[PLACE_MAX_NODES/64]={0};
+	int i;
+	for(i=0;i<n;i++){
+		mask[nodes[i]/64]|=1UL<<(nodes[i]%64);
+	}
+	syscall(SYS_mbind,addr,bytes,mode,mask,PLACE_MAX_NODES+1,0);
+}
+
+
+
+// sets the policy from "compact", "scatter" or a cpu list, returns 0 if it can't
+int place_parse(char *spec){
+	static CPU_INFO sorted[PLACE_MAX_CPUS];
+	int start[PLACE_MAX_NODES], count[PLACE_MAX_NODES];
+	int i, k, r, nodes=0, most=0;
+
+	pthread_once(&topology_once,load_topology);
+	num_order=0;
+	if(strcmp(spec,"compact")==0 || strcmp(spec,"scatter")==0){
+		memcpy(sorted,cpus,num_cpus*sizeof(CPU_INFO));
+		qsort(sorted,num_cpus,sizeof(CPU_INFO),compare_compact);
+		if(spec[0]=='c'){
+			for(i=0;i<num_cpus;i++){order[num_order++]=sorted[i].cpu;}
+			policy=PLACE_COMPACT;
+			return 1;
+		}
+
+		// scatter deals each node's cpus out in turn (they're together in compact order)
+		for(i=0;i<num_cpus;i++){
+			if(i==0 || sorted[i].node!=sorted[i-1].node){
+				start[nodes]=i;
+				count[nodes++]=0;
+			}
+			if(++count[nodes-1]>most){most=count[nodes-1];}
+		}
+		for(r=0;r<most;r++){
+			for(k=0;k<nodes;k++){
+				if(r<count[k]){order[num_order++]=sorted[start[k]+r].cpu;}
+			}
+		}
+		policy=PLACE_SCATTER;
+		return 1;
+	}
+
+	// anything else has to be a list of cpus this process can use
+	if(!parse_list(spec,add_listed,NULL) || num_order==0){
+		num_order=0;
+		return 0;
+	}
+	for(i=0;i<num_order;i++){
+		if(find_cpu(order[i])==NULL){
+			num_order=0;
+			return 0;
+		}
+	}
+	policy=PLACE_LIST;
+	return 1;
+}
+
+// PLACE_NONE, PLACE_COMPACT, PLACE_SCATTER or PLACE_LIST
+int place_policy(){
+	return policy;
+}
+
+// "none", "compact", "scatter" or "list"
+char *place_name(){
+	static char *names[]={"none","compact","scatter","list"};
+	return names[policy];
+}
+
+// cpu a slot gets (-1 with PLACE_NONE)
+int place_cpu(int slot){
+	if(policy==PLACE_NONE || num_order==0){return -1;}
+	return order[slot%num_order];
+}
+
+// pins a thread to the cpu for that slot (nothing with PLACE_NONE)
+void place_pin(pthread_t thread, int slot){
+	cpu_set_t set;
+	int cpu=place_cpu(slot);
+	if(cpu<0){return;}
+	CPU_ZERO(&set);
+	CPU_SET(cpu,&set);
+	pthread_setaffinity_np(thread,sizeof(set),&set);
+}
+
+// NUMA nodes the first that many slots run on (every node it can use if not pinned)
+int place_spread(int threads){
+	int seen[PLACE_MAX_NODES]={0};
+	int i, n, spread=0;
+	CPU_INFO *c;
+
+	pthread_once(&topology_once,load_topology);
+	n=(policy==PLACE_NONE)?num_cpus:((threads<num_order)?threads:num_order);
+	for(i=0;i<n;i++){
+		c=(policy==PLACE_NONE)?&cpus[i]:find_cpu(order[i]);
+		if(c!=NULL && c->node<PLACE_MAX_NODES && !seen[c->node]){
+			seen[c->node]=1;
+			spread++;
+		}
+	}
+	return (spread>0)?spread:1;
+}
+
+// cpus this process can run on
+int place_cpus(){
+	pthread_once(&topology_once,load_topology);
+	return num_cpus;
+}
+
+// fills in the ids of the NUMA nodes with memory, returns how many
+int place_memory_nodes(int *nodes){
+	pthread_once(&topology_once,load_topology);
+	memcpy(nodes,memory_nodes,num_memory_nodes*sizeof(int));
+	return num_memory_nodes;
+}
+
+// puts a mapped range's pages on a NUMA node (before they're touched)
+void place_bind(void *addr, long bytes, int node){
+	pthread_once(&topology_once,load_topology);
+	if(num_memory_nodes<=1 || node<0 || node>=PLACE_MAX_NODES){return;}
+	bind_range(addr,bytes,MODE_BIND,&node,1);
+}
+
+// spreads a mapped range's pages over every node with memory
+void place_interleave(void *addr, long bytes){
+	pthread_once(&topology_once,load_topology);
+	if(num_memory_nodes<=1){return;}
+	bind_range(addr,bytes,MODE_INTERLEAVE,memory_nodes,num_memory_nodes);
+}
@@ -0,0 +1,35 @@
+#ifndef PLACE_H
+#define PLACE_H
+
+#include <pthread.h>
+
+// Thread pinning and NUMA placement
+// The topology comes from /sys (the cpus this process may run on, which NUMA node
+// each is in and which core), so nothing beyond libc is needed and a machine
+// without NUMA just looks like one node. Thread slot i gets the i-th cpu of an
+// order the policy picks, wrapping round if there are more threads than cpus:
+//	compact	one NUMA node's cores before the next's (their hyperthreads after them)
+//	scatter	dealt round the NUMA nodes (a core on each node, then the next core on each)
+//	list	the cpus given, in that order ("0,2,8-11")
+// Memory is placed with the mbind system call: a range can be bound to a node or
+// interleaved page by page over every node with memory (both do nothing on one node)
+
+#define PLACE_NONE 0			// threads go wherever the scheduler puts them
+#define PLACE_COMPACT 1
+#define PLACE_SCATTER 2
+#define PLACE_LIST 3
+#define PLACE_MAX_CPUS 1024		// most cpus it keeps track of
+#define PLACE_MAX_NODES 64		// most NUMA nodes it keeps track of
+
+int place_parse(char *spec);							// sets the policy from "compact", "scatter" or a cpu list, returns 0 if it can't
+int place_policy();								// PLACE_NONE, PLACE_COMPACT, PLACE_SCATTER or PLACE_LIST
+char *place_name();								// "none", "compact", "scatter" or "list"
+void place_pin(pthread_t thread, int slot);					// pins a thread to the cpu for that slot (nothing with PLACE_NONE)
+int place_cpu(int slot);							// cpu a slot gets (-1 with PLACE_NONE)
+int place_spread(int threads);							// NUMA nodes the first that many slots run on (every node it can use if not pinned)
+int place_cpus();								// cpus this process can run on
+int place_memory_nodes(int *nodes);						// fills in the ids of the NUMA nodes with memory, returns how many
+void place_bind(void *addr, long bytes, int node);				// puts a mapped range's pages on a NUMA node (before they're touched)
+void place_interleave(void *addr, long bytes);					// spreads a mapped range's pages over every node with memory
+
+#endif
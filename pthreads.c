@@ -1,17 +1,238 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <limits.h>
 #include <math.h>
+#include <sched.h>
+#include <malloc.h>
 #include <pthread.h>
-
-// set up node structure
-typedef struct node{
-	int val;		// tree's value
-	struct node *left;	// child pointers
-	struct node *right;
-	pthread_mutex_t lock;	// and individual lock
-}NODE;
+#include "engine.h"
+#include "ebr.h"
+#include "eytzinger.h"
+#include "tpool.h"
+#include "heap.h"
+#include "bench.h"
+#include "trace.h"
+#include "snapshot.h"
+#include "wal.h"
+#include "cow.h"
+#include "skiplist.h"
+#include "chromatic.h"
+#include "filter.h"
+#include "cache.h"
+#include "arena.h"
+#include "place.h"
+
+#define REBAL_CUTOFF 10		// subtrees at least this high are rebalanced on the pool
+#define TEARDOWN_BATCH 4096	// nodes freed between chances to hand work off to the pool
+#define BUILD_CUTOFF 65536	// loaded subtrees with at least this many keys are built on the pool
+#define SET_CUTOFF 10		// set operations fork onto the pool while both trees are at least this high
+#define SAVE_CHUNK 4096		// keys save_tree aims to copy under one node lock at a time
+#define COMPACT_WALKS 1000000	// random lookups -C times before and after compacting
+#define COMPACT_TRIES 100	// goes at handing the moved out nodes back before giving up on the rest
+#define COMPACT_TOP_LEVELS 8	// levels compaction interleaves over every NUMA node (each subtree below goes on one)
+#define SCAN_COUPLED 0		// cursor re-finds its place lock coupled each step (no copy)
+#define SCAN_SNAPSHOT 1		// cursor copies the range when it's opened (consistent)
+#define OPEN_LAMBDA 2		// poisson_gen mean for open loop gaps (so a gap is 0-7 halves of the mean, as p_add sleeps)
+#define EDGE_MIN 0		// path down the left side to the smallest value
+#define EDGE_MAX 1		// path down the right side to the largest value
+#define UPDATE_SLOTS 256	// threads that can be updating the tree at once
+#define OUTER(node,dir) (*((dir)==EDGE_MIN?&((node)->left):&((node)->right)))	// child towards that end of the tree
+#define INNER(node,dir) (*((dir)==EDGE_MIN?&((node)->right):&((node)->left)))	// and the other one
+#define HEIGHT(node) (((node)==NULL)?0:(node)->height)	// a node's height (as last measured in the live tree)
+
+// with ORDER_STATS each node keeps the size of its subtree for rank_value() and select_value()
+// an add links its node in uncounted and then counts it in down the path, a delete marks its
+// node and counts it out down the path as it unlinks it, so sizes never need putting back
+#ifdef ORDER_STATS
+#define NODE_LIVE 0		// in the tree and counted
+#define NODE_ADDING 1		// linked in but not counted yet (not visible)
+#define NODE_DELETING 2		// being counted out (visible until it's unlinked)
+#define VISIBLE(node) ((node)->state!=NODE_ADDING)
+#define SETTLED(node) ((node)->state==NODE_LIVE)
+#define SIZE_OF(node) ((node)->size)
+#define ADD_SIZE(node,n) ((node)->size+=(n))
+#define LINKED(val)		// counted into the filter once it's visible instead (count_added)
+#else
+#define VISIBLE(node) 1
+#define SETTLED(node) 1
+#define SIZE_OF(node) 0
+#define ADD_SIZE(node,n)
+#define LINKED(val) mark_linked(val)	// an add takes effect where it links its node
+#endif
+
+// the tree is avl_tree.h made with int keys and no values, its nodes keeping
+//	height	levels in its subtree when last measured (exact in the private trees the set operations use)
+//	chunk	arena chunk it was moved into by compact_tree() (0 if malloc gave it out)
+//	size	values counted in this subtree (ORDER_STATS)
+//	state	NODE_LIVE, NODE_ADDING or NODE_DELETING (ORDER_STATS)
+// and the hooks doing what the filter, cache, log, edge paths and sizes need as it changes
+typedef struct coupled_node NODE;
+typedef struct coupled_tree TREE;
+void linked(NODE *parent, NODE *node, int side);				// everything an add does where its node goes in
+unsigned long unlinking(NODE *node);						// everything a delete or pop does before its node comes out, returns the new shape_version
+void retire_node(NODE *node);							// releases an unlinked node once no thread can reach it
+void stepped(NODE *node);							// publishes the node an update has just locked on its way down
+#ifdef ORDER_STATS
+void move_sizes(NODE *node, NODE *child, NODE *inner);				// moves the sizes with a rotation
+#define AVL_NODE_FIELDS short height; short chunk; int size; int state;
+#define AVL_INIT_NODE(node) ((node)->height=1,(node)->chunk=0,(node)->size=0,(node)->state=NODE_ADDING)	// count_added counts it in once it's linked
+#define AVL_ROTATING(node,child,inner) move_sizes(node,child,inner)
+#else
+#define AVL_NODE_FIELDS short height; short chunk;
+#define AVL_INIT_NODE(node) ((node)->height=1,(node)->chunk=0)
+#define AVL_STEPPED(node) stepped(node)		// so delete_range can tell if the update is inside what it cuts out
+#endif
+#define AVL_NAME coupled
+#define AVL_KEY int
+#define AVL_KEYS_ONLY 1
+#define AVL_LINKED(parent,node,side) linked(parent,node,side)
+#define AVL_BUSY(node) (!SETTLED(node))		// an add finding its value still being added or deleted tries again once that's done
+#define AVL_VISIBLE(node) VISIBLE(node)
+#define AVL_PASSED(node) ADD_SIZE(node,-1)		// a delete's node is somewhere below
+#define AVL_GAP_PASSED(node,moved) ADD_SIZE(node,SIZE_OF(moved))
+#define AVL_UNLINKING(node) unlinking(node)
+#define AVL_RETIRE(node) retire_node(node)		// a pop could still be about to lock it
+#define AVL_MEASURED(node,h) ((node)->height=(h))	// kept as a hint for the set operations
+#include "avl_tree.h"
+
+// a part of the tree for freeze() to collect in order
+typedef struct collect_job{
+	NODE *tree;		// subtree to collect (NULL for a single key)
+	int val;		// key of a node above the subtrees when tree is NULL
+	int *vals;		// keys collected
+	long count;
+	long cap;
+}COLLECT_JOB;
+
+// a left subtree for the pool to rebalance while the right one is done inline
+typedef struct rebal_task{
+	TASK task;
+	NODE *parent;		// locked node whose left subtree gets rebalanced
+	int counter;		// rebalances it took
+}REBAL_TASK;
+
+// the lower half of a sorted array for the pool to build into a subtree
+typedef struct build_task{
+	TASK task;
+	int *keys;
+	long n;
+	NODE *tree;		// the subtree built
+}BUILD_TASK;
+
+// a pair of subtrees for the pool to run a set operation on
+typedef struct set_task{
+	TASK task;
+	NODE *(*op)(NODE *a, NODE *b);	// union_trees, intersect_trees or difference_trees
+	NODE *a;
+	NODE *b;
+	NODE *result;
+}SET_TASK;
+
+// subtrees for one thread to free
+typedef struct teardown_task{
+	TASK task;
+	NODE **stack;			// roots of the subtrees still to free
+	long top;
+	long cap;
+	int cut;			// set for nodes delete_range cut out (a stale edge path might still hold one)
+	long freed;			// nodes freed by this task and the ones it spawned
+	struct teardown_task *next;	// next task spawned by the same parent
+}TEARDOWN_TASK;
+
+// subtrees cut out by one delete_range for the reclaim thread to free
+typedef struct reclaim_job{
+	NODE **roots;
+	long count;
+	long cap;
+	struct reclaim_job *next;	// next job in the queue
+}RECLAIM_JOB;
+
+// live nodes delete_range keeps locked until its cut takes effect
+typedef struct held_nodes{
+	NODE **nodes;
+	int count;
+	int cap;
+}HELD_NODES;
+
+// where one thread's update is in the tree, so delete_range can tell which updates its cut
+// leaves inside the cut out subtrees (what they do there is undone along with the rest)
+typedef struct update_slot{
+	unsigned long held;	// update number << 32 | key of the node it last locked on its way down
+	unsigned int seq;	// number of its current update (only it writes this)
+	unsigned int late;	// number of an update delete_range found inside a cut
+	int effecting;		// set while an update takes effect
+	int used;		// set while a thread owns the slot
+}__attribute__((aligned(64))) UPDATE_SLOT;
+
+// a node waiting for its turn in an in-order walk
+typedef struct scan_frame{
+	int val;		// node's value
+	int visible;		// set unless the node is still being added
+	NODE *right;		// right subtree still to walk (NULL if it's past the range)
+}SCAN_FRAME;
+
+// position in an ordered walk over a range of keys
+typedef struct cursor{
+	int mode;		// SCAN_COUPLED or SCAN_SNAPSHOT
+	int next;		// smallest key still to return
+	int hi;			// largest key to return
+	int done;		// set once the range is used up
+	COLLECT_JOB keys;	// copy of the range (SCAN_SNAPSHOT only)
+	long pos;		// next key in the copy
+}CURSOR;
+
+// cached path from the root to one end of the tree, so pop_min/pop_max only
+// have to lock the last two nodes on it instead of walking down from the root
+typedef struct edge_path{
+	pthread_mutex_t lock;
+	NODE **path;		// root first, the end of the tree last
+	int depth;		// 0 when it has to be walked again
+	int cap;
+	NODE *end;		// path[depth-1] (for add_value to check without the lock)
+	unsigned long version;	// shape_version the path is good for
+	long hits;		// pops that went straight to the end
+	long walks;		// times it was walked from the root
+}EDGE_PATH;
+
+// one thread's share of the priority queue timing
+typedef struct queue_job{
+	int ops;		// keys to push and pop
+	HEAP *heap;		// heap to use (NULL for the tree)
+	unsigned int seed;
+	long popped;
+}QUEUE_JOB;
+
+// one thread's share of the bench ops (every step-th one from first)
+typedef struct bench_job{
+	BENCH_OP *ops;
+	long n;			// ops in the whole sequence
+	long first;
+	int step;
+	long *latency;		// nanoseconds taken by each op (shared, each thread fills its own)
+	long *due;		// when each op is meant to start, ns after begin (NULL runs flat out)
+	long begin;		// bench_now() when the ops started
+}BENCH_JOB;
+
+// one thread's share of a trace being replayed (every step-th op from first)
+typedef struct replay_job{
+	TRACE_OP *ops;
+	long n;			// ops in the whole trace
+	long first;
+	int step;
+	int paced;		// set to wait for each op's time in the trace instead of going flat out
+	long begin;		// bench_now() when the replay started
+	long *latency;		// nanoseconds taken by each op (shared, each thread fills its own)
+}REPLAY_JOB;
+
+// where compact_tree is putting the nodes (one arena unless there's more than one NUMA node)
+typedef struct compaction{
+	ARENA *arenas;		// one bound to each NUMA node, then one interleaved over them all for the top levels
+	int nodes;		// NUMA nodes with memory
+	long next;		// subtrees dealt out to the nodes so far
+}COMPACTION;
 
 
 // Global Args
@@ -19,44 +240,201 @@ int max=1000;									// set as max number possible in tree
 int gap=3;									// set as digits for max number (max-1)
 char* empty="~~~";								// set as empty node print symbol (use gap number of characters) 
 int quiet=0;									// variable to choose if add/del info is printed or not
-
-// tree root and a root_lock
-NODE *tree_root;
-pthread_mutex_t root_lock;
+int num_pairs=1;								// number of adding/deleting thread pairs
+int flat_out=0;									// variable to choose if add/del threads skip the poisson sleeps
+int range_width=0;								// variable to choose if delete threads remove ranges of keys this wide
+int capturing=0;								// variable to choose if add/delete threads record their ops in a trace
+char *log_path=NULL;								// write ahead log for the tree's updates (NULL for none)
+long commit_interval=WAL_INTERVAL;						// microseconds between group commits
+long commit_batch=WAL_BATCH_OPS;						// ops waiting that start a group commit early
+int logging=0;									// set while updates are being logged
+int filtering=1;								// variable to choose if the AVL tree checks a membership filter before walking
+long cache_slots=0;								// slots in the AVL tree's hot key cache for lookups (0 for none)
+double lookup_skew=0;								// zipfian skew of the -z lookups (0 for uniform)
+int compacting=0;								// variable to choose if the AVL tree is compacted into an arena at the end
+ENGINE *engine=&avl_engine;							// tree the threads work on
+
+// the tree (its root, root lock and rotation count)
+TREE live;
+
+// queue of cut out subtrees and the thread that frees them
+RECLAIM_JOB *reclaim_queue=NULL;
+pthread_mutex_t reclaim_lock=PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reclaim_cond=PTHREAD_COND_INITIALIZER;
+pthread_t reclaimer;
+int reclaim_stop=0;
+long reclaimed=0;								// nodes freed by the reclaim thread
+
+// every updating thread's slot, claimed the first time it updates and given back when it exits
+UPDATE_SLOT update_slots[UPDATE_SLOTS];
+int num_slots=0;								// high water mark of slots in use
+__thread UPDATE_SLOT *my_slot=NULL;
+pthread_key_t slot_key;
+pthread_once_t slot_once=PTHREAD_ONCE_INIT;
+
+// paths to both ends of the tree for pop_min/pop_max, and a count of deletes
+// anything deleted might be on a path, so a path is only used while the count hasn't moved
+EDGE_PATH edges[2]={{.lock=PTHREAD_MUTEX_INITIALIZER},{.lock=PTHREAD_MUTEX_INITIALIZER}};
+unsigned long shape_version=0;
+
+// read optimised copy of the tree made by freeze(), valid until the next add or delete
+EYTZ *frozen=NULL;
+int frozen_valid=0;
+
+// keys in the tree as far as the filter knows, checked before walking (NULL if not filtering)
+FILTER *key_filter=NULL;
+
+// answers to recent lookups, checked once the filter can't tell (NULL if not caching)
+CACHE *hot_cache=NULL;
+
+// snapshot mapped by load_tree(), and whether lookups are still answered from it
+// because nothing has needed the tree built yet (load_lock is held to build it)
+SNAP *mapped=NULL;
+int loaded=0;
+pthread_mutex_t load_lock=PTHREAD_MUTEX_INITIALIZER;
 
 // Various Counters
 int add_counter=0, del_counter=0, bal_counter=0;
 int add_attempts=0, del_attempts=0;
 int p_finish=0;
+long scans[2]={0,0}, scan_keys[2]={0,0};					// full scans done by p_scan (by mode)
+double scan_time[2]={0,0};
+long bench_done=0;								// bench ops finished so far (for the balancer to keep up with)
 
 
 
 
 // functions used
-void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet);	//takes in command line arguments
-
-void add_value(int new_val);							// adds a specified value to the tree (-1 for random)
-void find_gap(NODE **start, NODE **new, int dir);				// finds a place to put new in the direction of dir from start
-void delete_value(int del_val);							// deletes a specified value from the tree (-1 for random)
-
-int find_height(NODE **tree);							// finds the height of the tree
-int rebalance(NODE **tree, NODE **parent, int direction);			// recursive function to rebalance the tree at a given node with a given parent
+void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet, ENGINE **engine, int *num_pairs, int *flat_out, int *no_lookups, int *scanning, int *range_width, int *no_pops, int *bench, long *no_keys, char **capture_path, char **replay_path, int *paced, double *rate, int *fixed, char **save_path, char **load_path, int *lazy, long *set_keys);	//takes in command line arguments
+
+int add_value(int new_val);							// adds a specified value to the tree (-1 for random), returns 1 if added
+int delete_value(int del_val);							// deletes a specified value from the tree (-1 for random), returns 1 if deleted
+int lookup_value(int val);							// returns 1 if a value is in the tree
+int find_value(int val);							// lock couples down to a value, returns 1 if it's there
+void mark_linked(int val);							// counts a key into the filter where its add takes effect (and out of the cache)
+void filter_tree(NODE *tree, int add);						// counts every key of a tree nobody else is using into the filter (or out)
+void refilter();								// rebuilds the filter from the tree and empties the cache (no other threads may be using it)
+#ifdef ORDER_STATS
+void count_added(int val);							// counts a newly linked value into the sizes on its path
+int mark_deleting(int val);							// marks a value for deleting, returns 0 if it isn't in the tree
+long subtree_size(NODE *tree);							// size of a subtree whose parent is locked
+long rank_value(int val);							// number of values in the tree below val
+int select_value(long k, int *val);						// finds the kth smallest value (from 0), returns 0 if there are fewer
+long tree_size();								// number of values in the tree
+#endif
+int delete_range(int lo, int hi);						// cuts every value in [lo,hi] out of the tree, returns 1 if there were any
+NODE *split_below(NODE *tree, int lo, RECLAIM_JOB *job, HELD_NODES *held, NODE **max);	// keeps the values below lo in a locked subtree, cutting out the rest
+NODE *split_above(NODE *tree, int hi, RECLAIM_JOB *job, HELD_NODES *held);	// keeps the values above hi in a locked subtree, cutting out the rest
+void hold(HELD_NODES *held, NODE *node);					// locks a live node for delete_range unless it's NULL or already held
+void add_held(HELD_NODES *held, NODE *node);					// counts a node delete_range has already locked as held
+NODE *graft_trees(HELD_NODES *held, NODE *left, NODE *mid, NODE *right);	// join_trees for live nodes, locking what it measures or moves
+NODE *graft_right(HELD_NODES *held, NODE *left, NODE *mid, NODE *right);	// graft_trees when left is the higher
+NODE *graft_left(HELD_NODES *held, NODE *left, NODE *mid, NODE *right);	// graft_trees when right is the higher
+NODE *regraft(HELD_NODES *held, NODE *node);					// restore for a held live node
+UPDATE_SLOT *get_slot();							// finds (or claims) the calling thread's update slot
+void release_slot(void *arg);							// gives a thread's slot back when it exits
+void start_update();								// gives the calling thread's next update a new number
+int begin_effect();								// marks an update as taking effect, returns 0 if a cut has already undone it
+void end_effect();								// marks it done taking effect
+void late_effect(int val, int add);						// what an update a cut has undone still does to the filter and cache
+void catch_late(int lo, int hi);						// marks the updates inside [lo,hi] late and waits for any taking effect
+void make_slot_key();								// sets up the key that gives slots back
+void add_reclaim(RECLAIM_JOB *job, NODE *tree);					// adds a cut out subtree to a reclaim job
+void wait_out(RECLAIM_JOB *job);						// waits for anything still inside a reclaim job's subtrees to finish
+void *p_reclaim();								// pthreads function to free cut out subtrees in the background
+
+void freeze();									// takes an Eytzinger layout copy of the tree for fast lookups
+int frozen_lookup(int val);							// looks up a value in the frozen copy (or the tree if it's out of date)
+void invalidate_frozen();							// marks the frozen copy out of date (called after every change)
+void collect(NODE *tree, COLLECT_JOB *job);					// collects a subtree's keys in order, locking the path
+void *p_collect(void *arg);							// pthreads function to collect a subtree
+void plan_collect(NODE *tree, int depth, COLLECT_JOB *jobs, int *num_jobs, NODE **held, int *num_held);	// locks the top of the tree and hands out its subtrees
+
+long save_tree(char *path);							// writes the tree to a snapshot file while updates carry on, returns how many keys (-1 on error)
+long load_tree(char *path, int lazy);						// loads a snapshot into an empty tree (lazy leaves it mapped until needed), returns how many keys (-1 on error)
+void settle_loaded();								// builds a lazily loaded snapshot into the tree if that hasn't happened yet
+NODE *build_balanced(int *keys, long n);					// builds a balanced subtree from sorted keys, forking big halves onto the pool
+void p_build(void *arg);							// pool function to build the lower half of a sorted array
+
+NODE *join_trees(NODE *left, NODE *mid, NODE *right);				// joins two private trees either side of a node, returns the root
+NODE *join_right(NODE *left, NODE *mid, NODE *right);				// join_trees when left is the higher (goes down its right side)
+NODE *join_left(NODE *left, NODE *mid, NODE *right);				// join_trees when right is the higher (goes down its left side)
+NODE *join_pair(NODE *left, NODE *right);					// joins two private trees with no node between them
+NODE *split_tree(NODE *tree, int key, NODE **left, NODE **right);		// splits a private tree around key, returns key's node (NULL if it isn't there)
+NODE *cut_max(NODE *tree, NODE **max);						// takes the largest node out of a private tree, returns what's left
+NODE *restore(NODE *node);							// rotates a private node back into balance, returns its subtree's root
+NODE *lift(NODE *node, int side);						// lifts a private node's child on one side into its place, returns the child
+void refresh(NODE *node);							// recomputes a private node's height (and size) from its children
+NODE *union_trees(NODE *a, NODE *b);						// every key in either private tree (both are used up)
+NODE *intersect_trees(NODE *a, NODE *b);					// the keys in both private trees (both are used up)
+NODE *difference_trees(NODE *a, NODE *b);					// the keys in a that aren't in b (both are used up)
+int start_set(SET_TASK *task);							// runs a set operation on the pool if both trees are big enough, returns 1 if spawned
+void p_set(void *arg);								// pool function to run a set operation on a pair of subtrees
+void merge_tree(NODE *(*op)(NODE *a, NODE *b), NODE *other);			// applies a set operation to the tree and other (no other threads in the tree)
+void union_tree(NODE *other);							// adds every key in other to the tree
+void intersect_tree(NODE *other);						// keeps only the keys that are also in other
+void difference_tree(NODE *other);						// deletes every key in other from the tree
+
+int seek_value(int from, int *val);						// finds the smallest value at least from, returns 1 if there is one
+NODE *find_range_top(int lo, int hi);						// finds and locks the highest node in [lo,hi] (NULL if none)
+void collect_range(NODE *top, int lo, int hi, COLLECT_JOB *job);		// collects the keys in [lo,hi] below a locked node in order
+void cursor_open(CURSOR *cursor, int lo, int hi, int mode);			// sets up a cursor over [lo,hi]
+int cursor_next(CURSOR *cursor, int *val);					// moves to the next key, returns 0 once the range is used up
+void cursor_close(CURSOR *cursor);						// frees anything the cursor holds
+long range_scan(int lo, int hi, int mode, void (*callback)(int val, void *arg), void *arg);	// calls callback on each key in [lo,hi] in order, returns how many
+void count_key(int val, void *arg);						// range_scan callback that counts keys
+
+int peek_min(int *val);								// finds the smallest value, returns 0 if the tree is empty
+int peek_max(int *val);								// finds the largest value, returns 0 if the tree is empty
+int pop_min(int *val);								// takes the smallest value out of the tree, returns 0 if it's empty
+int pop_max(int *val);								// takes the largest value out of the tree, returns 0 if it's empty
+int peek_edge(int dir, int *val);						// peek_min/peek_max for either end of the tree
+int pop_edge(int dir, int *val);						// pop_min/pop_max for either end of the tree
+int pop_cached(int dir, int *val);						// pops the end of the cached path, returns -1 to try again
+int walk_edge(int dir);								// walks the path to one end of the tree again, returns 0 if it's empty
+void set_edge(EDGE_PATH *e, int keep, NODE **tail, int n, unsigned long version);	// keeps the first keep nodes of a path and adds tail
+void drop_from_edge(int dir, NODE *node);					// drops a path if it goes through a node that's about to be retired
+void extend_edge(int dir, NODE *parent, NODE *node);				// adds a node just linked below the end of a path
+
+int rebalance(NODE **link);							// rebalances a locked node and then both its subtrees, returns how many rotations it did
+int rebalance_children(NODE **tree, int left_height);				// rebalances both subtrees of a node, forking big left ones onto the pool
+void p_rebalance(void *arg);							// pool function to rebalance a left subtree
 void rebalance_tree();								// calls the rebalance function with the correct arguments for a given tree
 
 void delete_tree(NODE **tree);							// deletes a tree and all its allocated memory is freed
+void p_teardown(void *arg);							// pool function to free subtrees, handing half off now and then
+long count_tree(NODE *tree);							// counts the nodes in a tree without locks
+void release_node(void *node);							// frees a node wherever it came from (malloc or an arena)
+long compact_tree();								// moves every node into a fresh arena in preorder, returns how many moved
+long compact(NODE **link, ARENA *arena, int depth, COMPACTION *c);		// moves a locked node and then its subtrees into the arena
+
+void avl_init();								// ENGINE wrappers for the lock coupled tree
+void avl_print();
+long avl_count();
+long avl_bytes();
+long avl_rotations();
+void avl_destroy();
+int avl_height();
 
 void *p_add(void *arg);								// pthreads function to add a specified number of values in poisson intervals
 void *p_del();									// pthreads function to delete a specified number of values in poisson intervals
 void *p_bal();									// pthreads function to rebalance the tree periodically
+void *p_scan();									// pthreads function to scan the whole tree until the updates finish
+void *p_queue(void *arg);							// pthreads function to push random keys and pop the smallest
+double time_queue(int num_threads, int ops, HEAP *heap, long *popped);		// times threads using the tree (heap NULL) or a heap as a priority queue
+void push_key(int val, void *arg);						// range_scan callback that pushes keys onto a heap
+void run_bench(int no_ops, int seed, double rate, int fixed);			// times the shared bench workload on num_pairs threads (open loop at rate ops/sec if rate>0) and prints it as CSV
+void *p_bench(void *arg);							// pthreads function to run and time one thread's share of the bench ops
+void *p_bench_bal();								// pthreads function to rebalance every BENCH_BALANCE_EVERY bench ops
+void run_size(long no_keys, int no_ops, int seed);				// times lookups, adds and deletes in a tree of no_keys keys and prints it as CSV
+void run_sets(long no_keys, long other_keys, int seed);				// times the set operations on two trees against add/delete loops and prints it as CSV
+void run_replay(char *path, int paced);						// replays a trace file on num_pairs threads and prints it as CSV
+void *p_replay(void *arg);							// pthreads function to replay and time one thread's share of a trace
+void replay_logged(int type, int key, int hi);					// wal_open callback that redoes a logged update
+void wait_until(long due);							// sleeps most of the way to bench_now() time due and spins (yielding) the rest
 
 int poisson_gen(double lambda);							// function to generate poisson random variables 
 
-// Printing was implemented for debugging purposes(tree will most likely be too large to print by current default)
-int find_height_print(NODE *tree);						// find height function without locks
-void print_gap(int a);								// function to print "a" number of gaps
-void print_line(NODE *tree, int start, int inc, int num);			// prints a line in the tree with specified gaps
-void print_tree(NODE *tree);							// prints out the tree (if under a certain height)
-
 
 
 int main(int argc, char *argv[]){
@@ -65,7 +443,35 @@ int main(int argc, char *argv[]){
 	//set default arguments
 	int no_adds=1000;
 	int seed=time(NULL);
-	parse_args(argc, argv, &no_adds, &seed, &quiet);
+	int no_lookups=0;
+	int scanning=0;
+	int no_pops=0;
+	int bench=0;
+	long no_keys=0;
+	char *capture_path=NULL;
+	char *replay_path=NULL;
+	int paced=0;
+	double rate=0;
+	int fixed=0;
+	char *save_path=NULL;
+	char *load_path=NULL;
+	int lazy=0;
+	long set_keys=0;
+	parse_args(argc, argv, &no_adds, &seed, &quiet, &engine, &num_pairs, &flat_out, &no_lookups, &scanning, &range_width, &no_pops, &bench, &no_keys, &capture_path, &replay_path, &paced, &rate, &fixed, &save_path, &load_path, &lazy, &set_keys);
+	if(engine!=&avl_engine){range_width=0;no_pops=0;load_path=NULL;log_path=NULL;set_keys=0;}
+	if(engine!=&avl_engine && engine!=&cow_engine){save_path=NULL;}
+	if(engine!=&avl_engine && engine!=&cow_engine && engine!=&sl_engine){scanning=0;}
+
+	// bench modes only print the CSV
+	if(bench || no_keys>0 || replay_path!=NULL || rate>0 || set_keys>0){
+		tpool_init(sysconf(_SC_NPROCESSORS_ONLN)-1);
+		if(replay_path!=NULL){run_replay(replay_path,paced);}
+		else if(no_keys>0){run_size(no_keys,no_adds,seed);}
+		else if(set_keys>0){run_sets(set_keys,no_adds,seed);}
+		else{run_bench(no_adds,seed,rate,fixed);}
+		tpool_destroy();
+		return 0;
+	}
 
 	// seeds program
 	printf("Seed is %d\n",seed);
@@ -74,41 +480,259 @@ int main(int argc, char *argv[]){
 
 	// pthreads arguments
 	pthread_t *handles;
-	pthread_mutex_init(&root_lock,NULL);
-	int num_threads=3;
+	int num_threads=2*num_pairs+1+scanning;
 		
 	handles=malloc(num_threads*sizeof(pthread_t));
 
 
-	// sets up tree
-	tree_root=NULL;
+	// starts a pool for the balancer to share work with the other cores
+	tpool_init(sysconf(_SC_NPROCESSORS_ONLN)-1);
+
+	// sets up tree (from a snapshot if asked) and starts the clock (and the trace if capturing)
+	engine->init();
+	struct timespec io_start, io_end;
+	double load_time=0;
+	long load_count=0;
+	if(load_path!=NULL){
+		clock_gettime(CLOCK_MONOTONIC,&io_start);
+		load_count=load_tree(load_path,lazy);
+		clock_gettime(CLOCK_MONOTONIC,&io_end);
+		load_time=(io_end.tv_sec-io_start.tv_sec)+(io_end.tv_nsec-io_start.tv_nsec)/1e9;
+		if(load_count<0){
+			fprintf(stderr,"Can't load snapshot %s\n",load_path);
+			exit(EXIT_FAILURE);
+		}
+	}
+	// then redoes anything logged since and logs from there
+	long recovered=0;
+	if(log_path!=NULL){
+		recovered=wal_open(log_path,commit_interval,commit_batch,replay_logged);
+		if(recovered<0){
+			fprintf(stderr,"Can't open log %s\n",log_path);
+			exit(EXIT_FAILURE);
+		}
+		logging=1;
+	}
+	capturing=(capture_path!=NULL);
+	if(capturing){trace_start();}
+	struct timespec start, finish;
+	clock_gettime(CLOCK_MONOTONIC,&start);
 
-	// runs 3 threads for adding, deleting and balancing
-	pthread_create(&handles[0],NULL,p_add, (void *)&no_adds);
-	pthread_create(&handles[1],NULL,p_del, NULL);
-	pthread_create(&handles[2],NULL,p_bal, NULL);
+	// runs pairs of threads for adding and deleting, and one for balancing (pinned in that order with -P)
+	int i;
+	for(i=0;i<num_pairs;i++){
+		pthread_create(&handles[2*i],NULL,p_add, (void *)&no_adds);
+		pthread_create(&handles[2*i+1],NULL,p_del, NULL);
+		place_pin(handles[2*i],2*i);
+		place_pin(handles[2*i+1],2*i+1);
+	}
+	pthread_create(&handles[2*num_pairs],NULL,p_bal, NULL);
+	place_pin(handles[2*num_pairs],2*num_pairs);
+	if(scanning){
+		pthread_create(&handles[num_threads-1],NULL,p_scan, NULL);
+		place_pin(handles[num_threads-1],num_threads-1);
+	}
 	
 	// waits for all threads to finish
-	int i;
 	for(i=0;i<num_threads;i++){
 		pthread_join(handles[i],NULL);
 	}
 	free(handles);
+	clock_gettime(CLOCK_MONOTONIC,&finish);
+	double elapsed=(finish.tv_sec-start.tv_sec)+(finish.tv_nsec-start.tv_nsec)/1e9;
+
+	// deletes can still run under the balancer's last pass, so one more (untimed) pass
+	// with nothing else running has to leave an AVL tree
+	if(engine==&avl_engine){
+		rebalance_tree();
+		if(coupled_check(live.root)<0){
+			fprintf(stderr,"Tree isn't balanced after the last rebalance\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	// same for the chromatic tree, whose last pass can miss what those deletes queued
+	if(engine==&chromatic_engine){
+		ch_balance();
+		if(ch_check()<0){
+			fprintf(stderr,"Chromatic tree still has violations after the last rebalance\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	long traced=(capturing)?trace_write(capture_path):0;
+
+	// saves the tree (this could run alongside the updates, but here it's the final state)
+	double save_time=0;
+	long save_count=0;
+	if(save_path!=NULL){
+		clock_gettime(CLOCK_MONOTONIC,&io_start);
+		save_count=(engine==&cow_engine)?cow_save(save_path):save_tree(save_path);
+		clock_gettime(CLOCK_MONOTONIC,&io_end);
+		save_time=(io_end.tv_sec-io_start.tv_sec)+(io_end.tv_nsec-io_start.tv_nsec)/1e9;
+		// the snapshot has everything logged so far
+		if(save_count>=0 && logging){wal_truncate();}
+	}
+	long logged=0, commits=0;
+	if(logging){
+		logging=0;
+		wal_close();
+		wal_stats(&logged,&commits);
+	}
+
+	long size=engine->count(), bytes=engine->bytes();
+	long filter_size=(key_filter!=NULL)?filter_bytes(key_filter):0;
+	int filter_kind=(key_filter!=NULL)?filter_exact(key_filter):-1;
+	long cache_hits=0, cache_misses=0, cache_size=0;
+	long rotations=(engine->rotations!=NULL)?engine->rotations():0;
+#ifdef ORDER_STATS
+	int median=0;
+	if(engine==&avl_engine){select_value(size/2,&median);}
+#endif
+
+	// times lookups through the tree against lookups in a frozen copy (and through the filter and cache if they're on)
+	double tree_time=0, freeze_time=0, frozen_time=0, filtered_time=0;
+	if(no_lookups>0 && engine==&avl_engine){
+		struct timespec t0, t1, t2, t3;
+		int found_tree=0, found_frozen=0;
+		int *hot=(lookup_skew>0)?bench_zipf(seed,no_lookups,max,lookup_skew):NULL;	// made before the clock starts
+		long begin;
+
+		if(key_filter!=NULL || hot_cache!=NULL){
+			begin=bench_now();
+			for(i=0;i<no_lookups;i++){lookup_value((hot!=NULL)?hot[i]:rand()%max);}
+			filtered_time=(bench_now()-begin)/1e9;
+		}
+		// find_value so the filter and cache can't answer for the tree
+		clock_gettime(CLOCK_MONOTONIC,&t0);
+		for(i=0;i<no_lookups;i++){found_tree+=find_value((hot!=NULL)?hot[i]:rand()%max);}
+		clock_gettime(CLOCK_MONOTONIC,&t1);
+		freeze();
+		clock_gettime(CLOCK_MONOTONIC,&t2);
+		for(i=0;i<no_lookups;i++){found_frozen+=frozen_lookup((hot!=NULL)?hot[i]:rand()%max);}
+		clock_gettime(CLOCK_MONOTONIC,&t3);
+		free(hot);
+
+		tree_time=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+		freeze_time=(t2.tv_sec-t1.tv_sec)+(t2.tv_nsec-t1.tv_nsec)/1e9;
+		frozen_time=(t3.tv_sec-t2.tv_sec)+(t3.tv_nsec-t2.tv_nsec)/1e9;
+		if(quiet==0){printf("Found %d (tree) and %d (frozen)\n",found_tree,found_frozen);}
+	}
+
+	// times walks down the tree and a full scan before and after compacting it
+	double walk_time[2]={0,0}, compact_scan[2]={0,0}, compact_time=0;
+	long moved=0, compact_rss[2]={0,0}, compact_keys=0;
+	if(compacting && engine==&avl_engine){
+		int *walks=malloc(COMPACT_WALKS*sizeof(int));
+		int k, found=0;
+		long begin;
+		for(i=0;i<COMPACT_WALKS;i++){walks[i]=rand()%max;}
+
+		for(k=0;k<2;k++){
+			if(k==1){
+				begin=bench_now();
+				moved=compact_tree();
+				compact_time=(bench_now()-begin)/1e9;
+			}
+			compact_rss[k]=bench_rss();
+			// find_value so the filter and cache can't answer for the tree
+			begin=bench_now();
+			for(i=0;i<COMPACT_WALKS;i++){found+=find_value(walks[i]);}
+			walk_time[k]=(bench_now()-begin)/1e9;
+			compact_keys=0;
+			begin=bench_now();
+			range_scan(INT_MIN,INT_MAX,SCAN_SNAPSHOT,count_key,&compact_keys);
+			compact_scan[k]=(bench_now()-begin)/1e9;
+		}
+		if(quiet==0){printf("Found %d in walks before and after compacting\n",found);}
+		free(walks);
+	}
+
+	// times the tree as a priority queue against a locked heap starting with the same keys
+	double queue_time=0, heap_time=0;
+	long queue_pops=0, heap_pops=0;
+	if(no_pops>0){
+		HEAP heap;
+		heap_init(&heap);
+		range_scan(0,max-1,SCAN_SNAPSHOT,push_key,&heap);
+		heap_time=time_queue(2*num_pairs,no_pops,&heap,&heap_pops);
+		queue_time=time_queue(2*num_pairs,no_pops,NULL,&queue_pops);
+		heap_destroy(&heap);
+	}
 
-	print_tree(tree_root);		// prints tree
-	delete_tree(&tree_root);	// deletes from memory
+	if(engine->print!=NULL){engine->print();}	// prints tree
+	if(hot_cache!=NULL){
+		cache_stats(hot_cache,&cache_hits,&cache_misses);
+		cache_size=cache_bytes(hot_cache);
+	}
+
+	// deletes from memory
+	struct timespec teardown_start, teardown_finish;
+	clock_gettime(CLOCK_MONOTONIC,&teardown_start);
+	engine->destroy();
+	clock_gettime(CLOCK_MONOTONIC,&teardown_finish);
+	double teardown=(teardown_finish.tv_sec-teardown_start.tv_sec)+(teardown_finish.tv_nsec-teardown_start.tv_nsec)/1e9;
+	tpool_destroy();
 
 	
 	// prints out some stats
-	printf("\n\nAdds:\t\t%d (%d attempts)\nDeletes:\t%d (%d attempts)\nBalances:\t%d\n",add_counter,add_attempts,del_counter,del_attempts,bal_counter);
+	printf("\n\nEngine:\t\t%s (%d add/delete pairs)",engine->name,num_pairs);
+	printf("\nAdds:\t\t%d (%d attempts)\nDeletes:\t%d (%d attempts)\nBalances:\t%d\n",add_counter,add_attempts,del_counter,del_attempts,bal_counter);
+	printf("Time:\t\t%.3fs (%.0f ops/sec)\n",elapsed,(add_attempts+del_attempts)/elapsed);
+	printf("Size:\t\t%ld keys (%.1f bytes/key)\n",size,(size>0)?(double)bytes/size:0.0);
+	printf("Teardown:\t%.3fs\n",teardown);
+#ifdef ORDER_STATS
+	if(engine==&avl_engine && size>0){printf("Median:\t\t%d (from select_value)\n",median);}
+#endif
+	if(filter_kind>=0){
+		printf("Filter:\t\t%s, %.1f KB\n",(filter_kind)?"bitmap (misses, duplicates and lookups skip the walk)":"counting Bloom filter (misses skip the walk)",filter_size/1024.0);
+	}
+	if(place_policy()!=PLACE_NONE){
+		printf("Pinning:\t%s, threads over %d NUMA node%s (%d cpus)\n",place_name(),place_spread(num_threads),(place_spread(num_threads)==1)?"":"s",place_cpus());
+	}
+	if(cache_size>0){
+		printf("Cache:\t\t%ld hits, %ld misses (%.1f%% hit rate), %.1f KB\n",cache_hits,cache_misses,(cache_hits+cache_misses>0)?100.0*cache_hits/(cache_hits+cache_misses):0.0,cache_size/1024.0);
+	}
+	if(load_path!=NULL){
+		printf("Loaded:\t\t%ld keys from %s in %.3fs%s\n",load_count,load_path,load_time,(lazy)?" (mapped, built on first write)":"");
+	}
+	if(log_path!=NULL){
+		printf("Log:\t\t%ld ops in %ld group commits (%.1f per fsync), %ld replayed from %s\n",logged,commits,(commits>0)?(double)logged/commits:0.0,recovered,log_path);
+	}
+	if(save_path!=NULL){
+		if(save_count<0){printf("Saved:\t\tcouldn't write %s\n",save_path);}
+		else{printf("Saved:\t\t%ld keys to %s in %.3fs\n",save_count,save_path,save_time);}
+	}
+	if(capturing){
+		if(traced<0){printf("Trace:\t\tcouldn't write %s\n",capture_path);}
+		else{printf("Trace:\t\t%ld ops written to %s\n",traced,capture_path);}
+	}
+	if(range_width>0){
+		printf("Ranges:\t\t%ld keys cut out %d at a time and freed in the background\n",reclaimed,range_width);
+	}
+	if(engine->rotations!=NULL){
+		printf("Rotations:\t%ld (%.3f per update)\n",rotations,(add_counter+del_counter>0)?(double)rotations/(add_counter+del_counter):0.0);
+	}
+	if(tree_time>0){
+		printf("Lookups:\t%.0f/sec (tree) %.0f/sec (frozen, %.3fs to freeze)",no_lookups/tree_time,no_lookups/frozen_time,freeze_time);
+		if(filtered_time>0){printf(" %.0f/sec (%s)",no_lookups/filtered_time,(filter_kind>=0)?"filter first":"cache first");}
+		printf("\n");
+	}
+	if(walk_time[0]>0){
+		printf("Compact:\t%ld nodes moved in %.3fs, walks %.0f/sec -> %.0f/sec, scan %.0f -> %.0f keys/sec, RSS %.1f -> %.1f MB\n",moved,compact_time,COMPACT_WALKS/walk_time[0],COMPACT_WALKS/walk_time[1],compact_keys/compact_scan[0],compact_keys/compact_scan[1],compact_rss[0]/1048576.0,compact_rss[1]/1048576.0);
+	}
+	if(queue_time>0){
+		printf("Queue:\t\t%.0f pops/sec (tree, %ld walks to the end) %.0f pops/sec (locked heap)\n",queue_pops/queue_time,edges[EDGE_MIN].walks,heap_pops/heap_time);
+	}
+	if(scanning){
+		printf("Scans:\t\t%ld coupled (%.0f keys/sec) %ld snapshot (%.0f keys/sec)\n",scans[SCAN_COUPLED],(scan_time[SCAN_COUPLED]>0)?scan_keys[SCAN_COUPLED]/scan_time[SCAN_COUPLED]:0.0,scans[SCAN_SNAPSHOT],(scan_time[SCAN_SNAPSHOT]>0)?scan_keys[SCAN_SNAPSHOT]/scan_time[SCAN_SNAPSHOT]:0.0);
+	}
 	return 0;
 }
 
 
-void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet){
+void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet, ENGINE **engine, int *num_pairs, int *flat_out, int *no_lookups, int *scanning, int *range_width, int *no_pops, int *bench, long *no_keys, char **capture_path, char **replay_path, int *paced, double *rate, int *fixed, char **save_path, char **load_path, int *lazy, long *set_keys){
 	//parse command line arguments
 	int opt;
-	while((opt=getopt(argc,argv,"n:s:q"))!=-1){
+	while((opt=getopt(argc,argv,"n:s:qe:t:fz:rd:k:m:bp:w:y:xo:uc:l:ia:g:j:v:hH:Z:CP:"))!=-1){
 		switch(opt){
 			case 'n':
 				*no_adds=atoi(optarg);
@@ -119,8 +743,113 @@ void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet){
 			case 'q':
 				*quiet=1;
 				break;
+			case 'e':
+				// picks the engine by number
+				switch(atoi(optarg)){
+					case 0: *engine=&avl_engine; break;
+					case 1: *engine=&lfbst_engine; break;
+					case 2: *engine=&sl_engine; break;
+					case 3: *engine=&bp_engine; break;
+					case 4: *engine=&rb_engine; break;
+					case 5: *engine=&avlmap_engine; break;
+					case 6: *engine=&cow_engine; break;
+					case 7: *engine=&chromatic_engine; break;
+					default:
+						fprintf(stderr,"Unknown engine %s\n",optarg);
+						exit(EXIT_FAILURE);
+				}
+				break;
+			case 't':
+				*num_pairs=atoi(optarg);
+				if(*num_pairs<1){*num_pairs=1;}
+				break;
+			case 'f':
+				*flat_out=1;
+				break;
+			case 'z':
+				*no_lookups=atoi(optarg);
+				break;
+			case 'r':
+				*scanning=1;
+				break;
+			case 'd':
+				*range_width=atoi(optarg);
+				break;
+			case 'k':
+				*no_pops=atoi(optarg);
+				break;
+			case 'm':
+				max=atoi(optarg);
+				if(max<1){max=1;}
+				break;
+			case 'b':
+				*bench=1;
+				break;
+			case 'p':
+				*no_keys=atol(optarg);
+				// keys go up to 2*no_keys
+				if(*no_keys>RAND_MAX/2){*no_keys=RAND_MAX/2;}
+				break;
+			case 'w':
+				*capture_path=optarg;
+				break;
+			case 'y':
+				*replay_path=optarg;
+				break;
+			case 'x':
+				*paced=1;
+				break;
+			case 'o':
+				*rate=atof(optarg);
+				break;
+			case 'u':
+				*fixed=1;
+				break;
+			case 'c':
+				*save_path=optarg;
+				break;
+			case 'l':
+				*load_path=optarg;
+				break;
+			case 'i':
+				*lazy=1;
+				break;
+			case 'a':
+				log_path=optarg;
+				break;
+			case 'g':
+				commit_interval=atol(optarg);
+				break;
+			case 'j':
+				commit_batch=atol(optarg);
+				break;
+			case 'v':
+				*set_keys=atol(optarg);
+				break;
+			case 'h':
+				filtering=0;
+				break;
+			case 'H':
+				cache_slots=atol(optarg);
+				break;
+			case 'Z':
+				lookup_skew=atof(optarg);
+				if(lookup_skew<0 || lookup_skew>=1){
+					fprintf(stderr,"-Z needs a skew in [0,1)\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'C':
+				compacting=1;
+				break;
+			case 'P':
+				if(!place_parse(optarg)){
+					fprintf(stderr,"-P needs compact, scatter or a list of cpus it can run on\n");
+					exit(EXIT_FAILURE);
+				}
+				break;
 			default:
-				fprintf(stderr,"Usage: %s [-nsq]\n",argv[0]);
+				fprintf(stderr,"Usage: %s [-nsqetfzrdkmbpwyxoucilagjvhHZCP]\n",argv[0]);
 				exit(EXIT_FAILURE);
 		}
 	}
@@ -128,637 +857,2467 @@ void parse_args(int argc, char *argv[], int *no_adds, int *seed, int *quiet){
 }
 
 
-// adds a specified value to the tree (-1 for random)
-void add_value(int new_val){
+// adds a specified value to the tree (-1 for random), returns 1 if added
+int add_value(int new_val){
+	settle_loaded();
 	if(new_val==-1){
 		new_val=rand()%max;
 	}
-	// allocates memory for a new node and sets up values
-	NODE *new_node;
-	new_node=(NODE *)malloc(sizeof(NODE));
-	new_node->val=new_val;
-	new_node->left=NULL;
-	new_node->right=NULL;
-	pthread_mutex_init(&(new_node->lock),NULL);
+	// a key the filter knows is there is a duplicate, so nothing is allocated or locked
+	if(key_filter!=NULL && filter_check(key_filter,new_val)==FILTER_PRESENT){return 0;}
+
+	// lock couples down and links the node in (see linked()), starting over if the
+	// value it finds is still being added or deleted
+	start_update();
+	if(!coupled_put(&live,new_val,0)){return 0;}
+#ifdef ORDER_STATS
+	count_added(new_val);
+#endif
+	invalidate_frozen();
+	return 1;
+}
+
+// everything an add does where its node goes in, with the parent (or the root lock) still
+// locked, so nothing walking down can see the node without the rest
+// (unless delete_range has cut it off, see begin_effect())
+void linked(NODE *parent, NODE *node, int side){
+	int on_time=begin_effect();
+	if(parent!=NULL){extend_edge((side)?EDGE_MAX:EDGE_MIN,parent,node);}
+	if(!on_time){late_effect(node->key,1);}
+	else{
+		LINKED(node->key);
+		if(logging){wal_log(WAL_ADD,node->key,0);}	// logged while it's still locked, so in tree order
+	}
+	end_effect();
+}
 
+// deletes a specified value from the tree (-1 for random), returns 1 if deleted
+int delete_value(int del_val){
+	settle_loaded();
+	// randomises delete value if requested
+	if(del_val==-1){
+		del_val=rand()%max;
+	}
+	// a key the filter knows isn't there needs no walk
+	if(key_filter!=NULL && filter_check(key_filter,del_val)==FILTER_ABSENT){return 0;}
+
+#ifdef ORDER_STATS
+	// marks it first so nothing else adds or deletes it while its ancestors are counted down below
+	if(!mark_deleting(del_val)){return 0;}
+#endif
+
+	// lock couples down to the node and unlinks it (see unlinking()), hanging its right
+	// subtree below its left, then retires it
+	start_update();
+	if(!coupled_del(&live,del_val,NULL)){return 0;}
+	invalidate_frozen();
+	return 1;
+}
 
-	NODE *parent, *child;
-	int stop=0;
+// everything a delete or pop does before its node comes out, with the node and its parent
+// (or the root lock) locked (unless delete_range has cut it off, see begin_effect())
+// returns the shape_version it moved on to
+unsigned long unlinking(NODE *node){
+	int on_time=begin_effect();
+	// the node might be on a cached edge path, so moves the count on before it's unlinked
+	unsigned long version=__atomic_add_fetch(&shape_version,1,__ATOMIC_SEQ_CST);
+	if(!on_time){late_effect(node->key,0);}
+	else{
+		// logged while it's locked, so in tree order
+		if(logging){wal_log(WAL_DEL,node->key,0);}
+		// and counted out of the filter and the cache while it's locked too
+		if(key_filter!=NULL){filter_remove(key_filter,node->key);}
+		if(hot_cache!=NULL){cache_invalidate(hot_cache,node->key);}
+	}
+	end_effect();
+	return version;
+}
 
-	// locks the root lock (to find current root)
-	pthread_mutex_lock(&root_lock);	
+// returns 1 if a value is in the tree
+int lookup_value(int val){
+	// answers from a loaded snapshot until something needs the tree
+	if(__atomic_load_n(&loaded,__ATOMIC_ACQUIRE)){return snap_search(mapped,val);}
 
-	// if its the root node it sets the pointer to our new node and sets break condition
-	if(tree_root==NULL){
-		tree_root=new_node;
-		pthread_mutex_unlock(&root_lock);
-		stop=1;
+	// and from the filter if it knows
+	if(key_filter!=NULL){
+		int known=filter_check(key_filter,val);
+		if(known!=FILTER_MAYBE){return known==FILTER_PRESENT;}
 	}
-	// otherwise sets parent as the current root and locks it, and unlocks root lock
-	else{
-		parent=tree_root;
-		pthread_mutex_lock(&(parent->lock));
-		pthread_mutex_unlock(&root_lock);
+
+	// then from the cache, which keeps the slot it read so a stale walk can't fill it
+	if(hot_cache==NULL){return find_value(val);}
+	unsigned long ticket;
+	int found=cache_check(hot_cache,val,&ticket);
+	if(found==CACHE_MISS){
+		found=find_value(val);
+		cache_fill(hot_cache,val,found,ticket);
+	}
+	return found==CACHE_PRESENT;
+}
+
+// lock couples down to a value, returns 1 if it's there
+int find_value(int val){
+	return coupled_get(&live,val,NULL);
+}
+
+// counts a key into the filter where its add takes effect (its node or parent still locked)
+// and drops it from the cache, where it might be cached as missing
+void mark_linked(int val){
+	if(key_filter!=NULL){filter_add(key_filter,val);}
+	if(hot_cache!=NULL){cache_invalidate(hot_cache,val);}
+}
+
+// counts every key of a tree nobody else is using into the filter (or out)
+void filter_tree(NODE *tree, int add){
+	if(key_filter==NULL || tree==NULL){return;}
+	if(add){filter_add(key_filter,tree->key);}
+	else{filter_remove(key_filter,tree->key);}
+	filter_tree(tree->left,add);
+	filter_tree(tree->right,add);
+}
+
+// rebuilds the filter from the tree and empties the cache (no other threads may be using it)
+void refilter(){
+	if(hot_cache!=NULL){cache_reset(hot_cache);}
+	if(key_filter==NULL){return;}
+	filter_reset(key_filter);
+	filter_tree(live.root,1);
+}
+
+#ifdef ORDER_STATS
+// counts a newly linked value into the sizes on its path, after which it's visible
+void count_added(int val){
+	NODE *parent, *child;
+
+	pthread_mutex_lock(&live.root_lock);
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+
+	// lock couples down adding one to every node above it (it can't move out from under this)
+	while(parent->key!=val){
+		ADD_SIZE(parent,1);
+		if(val<parent->key){child=parent->left;}
+		else{child=parent->right;}
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
 	}
+	ADD_SIZE(parent,1);
+	parent->state=NODE_LIVE;	// this is where the add takes effect
+	mark_linked(val);
+	pthread_mutex_unlock(&(parent->lock));
+}
 
+// marks a value for deleting, returns 0 if it isn't in the tree
+// waits for any add or delete of the same value to finish first
+int mark_deleting(int val){
+	NODE *parent, *child;
 
+	while(1){
+		pthread_mutex_lock(&live.root_lock);
+		if(live.root==NULL){
+			pthread_mutex_unlock(&live.root_lock);
+			return 0;
+		}
+		parent=live.root;
+		pthread_mutex_lock(&(parent->lock));
+		pthread_mutex_unlock(&live.root_lock);
 
-	// loops through until stop is set to 1
-	while(stop==0){
+		while(parent->key!=val){
+			if(val<parent->key){child=parent->left;}
+			else{child=parent->right;}
 
-		// if the new value is less than the current value at parent go left
-		if(new_val<parent->val){
-			// checks if the node to the left is set (sets it as new node if so and breaks out)
-			if(parent->left==NULL){
-				parent->left=new_node;
-				pthread_mutex_unlock(&(parent->lock));
-				stop=1;
-			}
-			// otherwise moves pointer forwards (unlocks parent and locks next node)
-			else{
-				child=parent->left;
-				pthread_mutex_lock(&(child->lock));
+			if(child==NULL){
 				pthread_mutex_unlock(&(parent->lock));
-				parent=child;
+				return 0;
 			}
+			pthread_mutex_lock(&(child->lock));
+			pthread_mutex_unlock(&(parent->lock));
+			parent=child;
 		}
-		// if the new value is less than the current value at parent go right
-		else if(new_val>parent->val){
-			// checks if the node to the right is set (sets it as new node if so and breaks out)
-			if(parent->right==NULL){
-				parent->right=new_node;
-				pthread_mutex_unlock(&(parent->lock));
-				stop=1;
-			}
-			// otherwise moves pointer forwards (unlocks parent and locks next node)
-			else{
-				child=parent->right;
-				pthread_mutex_lock(&(child->lock));
-				pthread_mutex_unlock(&(parent->lock));
-				parent=child;
-			}
+
+		// a node still being added isn't in the tree yet
+		if(parent->state==NODE_ADDING){
+			pthread_mutex_unlock(&(parent->lock));
+			return 0;
 		}
-		// else the value is already in the tree so free up the node and break out
-		else{
+		if(parent->state==NODE_LIVE){
+			parent->state=NODE_DELETING;
 			pthread_mutex_unlock(&(parent->lock));
-			free(new_node);
-			return;
+			return 1;
 		}
+		pthread_mutex_unlock(&(parent->lock));
+		sched_yield();
 	}
-	// prints out info unless quiet and updates add counter
-	if(quiet==0){printf("Added %0*d\n",gap,new_val);}
-	add_counter++;
-	return;
 }
 
-// finds a place to put new in the direction of dir from start
-void find_gap(NODE **start, NODE **new, int dir){
-	NODE *parent=*start;
-	NODE *child;
+// size of a subtree whose parent is locked
+long subtree_size(NODE *tree){
+	long size;
+	if(tree==NULL){return 0;}
+	pthread_mutex_lock(&(tree->lock));
+	size=tree->size;
+	pthread_mutex_unlock(&(tree->lock));
+	return size;
+}
 
-	// if we're going in left direction
-	if(dir==0){
-		// loops through looking for an empty spot to place new
-		while(1){
-			// if the leftside is empty it places new and unlocks the nodes
-			if(parent->left==NULL){
-				parent->left=*new;
-				pthread_mutex_unlock(&(parent->lock));
-				pthread_mutex_unlock(&((*new)->lock));
-				return;
-			}
-			// else it moves forwards and locks/unlocks
-			else{
-				child=parent->left;
-				pthread_mutex_lock(&(child->lock));
-				pthread_mutex_unlock(&(parent->lock));
-				parent=child;
-			}
-		}
+// number of values in the tree below val
+// adds up everything left of the path to val (exact once the updates in flight have finished)
+long rank_value(int val){
+	NODE *parent, *child;
+	long rank=0;
+
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		return 0;
 	}
-	if(dir==1){
-		// loops through looking for an empty spot to place new
-		while(1){
-			// if the rightside is empty it places new and unlocks the nodes
-			if(parent->right==NULL){
-				parent->right=*new;
-				pthread_mutex_unlock(&(parent->lock));
-				pthread_mutex_unlock(&((*new)->lock));
-				return;
-			}
-			// else it moves forwards and locks/unlocks
-			else{
-				child=parent->right;
-				pthread_mutex_lock(&(child->lock));
-				pthread_mutex_unlock(&(parent->lock));
-				parent=child;
-			}
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+
+	while(1){
+		// the node and its left subtree are below val
+		if(val>parent->key){
+			rank+=subtree_size(parent->left)+VISIBLE(parent);
+			child=parent->right;
+		}
+		else if(val==parent->key){
+			rank+=subtree_size(parent->left);
+			break;
 		}
+		else{child=parent->left;}
+
+		if(child==NULL){break;}
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
 	}
-	return;
+	pthread_mutex_unlock(&(parent->lock));
+	return rank;
 }
 
+// finds the kth smallest value (counting from 0), returns 0 if there are fewer values than that
+int select_value(long k, int *val){
+	NODE *parent, *child;
+	long left;
+	int found=0;
 
-// deletes a specified value from the tree (-1 for random)
-void delete_value(int del_val){
-	// randomises delete value if requested
-	if(del_val==-1){
-		del_val=rand()%max;
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		return 0;
 	}
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+
+	while(1){
+		left=subtree_size(parent->left);
+		if(k<left){child=parent->left;}
+		else if(k==left && VISIBLE(parent)){
+			*val=parent->key;
+			found=1;
+			break;
+		}
+		// skips the left subtree and the node
+		else{
+			k-=left+VISIBLE(parent);
+			child=parent->right;
+		}
 
-	NODE *parent, *deletee;
+		if(child==NULL){break;}
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
+	}
+	pthread_mutex_unlock(&(parent->lock));
+	return found;
+}
 
-	// locks the root lock
-	pthread_mutex_lock(&root_lock);
-	// if the tree is empty, there's nothing to delete so return
-	if(tree_root==NULL){
-		pthread_mutex_unlock(&root_lock);
-		return;
+// number of values in the tree (the root's size)
+long tree_size(){
+	long size=0;
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root!=NULL){
+		pthread_mutex_lock(&(live.root->lock));
+		size=live.root->size;
+		pthread_mutex_unlock(&(live.root->lock));
 	}
-	// else set parent as current root and lock it
-	else{
-		parent=tree_root;
-		pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+	return size;
+}
+#endif
+
+
+
+// cuts every value in [lo,hi] out of the tree, returns 1 if there were any
+// all of them sit below the highest node in the range, so it locks that node and its
+// parent, splits its subtrees down the paths to lo and hi, joins what's left back into
+// balance and swaps that in under the parent in one step. Only the two paths and the
+// joins are walked (the nodes kept from the paths stay locked until the swap); the
+// subtrees hanging off the paths are handed whole to the reclaim thread, which waits
+// for any update still inside them before freeing them. Those updates are marked late
+// (see catch_late()) so none of them logs or sets a bit for a subtree that's gone.
+// With ORDER_STATS it deletes the values one at a time instead
+int delete_range(int lo, int hi){
+	NODE *parent=NULL, *node, *child, *left, *right, *last=NULL, *joined;
+	RECLAIM_JOB *job;
+	HELD_NODES held={NULL,0,0};
+	int on_time, i;
+
+	settle_loaded();
+	if(lo>hi){return 0;}
+
+#ifdef ORDER_STATS
+	// cutting out whole subtrees would leave the sizes above them to fix up, so it deletes
+	// the values one at a time instead
+	CURSOR cursor;
+	int val, any=0;
+	cursor_open(&cursor,lo,hi,SCAN_SNAPSHOT);
+	while(cursor_next(&cursor,&val)){
+		if(delete_value(val)){
+			__sync_fetch_and_add(&reclaimed,1);
+			any=1;
+		}
+	}
+	cursor_close(&cursor);
+	return any;
+#endif
+
+	// locks the root lock (to find current root)
+	start_update();
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		return 0;
+	}
+	node=live.root;
+	pthread_mutex_lock(&(node->lock));
+	stepped(node);
+
+	// lock couples down to the highest node in the range, keeping its parent (or the root lock) locked
+	while(node->key<lo || node->key>hi){
+		if(node->key<lo){child=node->right;}
+		else{child=node->left;}
+
+		if(child==NULL){
+			pthread_mutex_unlock(&(node->lock));
+			if(parent!=NULL){pthread_mutex_unlock(&(parent->lock));}
+			else{pthread_mutex_unlock(&live.root_lock);}
+			return 0;
+		}
+		pthread_mutex_lock(&(child->lock));
+		stepped(child);
+		if(parent!=NULL){pthread_mutex_unlock(&(parent->lock));}
+		else{pthread_mutex_unlock(&live.root_lock);}
+		parent=node;
+		node=child;
 	}
 
+	__atomic_fetch_add(&shape_version,1,__ATOMIC_SEQ_CST);	// the cut might take part of an edge path
+	if(hot_cache!=NULL){cache_invalidate_range(hot_cache,lo,hi);}
 
-	int del_l=0, del_r=0, del_root=0;
-	int stop=0,counter=0;
+	job=malloc(sizeof(RECLAIM_JOB));
+	job->count=job->cap=0;
+	job->roots=NULL;
 
-	// loops through looking for the value
-	while(stop==0){
-		// goes left if the value is less than the current value
-		if(del_val<parent->val){
-			// if the node on the left isn't set, then break
-			if(parent->left==NULL){
-				pthread_mutex_unlock(&(parent->lock));
-				stop=1;
-			}	
-			// if the node on the left is the delete value, lock the deletee and break
-			else if(parent->left->val==del_val){
-				deletee=parent->left;
-				pthread_mutex_lock(&(deletee->lock));
-				del_l=1;
-				stop=1;
-			}	
-			// else move the pointer forward and lock the next node and unlock previous
-			else{
-				deletee=parent->left;
-				pthread_mutex_lock(&(deletee->lock));
-				pthread_mutex_unlock(&(parent->lock));
-				parent=deletee;
-			}
-				
-		}
-		// otherwise goes right
-		else if(del_val>parent->val){
-			// if the node on the right isn't set, then break
-			if(parent->right==NULL){
-				pthread_mutex_unlock(&(parent->lock));
-				stop=1;
-			}	
-			// if the node on the right is the delete value, lock the deletee and break
-			else if(parent->right->val==del_val){
-				deletee=parent->right;
-				pthread_mutex_lock(&(deletee->lock));
-				del_r=1;
-				stop=1;
-			}	
-			// else move the pointer forward and lock the next node and unlock previous
-			else{
-				deletee=parent->right;
-				pthread_mutex_lock(&(deletee->lock));
-				pthread_mutex_unlock(&(parent->lock));
-				parent=deletee;
-			}
+	// splits the values below lo off the left and above hi off the right
+	left=node->left;
+	if(left!=NULL){
+		pthread_mutex_lock(&(left->lock));
+		left=split_below(left,lo,job,&held,&last);
+	}
+	right=node->right;
+	if(right!=NULL){
+		pthread_mutex_lock(&(right->lock));
+		right=split_above(right,hi,job,&held);
+	}
+
+	// and joins them with the left side's biggest node between them
+	if(last!=NULL){joined=graft_trees(&held,left,last,right);}
+	else{joined=right;}
+
+	// nothing new can get below the node, so only the updates already there can still
+	// take effect in the range. Any that haven't yet are marked late, and any doing it
+	// now finish first, so the log has the range after them and before anything held
+	// up above the node
+	catch_late(lo,hi);
+	on_time=begin_effect();
+	if(on_time){
+		if(logging){wal_log(WAL_RANGE,lo,hi);}
+		if(key_filter!=NULL){filter_remove_range(key_filter,lo,hi);}	// and cleared after any bit they set
+	}
+	end_effect();
+
+	// swaps the join in for the node (this is where the delete takes effect)
+	if(parent==NULL){live.root=joined;}
+	else if(parent->left==node){parent->left=joined;}
+	else{parent->right=joined;}
+
+	node->left=node->right=NULL;
+	pthread_mutex_unlock(&(node->lock));
+	add_reclaim(job,node);
+	for(i=0;i<held.count;i++){pthread_mutex_unlock(&(held.nodes[i]->lock));}
+	free(held.nodes);
+	if(parent!=NULL){pthread_mutex_unlock(&(parent->lock));}
+	else{pthread_mutex_unlock(&live.root_lock);}
+	invalidate_frozen();
+
+	// queues the cut out subtrees for the reclaim thread
+	pthread_mutex_lock(&reclaim_lock);
+	job->next=reclaim_queue;
+	reclaim_queue=job;
+	pthread_cond_signal(&reclaim_cond);
+	pthread_mutex_unlock(&reclaim_lock);
+	return 1;
+}
+
+// keeps the values below lo in a locked subtree and returns it (or NULL)
+// walks down the path to lo: nodes below lo stay locked in held with their left subtrees,
+// the rest go to job with their right subtrees (which are all in the range). The kept
+// nodes are then joined back up from the bottom, all but the biggest, which is left
+// out in *max for delete_range to join the two sides with
+NODE *split_below(NODE *tree, int lo, RECLAIM_JOB *job, HELD_NODES *held, NODE **max){
+	NODE *node=tree, *next, *kept;
+	int first=held->count, last, i;
+
+	while(node!=NULL){
+		// keeps the node and its left, and carries on down its right
+		if(node->key<lo){
+			add_held(held,node);
+			next=node->right;
 		}
-		// else (will only be called if the root node is the deleted value)
+		// cuts out the node and its right, and carries on down its left
 		else{
-			del_root=1;
-			stop=1;
+			next=node->left;
+			node->left=NULL;
 		}
 
-		// if we aren't deleting the root then we can unlock root_lock
-		if(counter==0 && del_root==0){
-			pthread_mutex_unlock(&root_lock);
+		if(next!=NULL){pthread_mutex_lock(&(next->lock));}
+		if(node->key>=lo){
+			pthread_mutex_unlock(&(node->lock));
+			add_reclaim(job,node);
 		}
-		counter++;	// counter ensures we only unlock root lock once
+		node=next;
+	}
+	if(held->count==first){
+		*max=NULL;
+		return NULL;
 	}
-			
 
+	// each kept node is bigger than everything kept above it, so it joins its left subtree
+	// with what's been joined below it
+	last=held->count-1;
+	*max=held->nodes[last];
+	kept=(*max)->left;
+	for(i=last-1;i>=first;i--){
+		node=held->nodes[i];
+		kept=graft_trees(held,node->left,node,kept);
+	}
+	return kept;
+}
 
-	// if the value to be deleted is to the left of the parent
-	if(del_l==1){
-		// if the value to the left of the deletee is not empty
-		if(deletee->left!=NULL){
-			pthread_mutex_lock(&(deletee->left->lock));		// lock deletee's left
-			parent->left=deletee->left;				// set the parent's left to point to the deletee's left
+// keeps the values above hi in a locked subtree and returns it (SIMILAR to split_below,
+// but joining every kept node)
+NODE *split_above(NODE *tree, int hi, RECLAIM_JOB *job, HELD_NODES *held){
+	NODE *node=tree, *next, *kept=NULL;
+	int first=held->count, i;
 
-			// if deletee's right is also not empty
-			if(deletee->right!=NULL){
-				pthread_mutex_lock(&(deletee->right->lock));	// lock deletee's right
-				find_gap(&(parent->left),&(deletee->right),1);	// and try and place it to the right of deletee's left (unlocks both)
-			}
-			else{
-				pthread_mutex_unlock(&(deletee->left->lock));	// else unlock deletee's left
-			}
-		}
-		// else if the value to the right is not empty (but the left is)
-		else if(deletee->right!=NULL){
-			parent->left=deletee->right;	// can set parent's left to deletee's right as deletee's left is empty
+	while(node!=NULL){
+		if(node->key>hi){
+			add_held(held,node);
+			next=node->left;
 		}
-		// else if both children are empty
 		else{
-			parent->left=NULL;		// set parent's left to NULL 
+			next=node->right;
+			node->right=NULL;
 		}
 
-		// unlock the nodes and free deletee
-		pthread_mutex_unlock(&(deletee->lock));
-		pthread_mutex_unlock(&(parent->lock));
-		free(deletee);			
-	}
-	// else if it is to the right of the parent (SIMILAR TO del_l)
-	else if(del_r==1){
-		if(deletee->left!=NULL){
-			pthread_mutex_lock(&(deletee->left->lock));
-			parent->right=deletee->left;
-			if(deletee->right!=NULL){
-				pthread_mutex_lock(&(deletee->right->lock));
-				find_gap(&(parent->right),&(deletee->right),1);
-			}
-			else{
-				pthread_mutex_unlock(&(deletee->left->lock));
-			}
-		}
-		else if(deletee->right!=NULL){
-			parent->right=deletee->right;
-		}
-		else{
-			parent->right=NULL;
-		}
-		pthread_mutex_unlock(&(deletee->lock));
-		pthread_mutex_unlock(&(parent->lock));
-		free(deletee);
-	}
-	// else if the root is to be deleted
-	else if(del_root==1){
-		// checks if the root's left is set
-		if(parent->left!=NULL){		
-			pthread_mutex_lock(&(parent->left->lock));		// locks roots left
-			tree_root=parent->left;					// points the root the old root's left
-			if(parent->right!=NULL){				// checks if old root's right is also non empty
-				pthread_mutex_lock(&(parent->right->lock));	// locks old root's right if so
-				find_gap(&(parent->left),&(parent->right),1);	// finds a spot for it to the right of the new root
-			}
-			else{
-				pthread_mutex_unlock(&(parent->left->lock));	// else unlocks parent's left
-			}
-		}
-		// else checks if the root's right is set (left isn't)
-		else if(parent->right!=NULL){		
-			tree_root=parent->right;			// points the root to the old root's right (as root's left is empty)
-		}
-		else{
-			tree_root=NULL;					// else points the root to NULL
+		if(next!=NULL){pthread_mutex_lock(&(next->lock));}
+		if(node->key<=hi){
+			pthread_mutex_unlock(&(node->lock));
+			add_reclaim(job,node);
 		}
-
-		pthread_mutex_unlock(&(parent->lock));		// unlocks the node
-		pthread_mutex_unlock(&root_lock);		// unlocks the root lock
-		free(parent);					// frees the old root
+		node=next;
 	}
 
-	// If a node was deleted then update counter and print info if requested
-	if(del_l+del_r+del_root>0){
-		del_counter++;
-		if(quiet==0){printf("Deleted %0*d\n",gap,del_val);}
+	for(i=held->count-1;i>=first;i--){
+		node=held->nodes[i];
+		kept=graft_trees(held,kept,node,node->right);
 	}
-	return;
+	return kept;
 }
 
+// locks a live node for delete_range unless it's NULL or already held
+// only ever called on a child of a held node, so it locks top down like everything else
+void hold(HELD_NODES *held, NODE *node){
+	int i;
+	if(node==NULL){return;}
+	for(i=0;i<held->count;i++){
+		if(held->nodes[i]==node){return;}
+	}
+	pthread_mutex_lock(&(node->lock));
+	add_held(held,node);
+}
 
+// counts a node delete_range has already locked as held
+void add_held(HELD_NODES *held, NODE *node){
+	if(held->count==held->cap){
+		held->cap=(held->cap==0)?64:2*held->cap;
+		held->nodes=realloc(held->nodes,held->cap*sizeof(NODE *));
+	}
+	held->nodes[held->count++]=node;
+}
 
-// recursive function to find the height of the tree
-// input's parent should be locked
-int find_height(NODE **tree){
-	if(*tree==NULL){return 0;}		// if the input is NULL return 0
-	int left, right;
-	
-	pthread_mutex_lock(&((*tree)->lock));	// locks the input
-
-	left=find_height(&((*tree)->left));	// check left node's height
-	right=find_height(&((*tree)->right));	// and rights
-
-	pthread_mutex_unlock(&((*tree)->lock));	// unlocks
-
-	if(left>right){return left+1;}		// if left is bigger return left's height plus one for the current node
-	return right+1;				// else return right's height plus one
+// join_trees for live nodes below ones delete_range holds: every node it measures or moves
+// is held first (the heights are hints, as the balancer last left them)
+NODE *graft_trees(HELD_NODES *held, NODE *left, NODE *mid, NODE *right){
+	hold(held,left);
+	hold(held,right);
+	if(HEIGHT(left)>HEIGHT(right)+1){return graft_right(held,left,mid,right);}
+	if(HEIGHT(right)>HEIGHT(left)+1){return graft_left(held,left,mid,right);}
+	mid->left=left;
+	mid->right=right;
+	refresh(mid);
+	return mid;
 }
 
+// graft_trees when left is the higher (goes down its right side)
+NODE *graft_right(HELD_NODES *held, NODE *left, NODE *mid, NODE *right){
+	hold(held,left);
+	if(HEIGHT(left)<=HEIGHT(right)+1){
+		mid->left=left;
+		mid->right=right;
+		refresh(mid);
+		return mid;
+	}
+	left->right=graft_right(held,left->right,mid,right);
+	return regraft(held,left);
+}
 
-// function to recursively rebalance a tree from a given parent node and direction from which the tree comes from 
-int rebalance(NODE **tree, NODE **parent, int direction){
-	int counter=0;					// sets up a counter for amount of rebalances required
-	int l=0, r=0;
+// graft_trees when right is the higher (goes down its left side)
+NODE *graft_left(HELD_NODES *held, NODE *left, NODE *mid, NODE *right){
+	hold(held,right);
+	if(HEIGHT(right)<=HEIGHT(left)+1){
+		mid->left=left;
+		mid->right=right;
+		refresh(mid);
+		return mid;
+	}
+	right->left=graft_left(held,left,mid,right->left);
+	return regraft(held,right);
+}
 
-	// if the tree isn't empty find the heights at each side
-	if((*tree)!=NULL){
-		l=find_height(&(*tree)->left);		// finds the height to the left
-		r=find_height(&(*tree)->right);		// and to the right
+// restore for a held live node: holds its children, and the ones below that it
+// measures or lifts, first
+NODE *regraft(HELD_NODES *held, NODE *node){
+	NODE *child;
+	int balance;
+
+	hold(held,node->left);
+	hold(held,node->right);
+	balance=HEIGHT(node->left)-HEIGHT(node->right);
+	if(balance>1){
+		child=node->left;
+		hold(held,child->left);
+		hold(held,child->right);
+		if(HEIGHT(child->left)<HEIGHT(child->right)){
+			hold(held,child->right->left);
+			hold(held,child->right->right);
+			node->left=lift(child,1);
+		}
+		return lift(node,0);
 	}
-	// otherwise it doesn't need rebalancing 
-	else{
-		return 0;
+	if(balance<-1){
+		child=node->right;
+		hold(held,child->left);
+		hold(held,child->right);
+		if(HEIGHT(child->right)<HEIGHT(child->left)){
+			hold(held,child->left->left);
+			hold(held,child->left->right);
+			node->right=lift(child,0);
+		}
+		return lift(node,1);
 	}
+	refresh(node);
+	return node;
+}
 
-	NODE *ptemp=*parent, *ctemp=*tree;		// sets up temps for parent and child
+// adds a cut out subtree to a reclaim job
+void add_reclaim(RECLAIM_JOB *job, NODE *tree){
+	if(job->count==job->cap){
+		job->cap=(job->cap==0)?16:2*job->cap;
+		job->roots=realloc(job->roots,job->cap*sizeof(NODE *));
+	}
+	job->roots[job->count++]=tree;
+}
 
-	// parent and child equal it means we are at the root
-	if(ptemp==ctemp){
-		// keeps rebalancing while the difference in sizes is bigger than 1 (AVL tree)
-		while(abs(l-r)>1){
-			// loops while the right side is bigger
-			while(r-l>1){
-				tree_root=ptemp->right;					// sets the root to the old root's right
-				ptemp->right=NULL;					// sets the old roots right to NULL
-				find_gap(&tree_root,&ptemp,0);				// slots old root to left of new root
+// locks each node of a reclaim job's subtrees in turn (top down, like everything else, so
+// it stays behind any operation still inside them), then nothing is left in them once it's done
+void wait_out(RECLAIM_JOB *job){
+	NODE **stack, *node;
+	long top=0, cap=job->count+64, i;
+
+	stack=malloc(cap*sizeof(NODE *));
+	for(i=0;i<job->count;i++){stack[top++]=job->roots[i];}
+	while(top>0){
+		node=stack[--top];
+		pthread_mutex_lock(&(node->lock));
+		if(top+2>cap){
+			cap*=2;
+			stack=realloc(stack,cap*sizeof(NODE *));
+		}
+		if(node->right!=NULL){stack[top++]=node->right;}
+		if(node->left!=NULL){stack[top++]=node->left;}
+		pthread_mutex_unlock(&(node->lock));
+	}
+	free(stack);
+}
 
-		
-				ptemp=tree_root;					// updates ptemp to new parent
-				pthread_mutex_lock(&(ptemp->lock));			// relocks it
+// pthreads function to free cut out subtrees until the tree is destroyed
+// it waits out any update still inside them first (so delete_range doesn't have to),
+// and a stale edge path could still hold one of the nodes, so they're retired rather
+// than freed straight away
+void *p_reclaim(){
+	RECLAIM_JOB *job;
+	TEARDOWN_TASK all;
+
+	while(1){
+		pthread_mutex_lock(&reclaim_lock);
+		while(reclaim_queue==NULL && !reclaim_stop){
+			pthread_cond_wait(&reclaim_cond,&reclaim_lock);
+		}
+		job=reclaim_queue;
+		if(job==NULL){
+			pthread_mutex_unlock(&reclaim_lock);
+			return NULL;
+		}
+		reclaim_queue=job->next;
+		pthread_mutex_unlock(&reclaim_lock);
+
+		wait_out(job);
+		all.stack=job->roots;
+		all.top=job->count;
+		all.cap=job->cap;
+		all.cut=1;
+		p_teardown(&all);
+		__sync_fetch_and_add(&reclaimed,all.freed);
+
+		free(all.stack);
+		free(job);
+	}
+}
 
-				// updates l, r and counter
-				l=find_height(&(ptemp->left));
-				r=find_height(&(ptemp->right));
-				counter++;	
-			}
-			// loops while the left side is bigger
-			while(l-r>1){
-				tree_root=ptemp->left;					// sets the root to the old root's left
-				ptemp->left=NULL;					// sets the old roots left to NULL
-				find_gap(&tree_root,&ptemp,1);				// slots old root to left of new root
+// gives a thread's update slot back when it exits (the next owner carries on its numbering)
+void release_slot(void *arg){
+	UPDATE_SLOT *slot=(UPDATE_SLOT *)arg;
+	__atomic_store_n(&slot->used,0,__ATOMIC_RELEASE);
+}
 
-		
-				ptemp=tree_root;					// updates ptemp to new parent
-				pthread_mutex_lock(&(ptemp->lock));			// relocks
+void make_slot_key(){
+	pthread_key_create(&slot_key,release_slot);
+}
 
-				l=find_height(&(ptemp->left));
-				r=find_height(&(ptemp->right));
-				counter++;						// increments counter
+// finds (or claims) the calling thread's update slot
+UPDATE_SLOT *get_slot(){
+	int i, old;
+	if(my_slot!=NULL){return my_slot;}
+	pthread_once(&slot_once,make_slot_key);
+
+	for(i=0;i<UPDATE_SLOTS;i++){
+		// claims the first unused slot
+		if(__atomic_load_n(&update_slots[i].used,__ATOMIC_ACQUIRE)==0 && __sync_bool_compare_and_swap(&update_slots[i].used,0,1)){
+			my_slot=&update_slots[i];
+			pthread_setspecific(slot_key,my_slot);
+
+			// bumps the high water mark so catch_late() scans this slot
+			old=__atomic_load_n(&num_slots,__ATOMIC_ACQUIRE);
+			while(old<i+1 && !__sync_bool_compare_and_swap(&num_slots,old,i+1)){
+				old=__atomic_load_n(&num_slots,__ATOMIC_ACQUIRE);
 			}
+			return my_slot;
 		}
-		// checks if both sides are non empty and rebalances from there if not
-		if(ptemp->left!=NULL){
-			pthread_mutex_lock(&(ptemp->left->lock));
-			counter+=rebalance(&(ptemp->left),&ptemp,0);
-		}
-		if(ptemp->right!=NULL){
-			pthread_mutex_lock(&(ptemp->right->lock));
-			counter+=rebalance(&(ptemp->right),&ptemp,1);
-		}
-		
-		// unlocks the root and root lock
-		pthread_mutex_unlock(&(ptemp->lock));
-		pthread_mutex_unlock(&root_lock);
 	}
+	fprintf(stderr,"More than %d threads updating the tree\n",UPDATE_SLOTS);
+	exit(EXIT_FAILURE);
+}
 
-	// otherwise we are at a non root node
-	else{
-		// loops through while the gap is bigger than one
-		while(abs(l-r)>1){
-			// loops while the right side is bigger
-			while((r-l)>1){
-				// if the direction from the parent is left
-				if(direction==0){
-					pthread_mutex_lock(&(ctemp->right->lock));
-					ptemp->left=ctemp->right;		// sets parent's left to child's right
-					ctemp->right=NULL;			// set child's right to NULL
-					find_gap(&(ptemp->left),&ctemp,0);	// slots in child to left of parent's left
-
-					ctemp=ptemp->left;			// update ctemp
-					pthread_mutex_lock(&(ctemp->lock));	// relock
-
-				}	
-
-				// else if the direction from parent is right
-				else{
-					pthread_mutex_lock(&(ctemp->right->lock));
-					ptemp->right=ctemp->right;		// sets parent's right to child's right
-					ctemp->right=NULL;			// set child's right to NULL
-					find_gap(&(ptemp->right),&ctemp,0);	// slots in child to left of parent's right
-
-					ctemp=ptemp->right;			// update ctemp
-					pthread_mutex_lock(&(ctemp->lock));	// relock
+// gives the calling thread's next update a new number, so a mark left for its last one doesn't count
+void start_update(){
+	get_slot()->seq++;
+}
 
-				}
+// publishes the node an update has just locked, before it lets go of the one above
+// (so a delete_range that locks that one after it sees where the update went)
+void stepped(NODE *node){
+	UPDATE_SLOT *slot=get_slot();
+	__atomic_store_n(&(slot->held),((unsigned long)slot->seq<<32)|(unsigned int)node->key,__ATOMIC_RELEASE);
+}
 
-				// updates l,r and counter
-				l=find_height(&(ctemp->left));
-				r=find_height(&(ctemp->right));
+// marks the calling thread's update as taking effect, returns 0 if a delete_range has
+// cut it off (it's inside a subtree that's gone, and the range has already been logged
+// and cleared from the filter, so it mustn't log or set a bit of its own)
+// either catch_late() sees it taking effect and waits, or it sees the mark
+int begin_effect(){
+	UPDATE_SLOT *slot=get_slot();
+	__atomic_store_n(&(slot->effecting),1,__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&(slot->late),__ATOMIC_SEQ_CST)!=slot->seq;
+}
 
-				counter++;	
-			}
+// marks it done taking effect
+void end_effect(){
+	__atomic_store_n(&(my_slot->effecting),0,__ATOMIC_RELEASE);
+}
 
-				
-			// loops while the left side is bigger
-			while((l-r)>1){						// SIMILAR to ABOVE
-				// if the direction from the parent is left
-				if(direction==0){
-					pthread_mutex_lock(&(ctemp->left->lock));
-					ptemp->left=ctemp->left;		// sets parent's left to child's left
-					ctemp->left=NULL;			// set child's right to NULL
-					find_gap(&(ptemp->left),&ctemp,1);	// slots in child to right of parent's left
+// what an update a cut has undone still does: a Bloom filter counts its node in (or out),
+// since the reclaim thread counts out whatever nodes it finds in the cut, and the cache
+// drops the key. A bitmap has already had the whole range cleared
+void late_effect(int val, int add){
+	if(key_filter!=NULL && !filter_exact(key_filter)){
+		if(add){filter_add(key_filter,val);}
+		else{filter_remove(key_filter,val);}
+	}
+	if(hot_cache!=NULL){cache_invalidate(hot_cache,val);}
+}
 
-					ctemp=ptemp->left;			// update ctemp
-					pthread_mutex_lock(&(ctemp->lock));	// relock
+// marks every other update that's holding a node in [lo,hi] late and waits for any already
+// taking effect. delete_range calls it with everything it cuts locked or cut off, so those
+// are exactly the updates inside the cut, and none of them can get out of it
+void catch_late(int lo, int hi){
+	UPDATE_SLOT *me=get_slot(), *slot;
+	unsigned long held;
+	unsigned int seq, late;
+	int i, n=__atomic_load_n(&num_slots,__ATOMIC_ACQUIRE), key;
+
+	for(i=0;i<n;i++){
+		slot=&update_slots[i];
+		if(slot==me){continue;}
+		held=__atomic_load_n(&(slot->held),__ATOMIC_ACQUIRE);
+		key=(int)(unsigned int)held;
+		if(key<lo || key>hi){continue;}
+
+		// never moves the mark back, in case another delete_range has marked a later update
+		seq=(unsigned int)(held>>32);
+		late=__atomic_load_n(&(slot->late),__ATOMIC_SEQ_CST);
+		while((int)(seq-late)>0 && !__atomic_compare_exchange_n(&(slot->late),&late,seq,0,__ATOMIC_SEQ_CST,__ATOMIC_SEQ_CST)){}
+		while(__atomic_load_n(&(slot->effecting),__ATOMIC_SEQ_CST)){sched_yield();}
+	}
+}
 
-				}	
+// collects a subtree's keys in order, keeping the path to the current node locked
+void collect(NODE *tree, COLLECT_JOB *job){
+	pthread_mutex_lock(&(tree->lock));
+	if(tree->left!=NULL){collect(tree->left,job);}
 
-				// else if the direction from parent is right
-				else{
-					pthread_mutex_lock(&(ctemp->left->lock));
-					ptemp->right=ctemp->left;		// sets parent's right to child's left
-					ctemp->left=NULL;			// set child's right to NULL
-					find_gap(&(ptemp->right),&ctemp,1);	// slots in child to right of parent's right
+	// grows the job's array if needed
+	if(job->count==job->cap){
+		job->cap=(job->cap==0)?1024:2*job->cap;
+		job->vals=realloc(job->vals,job->cap*sizeof(int));
+	}
+	if(VISIBLE(tree)){job->vals[job->count++]=tree->key;}
 
-					ctemp=ptemp->right;			// update ctemp
-					pthread_mutex_lock(&(ctemp->lock));	// relock
+	if(tree->right!=NULL){collect(tree->right,job);}
+	pthread_mutex_unlock(&(tree->lock));
+}
 
-				}
+// pthreads function to collect a subtree
+void *p_collect(void *arg){
+	COLLECT_JOB *job=(COLLECT_JOB *)arg;
+	collect(job->tree,job);
+	return NULL;
+}
 
-				l=find_height(&(ctemp->left));
-				r=find_height(&(ctemp->right));
+// locks the top depth levels of the tree and hands out the subtrees below them in order
+void plan_collect(NODE *tree, int depth, COLLECT_JOB *jobs, int *num_jobs, NODE **held, int *num_held){
+	COLLECT_JOB *job;
+	if(depth==0){
+		job=&jobs[(*num_jobs)++];
+		job->tree=tree;
+		return;
+	}
+	pthread_mutex_lock(&(tree->lock));
+	held[(*num_held)++]=tree;
+
+	if(tree->left!=NULL){plan_collect(tree->left,depth-1,jobs,num_jobs,held,num_held);}
+	job=&jobs[(*num_jobs)++];	// the node itself goes between its subtrees
+	job->tree=NULL;
+	job->val=tree->key;
+	job->count=VISIBLE(tree);
+	if(tree->right!=NULL){plan_collect(tree->right,depth-1,jobs,num_jobs,held,num_held);}
+}
 
-				counter++;			// increments counter
+// takes an Eytzinger layout copy of the tree for fast lookups
+// holding the root lock stops new operations starting, and ones already in the tree
+// finish ahead of the collecting threads as every thread locks top down
+void freeze(){
+	settle_loaded();
+	int num_threads=sysconf(_SC_NPROCESSORS_ONLN);
+	int depth=0, num_jobs=0, num_held=0, i;
+	long n=0;
+
+	// one subtree per thread below the top depth levels
+	while((1<<depth)<num_threads){depth++;}
+	COLLECT_JOB *jobs=calloc(1<<(depth+1),sizeof(COLLECT_JOB));
+	NODE **held=malloc((1<<depth)*sizeof(NODE *));
+	pthread_t *handles=malloc((1<<(depth+1))*sizeof(pthread_t));
+
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root!=NULL){
+		plan_collect(live.root,depth,jobs,&num_jobs,held,&num_held);
+	}
+
+	// collects each subtree on its own thread
+	for(i=0;i<num_jobs;i++){
+		if(jobs[i].tree!=NULL){pthread_create(&handles[i],NULL,p_collect,(void *)&jobs[i]);}
+	}
+	for(i=0;i<num_jobs;i++){
+		if(jobs[i].tree!=NULL){pthread_join(handles[i],NULL);}
+		n+=jobs[i].count;
+	}
+
+	// joins the pieces up in order
+	int *sorted=malloc((n+1)*sizeof(int));
+	n=0;
+	for(i=0;i<num_jobs;i++){
+		if(jobs[i].tree!=NULL){
+			memcpy(sorted+n,jobs[i].vals,jobs[i].count*sizeof(int));
+			free(jobs[i].vals);
+		}
+		else if(jobs[i].count>0){sorted[n]=jobs[i].val;}
+		n+=jobs[i].count;
+	}
+
+	// swaps in the new copy (readers may still be using the old one)
+	EYTZ *old=frozen;
+	__atomic_store_n(&frozen,eytz_build(sorted,n,num_threads),__ATOMIC_RELEASE);
+	__atomic_store_n(&frozen_valid,1,__ATOMIC_RELEASE);
+	if(old!=NULL){ebr_retire(old);}
+
+	for(i=0;i<num_held;i++){
+		pthread_mutex_unlock(&(held[i]->lock));
+	}
+	pthread_mutex_unlock(&live.root_lock);
+
+	free(sorted);
+	free(jobs);
+	free(held);
+	free(handles);
+}
+
+// looks up a value in the frozen copy (or the tree if it has changed since)
+int frozen_lookup(int val){
+	int found;
+	EYTZ *snapshot;
+
+	ebr_enter();
+	snapshot=__atomic_load_n(&frozen,__ATOMIC_ACQUIRE);
+	if(snapshot!=NULL && __atomic_load_n(&frozen_valid,__ATOMIC_ACQUIRE)){
+		found=eytz_search(snapshot,val);
+		ebr_exit();
+		return found;
+	}
+	ebr_exit();
+	return lookup_value(val);
+}
+
+// marks the frozen copy out of date (only writes the flag if it's set, so the cache line stays shared)
+void invalidate_frozen(){
+	if(__atomic_load_n(&frozen_valid,__ATOMIC_RELAXED)){
+		__atomic_store_n(&frozen_valid,0,__ATOMIC_RELEASE);
+	}
+}
+
+
+
+// writes the tree to a snapshot file while updates carry on, returns how many keys (-1 on error)
+// copies SAVE_CHUNK or so keys at a time with a snapshot cursor, so updates are only held
+// up under one node for as long as it takes to copy a chunk. The key span of a chunk
+// doubles or halves to keep it near SAVE_CHUNK keys, and empty stretches are skipped with
+// seek_value. Each chunk is as it was when it was copied, so keys added or deleted
+// during the save may or may not be in it
+long save_tree(char *path){
+	SNAP_WRITER *writer=snap_create(path);
+	CURSOR cursor;
+	long span=SAVE_CHUNK, hi, got;
+	int next=INT_MIN, val;
+	if(writer==NULL){return -1;}
+
+	while(seek_value(next,&val)){
+		hi=(long)val+span-1;
+		if(hi>INT_MAX){hi=INT_MAX;}
+		got=0;
+		cursor_open(&cursor,val,hi,SCAN_SNAPSHOT);
+		while(cursor_next(&cursor,&val)){
+			snap_put(writer,val);
+			got++;
+		}
+		cursor_close(&cursor);
+
+		if(got<SAVE_CHUNK/2){span*=2;}
+		else if(got>2*SAVE_CHUNK && span>1){span/=2;}
+		if(hi==INT_MAX){break;}
+		next=hi+1;
+	}
+	return snap_finish(writer);
+}
+
+// loads a snapshot into an empty tree, returns how many keys (-1 on error)
+// the file is mapped and checked, then built straight into a balanced tree on the
+// pool, or with lazy left mapped and lookups binary searched in it until anything
+// else needs the tree. A tree that isn't empty just has the keys added
+long load_tree(char *path, int lazy){
+	SNAP *snap=snap_open(path);
+	long i, n;
+	if(snap==NULL){return -1;}
+	n=snap->n;
+
+	settle_loaded();
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root!=NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		for(i=0;i<n;i++){add_value(snap->keys[i]);}
+		snap_close(snap);
+		return n;
+	}
+	pthread_mutex_unlock(&live.root_lock);
+
+	pthread_mutex_lock(&load_lock);
+	if(mapped!=NULL){snap_close(mapped);}
+	mapped=snap;
+	__atomic_store_n(&loaded,1,__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&load_lock);
+	if(!lazy){settle_loaded();}
+	return n;
+}
+
+// builds a lazily loaded snapshot into the tree if that hasn't happened yet
+// lookups carry on from the snapshot until the tree is swapped in, anything else waits
+void settle_loaded(){
+	NODE *tree;
+	if(!__atomic_load_n(&loaded,__ATOMIC_ACQUIRE)){return;}
+	pthread_mutex_lock(&load_lock);
+	if(loaded){
+		tree=build_balanced(mapped->keys,mapped->n);
+		filter_tree(tree,1);
+		pthread_mutex_lock(&live.root_lock);
+		live.root=tree;
+		pthread_mutex_unlock(&live.root_lock);
+		// the mapping stays until avl_destroy in case a lookup is still searching it
+		__atomic_store_n(&loaded,0,__ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&load_lock);
+}
+
+// builds a balanced subtree from sorted keys, forking big halves onto the pool
+// every node is the median of its keys, so the subtree is as low as it can be
+NODE *build_balanced(int *keys, long n){
+	BUILD_TASK lower;
+	long mid=n/2;
+	if(n==0){return NULL;}
+
+	NODE *node=(NODE *)malloc(sizeof(NODE));
+	node->key=keys[mid];
+	node->chunk=0;
+	pthread_mutex_init(&(node->lock),NULL);
+#ifdef ORDER_STATS
+	node->size=n;
+	node->state=NODE_LIVE;
+#endif
+	if(n>=BUILD_CUTOFF && tpool_size()>1){
+		lower.keys=keys;
+		lower.n=mid;
+		tpool_spawn(&lower.task,p_build,&lower);
+		node->right=build_balanced(keys+mid+1,n-mid-1);
+		tpool_sync(&lower.task);
+		node->left=lower.tree;
+	}
+	else{
+		node->left=build_balanced(keys,mid);
+		node->right=build_balanced(keys+mid+1,n-mid-1);
+	}
+	node->height=((HEIGHT(node->left)>HEIGHT(node->right))?HEIGHT(node->left):HEIGHT(node->right))+1;
+	return node;
+}
+
+// pool function to build the lower half of a sorted array
+void p_build(void *arg){
+	BUILD_TASK *task=(BUILD_TASK *)arg;
+	task->tree=build_balanced(task->keys,task->n);
+}
+
+
+// joins two private trees either side of a node (every key in left < mid's < every key in right)
+// the higher tree's side is followed down to a subtree about as high as the other, which
+// takes its place with mid over the two, and the nodes above are rotated back into balance
+// on the way up. Heights are only hints in the live tree (the balancer keeps them), so a
+// stale one costs balance, never order
+NODE *join_trees(NODE *left, NODE *mid, NODE *right){
+	if(HEIGHT(left)>HEIGHT(right)+1){return join_right(left,mid,right);}
+	if(HEIGHT(right)>HEIGHT(left)+1){return join_left(left,mid,right);}
+	mid->left=left;
+	mid->right=right;
+	refresh(mid);
+	return mid;
+}
+
+// join_trees when left is the higher (goes down its right side)
+NODE *join_right(NODE *left, NODE *mid, NODE *right){
+	if(HEIGHT(left)<=HEIGHT(right)+1){
+		mid->left=left;
+		mid->right=right;
+		refresh(mid);
+		return mid;
+	}
+	left->right=join_right(left->right,mid,right);
+	return restore(left);
+}
+
+// join_trees when right is the higher (goes down its left side)
+NODE *join_left(NODE *left, NODE *mid, NODE *right){
+	if(HEIGHT(right)<=HEIGHT(left)+1){
+		mid->left=left;
+		mid->right=right;
+		refresh(mid);
+		return mid;
+	}
+	right->left=join_left(left,mid,right->left);
+	return restore(right);
+}
+
+// joins two private trees with no node between them (every key in left < every key in right)
+NODE *join_pair(NODE *left, NODE *right){
+	NODE *max;
+	if(left==NULL){return right;}
+	left=cut_max(left,&max);
+	return join_trees(left,max,right);
+}
+
+// splits a private tree around key into the smaller and the bigger keys, returns key's node (NULL if it isn't there)
+// only the path down to key is taken apart, the subtrees hanging off it are joined back onto each side
+NODE *split_tree(NODE *tree, int key, NODE **left, NODE **right){
+	NODE *found, *part;
+	if(tree==NULL){
+		*left=NULL;
+		*right=NULL;
+		return NULL;
+	}
+	if(key<tree->key){
+		found=split_tree(tree->left,key,left,&part);
+		*right=join_trees(part,tree,tree->right);
+	}
+	else if(key>tree->key){
+		found=split_tree(tree->right,key,&part,right);
+		*left=join_trees(tree->left,tree,part);
+	}
+	else{
+		*left=tree->left;
+		*right=tree->right;
+		found=tree;
+	}
+	return found;
+}
+
+// takes the largest node out of a private tree into *max, returns what's left
+NODE *cut_max(NODE *tree, NODE **max){
+	if(tree->right==NULL){
+		*max=tree;
+		return tree->left;
+	}
+	tree->right=cut_max(tree->right,max);
+	return restore(tree);
+}
+
+// rotates a private node whose sides differ by 2 back into balance, returns its subtree's root
+NODE *restore(NODE *node){
+	int balance=HEIGHT(node->left)-HEIGHT(node->right);
+	if(balance>1){
+		if(HEIGHT(node->left->left)<HEIGHT(node->left->right)){node->left=lift(node->left,1);}
+		return lift(node,0);
+	}
+	if(balance<-1){
+		if(HEIGHT(node->right->right)<HEIGHT(node->right->left)){node->right=lift(node->right,0);}
+		return lift(node,1);
+	}
+	refresh(node);
+	return node;
+}
+
+// lifts a private node's child on side (0 left, 1 right) into its place, returns the child
+NODE *lift(NODE *node, int side){
+	NODE *child=(side)?node->right:node->left;
+	if(side){
+		node->right=child->left;
+		child->left=node;
+	}
+	else{
+		node->left=child->right;
+		child->right=node;
+	}
+	refresh(node);
+	refresh(child);
+	return child;
+}
+
+// recomputes a private node's height (and size) from its children
+void refresh(NODE *node){
+	int l=HEIGHT(node->left), r=HEIGHT(node->right);
+	node->height=((l>r)?l:r)+1;
+#ifdef ORDER_STATS
+	node->size=((node->left!=NULL)?SIZE_OF(node->left):0)+((node->right!=NULL)?SIZE_OF(node->right):0)+1;
+#endif
+}
+
+// every key in either tree (both are used up, duplicates freed), returns the root
+// splits b around a's root, does both sides (the left on the pool if it's big) and joins
+// them back under a's root, so the work is O(m log(n/m+1)) for trees of m <= n keys
+NODE *union_trees(NODE *a, NODE *b){
+	SET_TASK lower;
+	NODE *dup, *right;
+	int forked;
+	if(a==NULL){return b;}
+	if(b==NULL){return a;}
+
+	dup=split_tree(b,a->key,&(lower.b),&right);
+	if(dup!=NULL){release_node(dup);}
+	lower.a=a->left;
+	lower.op=union_trees;
+	forked=start_set(&lower);
+	right=union_trees(a->right,right);
+	if(forked){tpool_sync(&(lower.task));}
+	return join_trees(lower.result,a,right);
+}
+
+// the keys in both trees (both are used up, everything else freed), returns the root
+NODE *intersect_trees(NODE *a, NODE *b){
+	SET_TASK lower;
+	NODE *dup, *right;
+	int forked;
+	if(a==NULL || b==NULL){
+		delete_tree(&a);
+		delete_tree(&b);
+		return NULL;
+	}
+
+	dup=split_tree(b,a->key,&(lower.b),&right);
+	lower.a=a->left;
+	lower.op=intersect_trees;
+	forked=start_set(&lower);
+	right=intersect_trees(a->right,right);
+	if(forked){tpool_sync(&(lower.task));}
+
+	// a's root only stays if b had it too
+	if(dup==NULL){
+		release_node(a);
+		return join_pair(lower.result,right);
+	}
+	release_node(dup);
+	return join_trees(lower.result,a,right);
+}
+
+// the keys in a that aren't in b (both are used up, everything else freed), returns the root
+NODE *difference_trees(NODE *a, NODE *b){
+	SET_TASK lower;
+	NODE *dup, *right;
+	int forked;
+	if(a==NULL){
+		delete_tree(&b);
+		return NULL;
+	}
+	if(b==NULL){return a;}
+
+	// splits a around b's root this time, as b's root never stays
+	dup=split_tree(a,b->key,&(lower.a),&right);
+	if(dup!=NULL){release_node(dup);}
+	lower.b=b->left;
+	lower.op=difference_trees;
+	forked=start_set(&lower);
+	right=difference_trees(right,b->right);
+	if(forked){tpool_sync(&(lower.task));}
+	release_node(b);
+	return join_pair(lower.result,right);
+}
+
+// runs a set operation on the pool if both trees are big enough (otherwise inline), returns 1 if it was spawned
+int start_set(SET_TASK *task){
+	if(HEIGHT(task->a)>=SET_CUTOFF && HEIGHT(task->b)>=SET_CUTOFF && tpool_size()>1){
+		tpool_spawn(&(task->task),p_set,task);
+		return 1;
+	}
+	p_set(task);
+	return 0;
+}
+
+// pool function to run a set operation on a pair of subtrees
+void p_set(void *arg){
+	SET_TASK *task=(SET_TASK *)arg;
+	task->result=task->op(task->a,task->b);
+}
+
+// applies a set operation to the tree and other (which is used up)
+// like delete_tree it needs the tree to itself (no other threads may be using it)
+void merge_tree(NODE *(*op)(NODE *a, NODE *b), NODE *other){
+	int i;
+	settle_loaded();
+
+	// a union only adds other's keys, anything else can take out keys of the tree's own
+	if(op==union_trees){
+		filter_tree(other,1);
+		live.root=op(live.root,other);
+		if(hot_cache!=NULL){cache_reset(hot_cache);}
+	}
+	else{
+		live.root=op(live.root,other);
+		refilter();
+	}
+
+	// nodes on either edge path may have moved or gone, and the frozen copy is out of date
+	__atomic_fetch_add(&shape_version,1,__ATOMIC_SEQ_CST);
+	for(i=0;i<2;i++){
+		set_edge(&edges[i],0,NULL,0,0);
+	}
+	invalidate_frozen();
+}
+
+// adds every key in other to the tree (no other threads may be using it)
+void union_tree(NODE *other){
+	merge_tree(union_trees,other);
+}
+
+// keeps only the keys that are also in other (no other threads may be using it)
+void intersect_tree(NODE *other){
+	merge_tree(intersect_trees,other);
+}
+
+// deletes every key in other from the tree (no other threads may be using it)
+void difference_tree(NODE *other){
+	merge_tree(difference_trees,other);
+}
+
+
+
+// finds the smallest value in the tree that is at least from, returns 1 if there is one
+// lock couples down like lookup_value, so it never holds more than two nodes
+int seek_value(int from, int *val){
+	NODE *parent, *child;
+	int found=0;
+	settle_loaded();
+
+	// locks the root lock (to find current root)
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		return 0;
+	}
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+
+	// remembers every value at least from on the way down (each is smaller than the last)
+	while(1){
+		if(parent->key>from){
+			if(VISIBLE(parent)){
+				*val=parent->key;
+				found=1;
 			}
+			child=parent->left;
 		}
-		
-		// checks if left and right are non empty and rebalances from them if not
-		if(ctemp->left!=NULL){
-			pthread_mutex_lock(&(ctemp->left->lock));
-			counter+=rebalance(&(ctemp->left),&ctemp,0);
+		else if(parent->key==from && VISIBLE(parent)){
+			*val=from;
+			found=1;
+			break;
 		}
-		if(ctemp->right!=NULL){
-			pthread_mutex_lock(&(ctemp->right->lock));
-			counter+=rebalance(&(ctemp->right),&ctemp,1);
+		else{child=parent->right;}
+
+		if(child==NULL){break;}
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
+	}
+	pthread_mutex_unlock(&(parent->lock));
+	return found;
+}
+
+// finds the highest node with a value in [lo,hi] and returns it locked (NULL if there isn't one)
+// every key in the range is below it
+NODE *find_range_top(int lo, int hi){
+	NODE *parent, *child;
+	settle_loaded();
+
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		return NULL;
+	}
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+
+	while(parent->key<lo || parent->key>hi){
+		if(parent->key<lo){child=parent->right;}
+		else{child=parent->left;}
+
+		if(child==NULL){
+			pthread_mutex_unlock(&(parent->lock));
+			return NULL;
 		}
-		
-		// unlocks child node once it is passed
-		pthread_mutex_unlock(&(ctemp->lock));
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
+	}
+	return parent;
+}
+
+// collects the keys in [lo,hi] below a locked node in order, with a stack instead of recursion
+// the top stays locked so no new operation can get in, and each node below is locked while
+// it's read so ones already inside finish ahead of the walk (as they lock top down too)
+void collect_range(NODE *top, int lo, int hi, COLLECT_JOB *job){
+	SCAN_FRAME *stack=NULL, frame;
+	long depth=0, cap=0;
+	NODE *node=top, *left;
+
+	while(node!=NULL || depth>0){
+		// reads down the left edge, stacking each node to come back to
+		while(node!=NULL){
+			if(node!=top){pthread_mutex_lock(&(node->lock));}
+			frame.val=node->key;
+			frame.visible=VISIBLE(node);
+			frame.right=(node->key<hi)?node->right:NULL;	// skips subtrees outside the range
+			left=(node->key>lo)?node->left:NULL;
+			if(node!=top){pthread_mutex_unlock(&(node->lock));}
+
+			if(depth==cap){
+				cap=(cap==0)?64:2*cap;
+				stack=realloc(stack,cap*sizeof(SCAN_FRAME));
+			}
+			stack[depth++]=frame;
+			node=left;
+		}
+
+		// then takes the node's value and walks its right subtree
+		frame=stack[--depth];
+		if(frame.visible && frame.val>=lo && frame.val<=hi){
+			if(job->count==job->cap){
+				job->cap=(job->cap==0)?1024:2*job->cap;
+				job->vals=realloc(job->vals,job->cap*sizeof(int));
+			}
+			job->vals[job->count++]=frame.val;
+		}
+		node=frame.right;
+	}
+	free(stack);
+}
+
+// sets up a cursor over [lo,hi]
+// SCAN_COUPLED holds nothing between steps and re-finds its place from the root each time,
+// so it sees changes made as it goes but every key it returns was in the tree when it was reached
+// SCAN_SNAPSHOT copies the range now (blocking updates under it only while it copies) and
+// returns the copy, so long scans see the tree as it was when they were opened
+void cursor_open(CURSOR *cursor, int lo, int hi, int mode){
+	NODE *top;
+	cursor->mode=mode;
+	cursor->next=lo;
+	cursor->hi=hi;
+	cursor->done=(lo>hi);
+	cursor->keys.vals=NULL;
+	cursor->keys.count=cursor->keys.cap=0;
+	cursor->pos=0;
+
+	if(mode==SCAN_SNAPSHOT && !cursor->done){
+		top=find_range_top(lo,hi);
+		if(top!=NULL){
+			collect_range(top,lo,hi,&(cursor->keys));
+			pthread_mutex_unlock(&(top->lock));
+		}
+	}
+}
+
+// moves to the next key in the range, returns 0 once the range is used up
+int cursor_next(CURSOR *cursor, int *val){
+	if(cursor->mode==SCAN_SNAPSHOT){
+		if(cursor->pos==cursor->keys.count){return 0;}
+		*val=cursor->keys.vals[cursor->pos++];
+		return 1;
+	}
+
+	if(cursor->done){return 0;}
+	if(!seek_value(cursor->next,val) || *val>cursor->hi){
+		cursor->done=1;
+		return 0;
+	}
+	// stops at hi rather than stepping past it (hi could be INT_MAX)
+	if(*val==cursor->hi){cursor->done=1;}
+	else{cursor->next=*val+1;}
+	return 1;
+}
+
+// frees anything the cursor holds
+void cursor_close(CURSOR *cursor){
+	free(cursor->keys.vals);
+	cursor->keys.vals=NULL;
+	cursor->done=1;
+}
+
+// calls callback on each key in [lo,hi] in order, returns how many there were
+// no locks are held while callback runs
+long range_scan(int lo, int hi, int mode, void (*callback)(int val, void *arg), void *arg){
+	CURSOR cursor;
+	long count=0;
+	int val;
+
+	cursor_open(&cursor,lo,hi,mode);
+	while(cursor_next(&cursor,&val)){
+		callback(val,arg);
+		count++;
 	}
+	cursor_close(&cursor);
+	return count;
+}
+
+// range_scan callback that counts keys
+void count_key(int val, void *arg){
+	(void)val;
+	(*(long *)arg)++;
+}
+
 
-	return counter;		// return how many rebalances have taken place
+int peek_min(int *val){
+	return peek_edge(EDGE_MIN,val);
+}
+
+int peek_max(int *val){
+	return peek_edge(EDGE_MAX,val);
+}
+
+int pop_min(int *val){
+	return pop_edge(EDGE_MIN,val);
+}
+
+int pop_max(int *val){
+	return pop_edge(EDGE_MAX,val);
+}
+
+// finds the value at one end of the tree, returns 0 if the tree is empty
+int peek_edge(int dir, int *val){
+	settle_loaded();	// the edge paths only cover the tree, not a snapshot that's still mapped
+#ifdef ORDER_STATS
+	// the end node might still be being added, so it asks the sizes instead
+	long k=(dir==EDGE_MIN)?0:tree_size()-1;
+	return k>=0 && select_value(k,val);
+#else
+	EDGE_PATH *e=&edges[dir];
+	int found=0;
+
+	while(1){
+		ebr_enter();
+		pthread_mutex_lock(&(e->lock));
+		if(e->depth>0 && e->version==__atomic_load_n(&shape_version,__ATOMIC_SEQ_CST)){
+			*val=e->end->key;
+			found=1;
+		}
+		pthread_mutex_unlock(&(e->lock));
+		ebr_exit();
+		if(found || !walk_edge(dir)){return found;}
+	}
+#endif
+}
+
+// takes the value at one end of the tree out, returns 0 if the tree is empty
+int pop_edge(int dir, int *val){
+	settle_loaded();
+#ifdef ORDER_STATS
+	// every size on the way down changes, so it's an ordinary delete of whatever is at that end
+	while(peek_edge(dir,val)){
+		if(delete_value(*val)){return 1;}
+	}
+	return 0;
+#else
+	int popped;
+	while((popped=pop_cached(dir,val))<0){}
+	return popped;
+#endif
+}
+
+// pops the end of the cached path, walking it first if it's out of date
+// returns 1 if it popped, 0 if the tree is empty and -1 if another update got there first
+int pop_cached(int dir, int *val){
+	EDGE_PATH *e=&edges[dir];
+	NODE *parent, *node, *child, **tail=NULL;
+	unsigned long version, unlinked;
+	int n=0, cap=0, moved;
+
+	// the nodes on the path are only safe to lock while the version still matches
+	start_update();
+	ebr_enter();
+	pthread_mutex_lock(&(e->lock));
+	version=e->version;
+	if(e->depth==0 || version!=__atomic_load_n(&shape_version,__ATOMIC_SEQ_CST)){
+		pthread_mutex_unlock(&(e->lock));
+		ebr_exit();
+		return walk_edge(dir)?-1:0;
+	}
+	node=e->end;
+	parent=(e->depth>1)?e->path[e->depth-2]:NULL;
+	pthread_mutex_unlock(&(e->lock));
+
+	// only locks the node while it's still parent's child, so it locks top down like everything
+	// else (a rotation could have lifted it above parent, and whatever holds it then might be
+	// on its way down to parent)
+	if(parent==NULL){pthread_mutex_lock(&live.root_lock);}
+	else{pthread_mutex_lock(&(parent->lock));}
+	moved=((parent==NULL)?live.root:OUTER(parent,dir))!=node;
+	if(!moved){pthread_mutex_lock(&(node->lock));}
+
+	// checks nothing's been deleted since and that it's still the end and still parent's child
+	if(moved || version!=__atomic_load_n(&shape_version,__ATOMIC_SEQ_CST) || OUTER(node,dir)!=NULL){
+		if(!moved){pthread_mutex_unlock(&(node->lock));}
+		if(parent==NULL){pthread_mutex_unlock(&live.root_lock);}
+		else{pthread_mutex_unlock(&(parent->lock));}
+
+		// drops the path unless another pop has already moved it on
+		pthread_mutex_lock(&(e->lock));
+		if(e->end==node){set_edge(e,0,NULL,0,0);}
+		pthread_mutex_unlock(&(e->lock));
+		ebr_exit();
+		return -1;
+	}
+
+	// unlinks the node (logged and counted out like any delete), lifting its other subtree into its place
+	*val=node->key;
+	unlinked=unlinking(node);
+	child=INNER(node,dir);
+	if(parent==NULL){live.root=child;}
+	else{OUTER(parent,dir)=child;}
+
+	// the new end is at the far end of that subtree (or is the parent if it's empty)
+	if(child!=NULL){
+		cap=16;
+		tail=malloc(cap*sizeof(NODE *));
+		pthread_mutex_lock(&(child->lock));
+		tail[n++]=child;
+		while(OUTER(tail[n-1],dir)!=NULL){
+			if(n==cap){
+				cap*=2;
+				tail=realloc(tail,cap*sizeof(NODE *));
+			}
+			tail[n]=OUTER(tail[n-1],dir);
+			pthread_mutex_lock(&(tail[n]->lock));
+			pthread_mutex_unlock(&(tail[n-1]->lock));
+			n++;
+		}
+	}
+
+	// updates the path while the new end is still locked so an add below it can't be missed
+	// it's good for the version this pop moved on to, unless something else moved it too
+	pthread_mutex_lock(&(e->lock));
+	if(e->end==node && unlinked==version+1){set_edge(e,e->depth-1,tail,n,unlinked);}
+	else{set_edge(e,0,NULL,0,0);}
+	e->hits++;
+	pthread_mutex_unlock(&(e->lock));
+
+	if(n>0){pthread_mutex_unlock(&(tail[n-1]->lock));}
+	pthread_mutex_unlock(&(node->lock));
+	if(parent==NULL){pthread_mutex_unlock(&live.root_lock);}
+	else{pthread_mutex_unlock(&(parent->lock));}
+
+	// the other path only shares the root, but a stale one could still hold the node
+	drop_from_edge(!dir,node);
+	retire_node(node);
+	ebr_exit();
+	free(tail);
+	invalidate_frozen();
+	return 1;
+}
+
+// walks the path down to one end of the tree again, returns 0 if the tree is empty
+int walk_edge(int dir){
+	EDGE_PATH *e=&edges[dir];
+	NODE *parent, *child, **path;
+	int n=0, cap=64;
+	// read before the walk so any delete during it leaves the path out of date
+	unsigned long version=__atomic_load_n(&shape_version,__ATOMIC_SEQ_CST);
+
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root==NULL){
+		pthread_mutex_unlock(&live.root_lock);
+		pthread_mutex_lock(&(e->lock));
+		set_edge(e,0,NULL,0,version);
+		pthread_mutex_unlock(&(e->lock));
+		return 0;
+	}
+	path=malloc(cap*sizeof(NODE *));
+	parent=live.root;
+	pthread_mutex_lock(&(parent->lock));
+	pthread_mutex_unlock(&live.root_lock);
+	path[n++]=parent;
+
+	// lock couples down the outside of the tree
+	while((child=OUTER(parent,dir))!=NULL){
+		pthread_mutex_lock(&(child->lock));
+		pthread_mutex_unlock(&(parent->lock));
+		parent=child;
+		if(n==cap){
+			cap*=2;
+			path=realloc(path,cap*sizeof(NODE *));
+		}
+		path[n++]=parent;
+	}
+
+	// stores it while the end is still locked so an add below it can't be missed
+	pthread_mutex_lock(&(e->lock));
+	set_edge(e,0,path,n,version);
+	e->walks++;
+	pthread_mutex_unlock(&(e->lock));
+	pthread_mutex_unlock(&(parent->lock));
+	free(path);
+	return 1;
+}
+
+// keeps the first keep nodes of a path and adds n more from tail (the path must be locked)
+void set_edge(EDGE_PATH *e, int keep, NODE **tail, int n, unsigned long version){
+	if(keep+n>e->cap){
+		e->cap=2*(keep+n);
+		e->path=realloc(e->path,e->cap*sizeof(NODE *));
+	}
+	if(n>0){memcpy(e->path+keep,tail,n*sizeof(NODE *));}
+	e->depth=keep+n;
+	e->version=version;
+	__atomic_store_n(&(e->end),(e->depth>0)?e->path[e->depth-1]:NULL,__ATOMIC_RELEASE);
+}
+
+// drops a path if it goes through a node that's about to be retired
+void drop_from_edge(int dir, NODE *node){
+	EDGE_PATH *e=&edges[dir];
+	int i;
+	pthread_mutex_lock(&(e->lock));
+	for(i=0;i<e->depth;i++){
+		if(e->path[i]==node){
+			set_edge(e,0,NULL,0,0);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(e->lock));
+}
+
+// adds a node just linked below the end of a path (parent must still be locked)
+void extend_edge(int dir, NODE *parent, NODE *node){
+	EDGE_PATH *e=&edges[dir];
+	if(__atomic_load_n(&(e->end),__ATOMIC_ACQUIRE)!=parent){return;}
+	pthread_mutex_lock(&(e->lock));
+	if(e->end==parent){set_edge(e,e->depth,&node,1,e->version);}
+	pthread_mutex_unlock(&(e->lock));
+}
+
+
+// rebalances the locked node at *link and then both its subtrees, returns how many rotations it did
+// whatever owns link (its parent or the root lock) stays locked, and the node is unlocked at the end
+int rebalance(NODE **link){
+	int l, counter=coupled_balance_at(link,&l);	// rotates it until no side is 2 higher
+
+	// rebalances from both sides (in parallel if they're big enough)
+	counter+=rebalance_children(link,l);
+	pthread_mutex_unlock(&((*link)->lock));
+	return counter;
+}
+
+#ifdef ORDER_STATS
+// moves the sizes with a rotation: child takes node's place (and size) and node takes child's inner subtree
+// node and child are locked
+void move_sizes(NODE *node, NODE *child, NODE *inner){
+	long node_size=SIZE_OF(node), child_size=SIZE_OF(child);
+	long inner_size=subtree_size(inner);	// locks it in case an update is still inside
+
+	child->size=node_size;
+	node->size=node_size-child_size+inner_size;
+}
+#endif
+
+// rebalances both subtrees of a locked node
+// once a node is balanced its subtrees are disjoint, so a big left one is
+// forked onto the pool while this thread does the right one
+int rebalance_children(NODE **tree, int left_height){
+	NODE *node=*tree;
+	REBAL_TASK left;
+	int counter=0, forked=0;
+
+	// checks if left and right are non empty and rebalances from them if not
+	if(node->left!=NULL){
+		if(left_height>=REBAL_CUTOFF){
+			left.parent=node;
+			tpool_spawn(&left.task,p_rebalance,&left);
+			forked=1;
+		}
+		else{
+			pthread_mutex_lock(&(node->left->lock));
+			counter+=rebalance(&(node->left));
+		}
+	}
+	if(node->right!=NULL){
+		pthread_mutex_lock(&(node->right->lock));
+		counter+=rebalance(&(node->right));
+	}
+
+	// waits for the left side (node stays locked so nobody else can get below it)
+	if(forked){
+		tpool_sync(&left.task);
+		counter+=left.counter;
+	}
+	return counter;
+}
+
+// pool function to rebalance a left subtree
+void p_rebalance(void *arg){
+	REBAL_TASK *task=(REBAL_TASK *)arg;
+	pthread_mutex_lock(&(task->parent->left->lock));
+	task->counter=rebalance(&(task->parent->left));
 }
 
 // calls the rebalance function until no rebalances necessary
 void rebalance_tree(){
 	int n=1;
+	// a loaded snapshot is built balanced, so there's nothing to do until it is built
+	if(__atomic_load_n(&loaded,__ATOMIC_ACQUIRE)){return;}
 	// loops through with the root arguments until zero rebalances were necessary
 	while(n>0){
-		pthread_mutex_lock(&root_lock);
-		if(tree_root!=NULL){
-			pthread_mutex_lock(&(tree_root->lock));
-			n=rebalance(&tree_root,&tree_root,0);
-		}
-		else{
-			pthread_mutex_unlock(&root_lock);
-			n=0;
+		n=0;
+		pthread_mutex_lock(&live.root_lock);
+		if(live.root!=NULL){
+			pthread_mutex_lock(&(live.root->lock));
+			n=rebalance(&live.root);
+			live.rotations+=n;
 		}
+		pthread_mutex_unlock(&live.root_lock);
 	}
 }
 
 // deletes a tree and all its allocated memory is freed
+// works iteratively so a degenerate tree can't overflow the stack, and splits
+// the work with the pool (no other threads may be using the tree)
 void delete_tree(NODE **tree){
+	TEARDOWN_TASK all;
 	// if the input isn't NULL
 	if((*tree)!=NULL){
-		delete_tree(&((*tree)->left));	// free from the left
-		delete_tree(&((*tree)->right));	// and right
-		free(*tree);			// then free the node
+		all.cap=64;
+		all.stack=malloc(all.cap*sizeof(NODE *));
+		all.stack[0]=*tree;
+		all.top=1;
+		all.cut=0;
+		p_teardown(&all);	// frees it on this thread, sharing it out as it goes
+		free(all.stack);
+		*tree=NULL;
+	}
+}
+
+// pool function to free subtrees with an explicit stack
+// every TEARDOWN_BATCH nodes the bottom half of the stack (the subtrees
+// nearest the top of the tree, so the biggest) is handed to the pool
+void p_teardown(void *arg){
+	TEARDOWN_TASK *task=(TEARDOWN_TASK *)arg, *spawned=NULL, *child, *next;
+	NODE *node;
+	long freed=0, half;
+
+	while(task->top>0){
+		node=task->stack[--task->top];
+		if(task->cut && key_filter!=NULL){filter_forget(key_filter,node->key);}	// a cut out key leaves a Bloom filter here
+
+		// makes room for both children then frees the node
+		if(task->top+2>task->cap){
+			task->cap=2*task->cap+2;
+			task->stack=realloc(task->stack,task->cap*sizeof(NODE *));
+		}
+		if(node->right!=NULL){task->stack[task->top++]=node->right;}
+		if(node->left!=NULL){task->stack[task->top++]=node->left;}
+		// cut out nodes might still be on a stale edge path
+		if(task->cut){retire_node(node);}
+		else{release_node(node);}
+
+		// hands off half the subtrees if there's another thread to take them
+		if(++freed%TEARDOWN_BATCH==0 && task->top>1 && tpool_size()>1){
+			half=task->top/2;
+			child=malloc(sizeof(TEARDOWN_TASK));
+			child->cap=half+64;
+			child->stack=malloc(child->cap*sizeof(NODE *));
+			memcpy(child->stack,task->stack,half*sizeof(NODE *));
+			child->top=half;
+			child->cut=task->cut;
+			memmove(task->stack,task->stack+half,(task->top-half)*sizeof(NODE *));
+			task->top-=half;
+
+			child->next=spawned;
+			spawned=child;
+			tpool_spawn(&(child->task),p_teardown,child);
+		}
+	}
+
+	// waits for everything handed off
+	while(spawned!=NULL){
+		tpool_sync(&(spawned->task));
+		freed+=spawned->freed;
+		next=spawned->next;
+		free(spawned->stack);
+		free(spawned);
+		spawned=next;
+	}
+	task->freed=freed;
+}
+
+// counts the nodes in a tree without locks
+long count_tree(NODE *tree){
+	if(tree==NULL){return 0;}
+	return count_tree(tree->left)+count_tree(tree->right)+1;
+}
+
+// frees a node wherever it came from (malloc or an arena)
+void release_node(void *node){
+	short chunk=((NODE *)node)->chunk;
+	if(chunk!=0){arena_free(chunk);}
+	else{free(node);}
+}
+
+// releases an unlinked node once no thread can reach it
+void retire_node(NODE *node){
+	ebr_retire_with(node,release_node);
+}
+
+// moves every node into a fresh arena in preorder (each node just before its left subtree)
+// so a walk down the tree goes forwards through memory, returns how many moved
+// it locks like the balancer, so the updates carry on below it, and the old nodes
+// are retired as it goes and then handed back with the free heap pages returned to the OS
+// with more than one NUMA node the top levels, which every walk goes through, are
+// interleaved over all of them and the subtrees below are dealt out a node each
+long compact_tree(){
+	COMPACTION c;
+	int ids[PLACE_MAX_NODES];
+	long moved=0;
+	int i;
+	// a loaded snapshot has no nodes until it's built
+	if(__atomic_load_n(&loaded,__ATOMIC_ACQUIRE)){return 0;}
+
+	c.nodes=place_memory_nodes(ids);
+	c.next=0;
+	c.arenas=malloc((c.nodes+1)*sizeof(ARENA));
+	for(i=0;i<=c.nodes;i++){arena_open(&(c.arenas[i]),sizeof(NODE));}
+	if(c.nodes>1){
+		for(i=0;i<c.nodes;i++){arena_place(&(c.arenas[i]),ids[i]);}
+		arena_place(&(c.arenas[c.nodes]),ARENA_INTERLEAVE);
+	}
+	pthread_mutex_lock(&live.root_lock);
+	if(live.root!=NULL){
+		pthread_mutex_lock(&(live.root->lock));
+		moved=compact(&live.root,&(c.arenas[(c.nodes>1)?c.nodes:0]),0,&c);
+	}
+	pthread_mutex_unlock(&live.root_lock);
+	for(i=0;i<=c.nodes;i++){arena_close(&(c.arenas[i]));}
+	free(c.arenas);
+
+	for(i=0;i<COMPACT_TRIES && ebr_collect()>0;i++){sched_yield();}
+	malloc_trim(0);
+	return moved;
+}
+
+// moves the locked node at *link (whatever owns link is locked too) into the arena, then its
+// left and right subtrees, holding it while it does them like rebalance, returns how many moved
+long compact(NODE **link, ARENA *arena, int depth, COMPACTION *c){
+	NODE *node=*link, *copy;
+	short chunk;
+	long moved=1;
+
+	// below the interleaved top levels each subtree goes on the next NUMA node round
+	if(c->nodes>1 && depth==COMPACT_TOP_LEVELS){arena=&(c->arenas[c->next++%c->nodes]);}
+
+	// leaves the rest where it is if the arena has run out of chunks
+	copy=arena_alloc(arena,&chunk);
+	if(copy==NULL){
+		pthread_mutex_unlock(&(node->lock));
+		return 0;
+	}
+	*copy=*node;
+	copy->chunk=chunk;
+	pthread_mutex_init(&(copy->lock),NULL);
+	pthread_mutex_lock(&(copy->lock));
+
+	// a stale edge path might still hold the old node, so moves the count on before it's swapped out
+	__atomic_fetch_add(&shape_version,1,__ATOMIC_SEQ_CST);
+	*link=copy;
+	pthread_mutex_unlock(&(node->lock));
+	retire_node(node);
+
+	if(copy->left!=NULL){
+		pthread_mutex_lock(&(copy->left->lock));
+		moved+=compact(&(copy->left),arena,depth+1,c);
+	}
+	if(copy->right!=NULL){
+		pthread_mutex_lock(&(copy->right->lock));
+		moved+=compact(&(copy->right),arena,depth+1,c);
+	}
+	pthread_mutex_unlock(&(copy->lock));
+	return moved;
+}
+
+// ENGINE wrappers for the lock coupled tree
+void avl_init(){
+	coupled_init(&live);
+	for(int i=0;i<2;i++){
+		set_edge(&edges[i],0,NULL,0,0);
+		edges[i].hits=edges[i].walks=0;
+	}
+	reclaim_stop=0;
+	reclaimed=0;
+	pthread_create(&reclaimer,NULL,p_reclaim,NULL);
+	if(filtering){key_filter=filter_create(max);}
+	if(cache_slots>0){hot_cache=cache_create(cache_slots);}
+}
+
+void avl_print(){
+	settle_loaded();
+	coupled_print(&live,gap,empty);
+}
+
+long avl_count(){
+	if(__atomic_load_n(&loaded,__ATOMIC_ACQUIRE)){return mapped->n;}
+#ifdef ORDER_STATS
+	return tree_size();
+#else
+	return count_tree(live.root);
+#endif
+}
+
+long avl_bytes(){
+	return avl_count()*sizeof(NODE);
+}
+
+long avl_rotations(){
+	return live.rotations;
+}
+
+int avl_height(){
+	settle_loaded();
+	return coupled_height(live.root);
+}
+
+void avl_destroy(){
+	// lets the reclaim thread finish what's queued
+	pthread_mutex_lock(&reclaim_lock);
+	reclaim_stop=1;
+	pthread_cond_signal(&reclaim_cond);
+	pthread_mutex_unlock(&reclaim_lock);
+	pthread_join(reclaimer,NULL);
+
+	delete_tree(&live.root);
+	for(int i=0;i<2;i++){
+		free(edges[i].path);
+		edges[i].path=NULL;
+		edges[i].cap=0;
+		set_edge(&edges[i],0,NULL,0,0);
 	}
+	free(frozen);
+	frozen=NULL;
+	frozen_valid=0;
+	if(mapped!=NULL){snap_close(mapped);}
+	mapped=NULL;
+	loaded=0;
+	ebr_flush();
+	if(key_filter!=NULL){filter_destroy(key_filter);}
+	key_filter=NULL;
+	if(hot_cache!=NULL){cache_destroy(hot_cache);}
+	hot_cache=NULL;
 }
 
+ENGINE avl_engine={"lock coupled AVL",avl_init,add_value,delete_value,lookup_value,rebalance_tree,avl_print,avl_count,avl_bytes,avl_rotations,avl_destroy,avl_height};
+
  // pthreads function to add a specified number of values in poisson intervals
 void *p_add(void *arg){
 	int *no_adds = (int *)arg;
-	int i;
+	int i, val;
 	// loops a specified number of times
 	for(i=0;i<(*no_adds);i++){
-		usleep(50*poisson_gen(2));
-		add_value(-1);
-		add_attempts++;
+		if(!flat_out){usleep(50*poisson_gen(2));}
+		val=rand()%max;
+		if(capturing){trace_record(TRACE_ADD,val,0);}
+		// prints out info unless quiet and updates add counter (once it's durable if logging)
+		if(engine->add(val)){
+			if(logging){wal_sync();}
+			if(quiet==0){printf("Added %0*d\n",gap,val);}
+			__sync_fetch_and_add(&add_counter,1);
+		}
+		__sync_fetch_and_add(&add_attempts,1);
 	}
-	p_finish++;	// updates p_finish to tell other threads to finish
+	__sync_fetch_and_add(&p_finish,1);	// updates p_finish to tell other threads to finish
 	return NULL;
 }
 // pthreads function to delete values in poisson intervals
 void *p_del(){
-	// loops until p_add is finished
-	while(p_finish==0){
-		usleep(50*poisson_gen(2));
-		delete_value(-1);
-		del_attempts++;
+	int val;
+	// loops until every p_add is finished
+	while(__atomic_load_n(&p_finish,__ATOMIC_ACQUIRE)<num_pairs){
+		if(!flat_out){usleep(50*poisson_gen(2));}
+		val=rand()%max;
+		if(capturing){trace_record((range_width>0)?TRACE_RANGE:TRACE_DEL,val,range_width);}
+		// cuts out a whole range instead if asked
+		if(range_width>0){
+			if(delete_range(val,val+range_width-1)){
+				if(logging){wal_sync();}
+				if(quiet==0){printf("Deleted %0*d to %0*d\n",gap,val,gap,val+range_width-1);}
+				__sync_fetch_and_add(&del_counter,1);
+			}
+		}
+		// If a node was deleted then update counter and print info if requested
+		else if(engine->del(val)){
+			if(logging){wal_sync();}
+			if(quiet==0){printf("Deleted %0*d\n",gap,val);}
+			__sync_fetch_and_add(&del_counter,1);
+		}
+		__sync_fetch_and_add(&del_attempts,1);
 	}
 	return NULL;
 }
 
 // pthreads function to rebalance the tree periodically
 void *p_bal(){
-	// loops until p_add is finished
-	while(p_finish==0){
+	// nothing to do for engines that keep themselves in shape
+	if(engine->balance==NULL){return NULL;}
+
+	// loops until every p_add is finished
+	while(__atomic_load_n(&p_finish,__ATOMIC_ACQUIRE)<num_pairs){
 		usleep(100*poisson_gen(20));
-		rebalance_tree();
+		engine->balance();
 		if(quiet==0){printf("\t\tBalanced\n");}
 		bal_counter++;
 	}
-	rebalance_tree();
+	engine->balance();
 	return NULL;
 }
 
-// function to generate poisson random variables 
-int poisson_gen(double lambda){
-	int k=0;
-	double p=exp(-lambda);		//initialises p
-	double F=p;			// sets F to p
-	double rnum=drand48();		// generates a random number
+// pthreads function to scan the whole tree in each mode in turn until the updates finish
+void *p_scan(){
+	struct timespec start, finish;
+	long keys;
+	int mode=SCAN_COUPLED;
+
+	while(__atomic_load_n(&p_finish,__ATOMIC_ACQUIRE)<num_pairs){
+		keys=0;
+		clock_gettime(CLOCK_MONOTONIC,&start);
+		if(engine==&cow_engine){
+			// every snapshot of the copy-on-write tree is consistent and lock free
+			mode=SCAN_SNAPSHOT;
+			cow_scan(cow_snapshot(),0,max-1,count_key,&keys);
+			cow_release();
+		}
+		else if(engine==&sl_engine){
+			// the skip list's bottom level is already in order, so it walks that with no locks
+			mode=SCAN_COUPLED;
+			sl_scan(0,max-1,count_key,&keys);
+		}
+		else{range_scan(0,max-1,mode,count_key,&keys);}
+		clock_gettime(CLOCK_MONOTONIC,&finish);
 
-	// loops until it finds the right value of k
-	while(rnum>F){			
-		p*=lambda/(k+1);	// calculates p
-		F+=p;			// bumps up F
-		k++;			// increments k counter
+		scan_time[mode]+=(finish.tv_sec-start.tv_sec)+(finish.tv_nsec-start.tv_nsec)/1e9;
+		scan_keys[mode]+=keys;
+		scans[mode]++;
+		mode=(mode==SCAN_COUPLED)?SCAN_SNAPSHOT:SCAN_COUPLED;
 	}
-	return k;
+	return NULL;
 }
 
-// finds height without locks
-int find_height_print(NODE *tree){
-	if(tree==NULL){return 0;}		// if the input is NULL return 0
-	int left, right;
+// pthreads function to push random keys and pop the smallest, on the tree or a heap
+void *p_queue(void *arg){
+	QUEUE_JOB *job=(QUEUE_JOB *)arg;
+	int i, val;
+	for(i=0;i<job->ops;i++){
+		val=rand_r(&(job->seed));	// over the whole int range so adds are rarely duplicates
+		if(job->heap!=NULL){
+			heap_push(job->heap,val);
+			job->popped+=heap_pop(job->heap,&val);
+		}
+		else{
+			add_value(val);
+			job->popped+=pop_min(&val);
+		}
+	}
+	return NULL;
+}
 
-	left=find_height_print(tree->left);	// check left node's height
-	right=find_height_print(tree->right);	// and rights
+// times threads using the tree (heap NULL) or a heap as a priority queue, returns the seconds taken
+double time_queue(int num_threads, int ops, HEAP *heap, long *popped){
+	pthread_t *handles=malloc(num_threads*sizeof(pthread_t));
+	QUEUE_JOB *jobs=malloc(num_threads*sizeof(QUEUE_JOB));
+	struct timespec start, finish;
+	int i;
 
-	if(left>right){return left+1;}		// if left is bigger return left's height plus one for the current node
-	return right+1;				// else return right's height plus one
+	clock_gettime(CLOCK_MONOTONIC,&start);
+	for(i=0;i<num_threads;i++){
+		jobs[i].ops=ops;
+		jobs[i].heap=heap;
+		jobs[i].seed=rand();
+		jobs[i].popped=0;
+		pthread_create(&handles[i],NULL,p_queue,&jobs[i]);
+		place_pin(handles[i],i);
+	}
+	*popped=0;
+	for(i=0;i<num_threads;i++){
+		pthread_join(handles[i],NULL);
+		*popped+=jobs[i].popped;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&finish);
+	free(handles);
+	free(jobs);
+	return (finish.tv_sec-start.tv_sec)+(finish.tv_nsec-start.tv_nsec)/1e9;
 }
-	
-// function to print "a" number of gaps
-void print_gap(int a){
-	int i;
-	for(i=0;i<a*gap;i++){printf(" ");}
+
+// range_scan callback that pushes keys onto a heap
+void push_key(int val, void *arg){
+	heap_push((HEAP *)arg,val);
 }
 
-// prints a line in the tree with specified gaps
-void print_line(NODE *tree, int start, int inc, int num){
-	int j,k;
-	NODE *temp;
-	print_gap(start);	// prints start number of gaps
+// times the shared bench workload on num_pairs threads and prints it as CSV
+// the tree is filled first, then the threads take every num_pairs-th op each while
+// p_bench_bal rebalances (if the engine needs it) as often as serial.out does.
+// With a rate it runs open loop: each thread's ops are given start times up front,
+// rate/num_pairs a second apart (poisson_gen spaced unless fixed), a thread only
+// waits when it's ahead of them, and latency runs from the time an op was due, so
+// anything that holds the threads up (like the balancer on the root lock) is counted
+// against every op queued behind it instead of just delaying when they're sent.
+// With a log (engine 0) the fill isn't logged but every op after it is, and an op's
+// time runs until it's durable, so the latencies are commit latencies
+void run_bench(int no_ops, int seed, double rate, int fixed){
+	BENCH_OP *ops=bench_ops(seed,no_ops,max);
+	BENCH_RESULT result={"pthreads",engine->name,num_pairs,max,no_ops,seed,0,NULL,0,0,0,place_name(),place_spread(num_pairs)};
+	pthread_t *handles=malloc(num_pairs*sizeof(pthread_t)), balancer;
+	BENCH_JOB *jobs=malloc(num_pairs*sizeof(BENCH_JOB));
+	long i, n, begin, *due=NULL;
+	int *fill=bench_fill(seed,max,&n);
+
+	// each thread's arrivals are a stream of their own, the mean gap num_pairs/rate apart
+	if(rate>0){
+		double gap=1e9*num_pairs/rate;
+		result.driver="open";
+		due=malloc(no_ops*sizeof(long));
+		srand48(seed);
+		for(i=0;i<no_ops;i++){
+			if(i<num_pairs){due[i]=0;}
+			else if(fixed){due[i]=due[i-num_pairs]+gap;}
+			else{due[i]=due[i-num_pairs]+gap*poisson_gen(OPEN_LAMBDA)/OPEN_LAMBDA;}
+		}
+	}
 
-	int val;
+	engine->init();
+	for(i=0;i<n;i++){engine->add(fill[i]);}
+	if(engine->balance!=NULL){engine->balance();}
+	free(fill);
+
+	// starts a fresh log rather than replaying an old one over the fill
+	if(log_path!=NULL){
+		unlink(log_path);
+		if(wal_open(log_path,commit_interval,commit_batch,replay_logged)<0){
+			fprintf(stderr,"Can't open log %s\n",log_path);
+			exit(EXIT_FAILURE);
+		}
+		logging=1;
+		result.driver=(rate>0)?"open-wal":"wal";
+	}
 
-	// loops through how many values are on the line
-	for(j=0;j<num;j++){
-		val=1;		// resets val
-		temp=tree;	// sets temp to start of tree
-		
-		// it takes num/2 steps through the tree to get to the level with num values (won't enter loop if root)
-		for(k=num/2;k>=1;k/=2){
-			// uses j as binary representation of directions it travels (0 for left, 1 for right)
-			// if direction is left
-			if((k&j)==0){
-				if(temp->left==NULL){val=0;k=0;}	// sets val to 0 if left is an empty NODE and breaks by setting k=0
-				else{temp=temp->left;}			// else moves along
-			}
-			// else direction is right
-			else{
-				if(temp->right==NULL){val=0;k=0;}	// SIMILAR to LEFT
-				else{temp=temp->right;}
-			}
+	result.latency=malloc(no_ops*sizeof(long));
+	bench_done=0;
+	begin=bench_now();
+	for(i=0;i<num_pairs;i++){
+		jobs[i].ops=ops;
+		jobs[i].n=no_ops;
+		jobs[i].first=i;
+		jobs[i].step=num_pairs;
+		jobs[i].latency=result.latency;
+		jobs[i].due=due;
+		jobs[i].begin=begin;
+		pthread_create(&handles[i],NULL,p_bench,&jobs[i]);
+		place_pin(handles[i],i);
+	}
+	if(engine->balance!=NULL){
+		pthread_create(&balancer,NULL,p_bench_bal,&no_ops);
+		place_pin(balancer,num_pairs);
+	}
+	for(i=0;i<num_pairs;i++){
+		pthread_join(handles[i],NULL);
+	}
+	if(engine->balance!=NULL){pthread_join(balancer,NULL);}
+	result.seconds=(bench_now()-begin)/1e9;
+	if(logging){
+		logging=0;
+		wal_close();
+	}
+
+	result.keys=engine->count();
+	result.height=(engine->height!=NULL)?engine->height():-1;
+	result.bytes=engine->bytes();
+	bench_csv(stdout,&result);
+
+	engine->destroy();
+	free(result.latency);
+	free(due);
+	free(jobs);
+	free(handles);
+	free(ops);
+}
+
+// pthreads function to run and time one thread's share of the bench ops
+void *p_bench(void *arg){
+	BENCH_JOB *job=(BENCH_JOB *)arg;
+	long i, start;
+	for(i=job->first;i<job->n;i+=job->step){
+		// open loop ops count from when they were due, however late they start
+		if(job->due!=NULL){
+			start=job->begin+job->due[i];
+			wait_until(start);
 		}
-		if(val==1){printf("%0*d",gap,temp->val);}			// if val is still 1 then it prints the value
-		else{printf("%s",empty);}					// else prints ~~
-		print_gap(inc);						// prints the incremental gap
+		else{start=bench_now();}
+		if(job->ops[i].type==BENCH_ADD){engine->add(job->ops[i].key);}
+		else{engine->del(job->ops[i].key);}
+		if(logging){wal_sync();}
+		job->latency[i]=bench_now()-start;
+		__sync_fetch_and_add(&bench_done,1);
 	}
-	printf("\n\n");							// and two line breaks for readability
+	return NULL;
 }
-			
-// prints out the tree (if under a certain height)
-void print_tree(NODE *tree){
-	if( tree == NULL){
-		printf("Tree is empty, can't print\n");
-		return;
+
+// pthreads function to rebalance every BENCH_BALANCE_EVERY bench ops, and once at the end
+void *p_bench_bal(void *arg){
+	long no_ops=*(int *)arg, next=BENCH_BALANCE_EVERY, done;
+	while((done=__atomic_load_n(&bench_done,__ATOMIC_ACQUIRE))<no_ops){
+		if(done>=next){
+			engine->balance();
+			next=done-done%BENCH_BALANCE_EVERY+BENCH_BALANCE_EVERY;
+		}
+		else{usleep(50);}
 	}
+	engine->balance();
+	return NULL;
+}
 
-	int height=find_height_print(tree);	// finds height of tree
-	// only prints if 6 or lower height
-	if(height>6){
-		printf("Tree too large to print\n");
-		return;
+// times lookups, adds and deletes in a tree of no_keys keys and prints it as CSV
+// the tree holds the even keys below 2*no_keys, put in medians first so it starts
+// balanced (a rebalance then has nothing to move). Lookups are of random keys in it, adds of random odd
+// keys, and the deletes take those out again so the size stays put. One thread,
+// with the memory counted from the process's resident size as well as the engine's
+void run_size(long no_keys, int no_ops, int seed){
+	int *keys=malloc(no_ops*sizeof(int)), i, found=0;
+	unsigned int state=seed;
+	long rss, begin, filled, looked, added, deleted;
+	double fill_time;
+
+	rss=bench_rss();
+	engine->init();
+	begin=bench_now();
+	bench_fill_balanced(0,no_keys-1,engine->add);
+	if(engine->balance!=NULL){engine->balance();}		// for engines that move the keys around (like the AVL map)
+	fill_time=(bench_now()-begin)/1e9;
+	rss=bench_rss()-rss;
+	filled=engine->count();
+
+	for(i=0;i<no_ops;i++){keys[i]=2*(rand_r(&state)%no_keys);}
+	begin=bench_now();
+	for(i=0;i<no_ops;i++){found+=engine->lookup(keys[i]);}
+	looked=bench_now()-begin;
+
+	for(i=0;i<no_ops;i++){keys[i]=2*(rand_r(&state)%no_keys)+1;}
+	begin=bench_now();
+	for(i=0;i<no_ops;i++){engine->add(keys[i]);}
+	added=bench_now()-begin;
+	begin=bench_now();
+	for(i=0;i<no_ops;i++){engine->del(keys[i]);}
+	deleted=bench_now()-begin;
+
+	if(found!=no_ops){fprintf(stderr,"%s: found %d of %d keys\n",engine->name,found,no_ops);}
+	printf("engine,keys,ops,seed,fill_s,lookup_ns,add_ns,delete_ns,height,bytes_per_key,rss_bytes_per_key,rss_mb\n");
+	printf("\"%s\",%ld,%d,%d,%.3f,%.1f,%.1f,%.1f,",engine->name,filled,no_ops,seed,fill_time,(double)looked/no_ops,(double)added/no_ops,(double)deleted/no_ops);
+	if(engine->height!=NULL){printf("%d",engine->height());}
+	printf(",%.1f,%.1f,%.1f\n",(double)engine->bytes()/filled,(double)rss/filled,rss/1048576.0);
+
+	engine->destroy();
+	free(keys);
+}
+
+
+// times union_tree, intersect_tree and difference_tree against the same change made with
+// add_value/delete_value loops, and prints it as CSV
+// the tree gets each key below 2*no_keys with chance 1/2 and the other tree each with
+// chance other_keys/(2*no_keys), so they overlap as much as random sets of those sizes
+void run_sets(long no_keys, long other_keys, int seed){
+	long span=2*no_keys, n=0, m=0, only=0, k, i, j;
+	long begin, times[6], counts[3], expect[3];
+	int *a=malloc(span*sizeof(int)), *b=malloc(span*sizeof(int)), *a_only=malloc(span*sizeof(int));
+	unsigned int state=seed;
+	double chance=(double)other_keys/span;
+
+	for(k=0;k<span;k++){
+		if(rand_r(&state)%2){a[n++]=k;}
+		if(rand_r(&state)/(RAND_MAX+1.0)<chance){b[m++]=k;}
 	}
-	int i;
-	// loops through the layers (setting values to print_line accordingly)
-	for(i=height;i>0;i--){
-		print_line(tree,pow(2,i-1),pow(2,i)-1,pow(2,height-i));
-	}		
-		return;
-	
+	// keys the intersection loop has to delete
+	for(i=0,j=0;i<n;i++){
+		while(j<m && b[j]<a[i]){j++;}
+		if(j==m || b[j]!=a[i]){a_only[only++]=a[i];}
+	}
+	expect[0]=n+m-(n-only);
+	expect[1]=n-only;
+	expect[2]=only;
+
+	engine->init();
+	for(k=0;k<3;k++){
+		// the tree and the other tree are built balanced before the clock starts
+		live.root=build_balanced(a,n);
+		refilter();
+		NODE *other=build_balanced(b,m);
+		begin=bench_now();
+		if(k==0){union_tree(other);}
+		else if(k==1){intersect_tree(other);}
+		else{difference_tree(other);}
+		times[2*k]=bench_now()-begin;
+		counts[k]=count_tree(live.root);
+		delete_tree(&live.root);
+
+		// and then key by key
+		live.root=build_balanced(a,n);
+		refilter();
+		begin=bench_now();
+		if(k==0){for(i=0;i<m;i++){add_value(b[i]);}}
+		else if(k==1){for(i=0;i<only;i++){delete_value(a_only[i]);}}
+		else{for(i=0;i<m;i++){delete_value(b[i]);}}
+		times[2*k+1]=bench_now()-begin;
+		if(count_tree(live.root)!=counts[k] || counts[k]!=expect[k]){
+			fprintf(stderr,"set operation %ld: %ld keys joined, %ld looped, %ld expected\n",k,counts[k],count_tree(live.root),expect[k]);
+		}
+		delete_tree(&live.root);
+	}
+
+	printf("threads,keys,other_keys,seed,union_s,union_loop_s,intersect_s,intersect_loop_s,difference_s,difference_loop_s,union_keys,intersect_keys,difference_keys\n");
+	printf("%d,%ld,%ld,%d",tpool_size(),n,m,seed);
+	for(k=0;k<6;k++){printf(",%.4f",times[k]/1e9);}
+	printf(",%ld,%ld,%ld\n",counts[0],counts[1],counts[2]);
+
+	engine->destroy();
+	free(a);
+	free(b);
+	free(a_only);
+}
+
+// replays a trace file on num_pairs threads and prints it as CSV
+// thread t takes every num_pairs-th op, flat out or (paced) each at its time in
+// the trace, while p_bench_bal rebalances as in run_bench. The tree starts empty
+// like the run that was captured. Ranges are cut in one go on engine 0 and key
+// by key on the others
+void run_replay(char *path, int paced){
+	long i, n, begin;
+	TRACE_OP *ops=trace_read(path,&n);
+	if(ops==NULL){
+		fprintf(stderr,"Can't read trace %s\n",path);
+		exit(EXIT_FAILURE);
+	}
+	int no_ops=n;
+	BENCH_RESULT result={"replay",engine->name,num_pairs,0,n,0,0,NULL,0,0,0,place_name(),place_spread(num_pairs)};
+	pthread_t *handles=malloc(num_pairs*sizeof(pthread_t)), balancer;
+	REPLAY_JOB *jobs=malloc(num_pairs*sizeof(REPLAY_JOB));
+
+	// keys are in [0,max) as far as the row goes
+	for(i=0;i<n;i++){
+		if(ops[i].key+ops[i].width>=result.max){result.max=ops[i].key+ops[i].width+1;}
+	}
+
+	engine->init();
+	result.latency=malloc((n+1)*sizeof(long));
+	bench_done=0;
+	begin=bench_now();
+	for(i=0;i<num_pairs;i++){
+		jobs[i].ops=ops;
+		jobs[i].n=n;
+		jobs[i].first=i;
+		jobs[i].step=num_pairs;
+		jobs[i].paced=paced;
+		jobs[i].begin=begin;
+		jobs[i].latency=result.latency;
+		pthread_create(&handles[i],NULL,p_replay,&jobs[i]);
+		place_pin(handles[i],i);
+	}
+	if(engine->balance!=NULL){
+		pthread_create(&balancer,NULL,p_bench_bal,&no_ops);
+		place_pin(balancer,num_pairs);
+	}
+	for(i=0;i<num_pairs;i++){
+		pthread_join(handles[i],NULL);
+	}
+	if(engine->balance!=NULL){pthread_join(balancer,NULL);}
+	result.seconds=(bench_now()-begin)/1e9;
+
+	result.keys=engine->count();
+	result.height=(engine->height!=NULL)?engine->height():-1;
+	result.bytes=engine->bytes();
+	bench_csv(stdout,&result);
+
+	engine->destroy();
+	free(result.latency);
+	free(jobs);
+	free(handles);
+	free(ops);
+}
+
+// pthreads function to replay and time one thread's share of a trace
+void *p_replay(void *arg){
+	REPLAY_JOB *job=(REPLAY_JOB *)arg;
+	TRACE_OP *op;
+	long i, start;
+	int val;
+	for(i=job->first;i<job->n;i+=job->step){
+		op=&(job->ops[i]);
+		if(job->paced){wait_until(job->begin+op->time);}
+		start=bench_now();
+		switch(op->type){
+			case TRACE_ADD:
+				engine->add(op->key);
+				break;
+			case TRACE_DEL:
+				engine->del(op->key);
+				break;
+			case TRACE_LOOKUP:
+				engine->lookup(op->key);
+				break;
+			case TRACE_RANGE:
+				if(engine==&avl_engine){delete_range(op->key,op->key+op->width-1);}
+				else{for(val=op->key;val<op->key+op->width;val++){engine->del(val);}}
+				break;
+		}
+		job->latency[i]=bench_now()-start;
+		__sync_fetch_and_add(&bench_done,1);
+	}
+	return NULL;
+}
+
+// wal_open callback that redoes a logged update
+void replay_logged(int type, int key, int hi){
+	if(type==WAL_ADD){add_value(key);}
+	else if(type==WAL_DEL){delete_value(key);}
+	else{delete_range(key,hi);}
+}
+
+// sleeps to within a millisecond of bench_now() time due (usleep can overshoot by
+// that much) and spins the rest, yielding so a thread that's behind on the same core gets it
+void wait_until(long due){
+	long now;
+	while((now=bench_now())<due){
+		if(due-now>2000000){usleep((due-now-1000000)/1000);}
+		else{sched_yield();}
+	}
+}
+
+// function to generate poisson random variables 
+int poisson_gen(double lambda){
+	int k=0;
+	double p=exp(-lambda);		//initialises p
+	double F=p;			// sets F to p
+	double rnum=drand48();		// generates a random number
+
+	// loops until it finds the right value of k
+	while(rnum>F){			
+		p*=lambda/(k+1);	// calculates p
+		F+=p;			// bumps up F
+		k++;			// increments k counter
+	}
+	return k;
 }
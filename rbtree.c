@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "rbtree.h"
+#include "engine.h"
+
+#define RED 0
+#define BLACK 1
+
+// set up node structure
+typedef struct rb_node{
+	int val;			// node's value
+	int colour;			// RED or BLACK
+	struct rb_node *left;		// child pointers
+	struct rb_node *right;
+	struct rb_node *parent;
+}RB_NODE;
+
+
+// black sentinel used in place of NULL children (and the root's parent)
+static RB_NODE nil_node={0,BLACK,&nil_node,&nil_node,&nil_node};
+#define NIL (&nil_node)
+
+static RB_NODE *rb_root=NIL;
+static pthread_rwlock_t rb_lock=PTHREAD_RWLOCK_INITIALIZER;
+
+static long rb_counter=0;		// number of values in the tree
+static long rb_rots=0;			// rotations so far
+
+
+
+// rotates x's right child up into its place
+static void rotate_left(RB_NODE *x){
+	RB_NODE *y=x->right;
+	x->right=y->left;
+	if(y->left!=NIL){y->left->parent=x;}
+	y->parent=x->parent;
+	if(x->parent==NIL){rb_root=y;}
+	else if(x==x->parent->left){x->parent->left=y;}
+	else{x->parent->right=y;}
+	y->left=x;
+	x->parent=y;
+	rb_rots++;
+}
+
+// rotates x's left child up into its place
+static void rotate_right(RB_NODE *x){
+	RB_NODE *y=x->left;
+	x->left=y->right;
+	if(y->right!=NIL){y->right->parent=x;}
+	y->parent=x->parent;
+	if(x->parent==NIL){rb_root=y;}
+	else if(x==x->parent->right){x->parent->right=y;}
+	else{x->parent->left=y;}
+	y->right=x;
+	x->parent=y;
+	rb_rots++;
+}
+
+// restores the colour rules after z was added as a red leaf
+static void add_fixup(RB_NODE *z){
+	RB_NODE *uncle;
+	while(z->parent->colour==RED){
+		if(z->parent==z->parent->parent->left){
+			uncle=z->parent->parent->right;
+			// red uncle: recolour and carry on from the grandparent
+			if(uncle->colour==RED){
+				z->parent->colour=BLACK;
+				uncle->colour=BLACK;
+				z->parent->parent->colour=RED;
+				z=z->parent->parent;
+			}
+			// black uncle: at most two rotations and we're done
+			else{
+				if(z==z->parent->right){
+					z=z->parent;
+					rotate_left(z);
+				}
+				z->parent->colour=BLACK;
+				z->parent->parent->colour=RED;
+				rotate_right(z->parent->parent);
+			}
+		}
+		// SIMILAR with left and right swapped
+		else{
+			uncle=z->parent->parent->left;
+			if(uncle->colour==RED){
+				z->parent->colour=BLACK;
+				uncle->colour=BLACK;
+				z->parent->parent->colour=RED;
+				z=z->parent->parent;
+			}
+			else{
+				if(z==z->parent->left){
+					z=z->parent;
+					rotate_right(z);
+				}
+				z->parent->colour=BLACK;
+				z->parent->parent->colour=RED;
+				rotate_left(z->parent->parent);
+			}
+		}
+	}
+	rb_root->colour=BLACK;
+}
+
+// puts v in u's place under u's parent
+static void transplant(RB_NODE *u, RB_NODE *v){
+	if(u->parent==NIL){rb_root=v;}
+	else if(u==u->parent->left){u->parent->left=v;}
+	else{u->parent->right=v;}
+	v->parent=u->parent;
+}
+
+// restores the colour rules after a black node was removed above x
+static void delete_fixup(RB_NODE *x){
+	RB_NODE *w;
+	while(x!=rb_root && x->colour==BLACK){
+		if(x==x->parent->left){
+			w=x->parent->right;		// x's sibling
+			if(w->colour==RED){
+				w->colour=BLACK;
+				x->parent->colour=RED;
+				rotate_left(x->parent);
+				w=x->parent->right;
+			}
+			// both nephews black: recolour and move up
+			if(w->left->colour==BLACK && w->right->colour==BLACK){
+				w->colour=RED;
+				x=x->parent;
+			}
+			// otherwise one or two rotations finish it
+			else{
+				if(w->right->colour==BLACK){
+					w->left->colour=BLACK;
+					w->colour=RED;
+					rotate_right(w);
+					w=x->parent->right;
+				}
+				w->colour=x->parent->colour;
+				x->parent->colour=BLACK;
+				w->right->colour=BLACK;
+				rotate_left(x->parent);
+				x=rb_root;
+			}
+		}
+		// SIMILAR with left and right swapped
+		else{
+			w=x->parent->left;
+			if(w->colour==RED){
+				w->colour=BLACK;
+				x->parent->colour=RED;
+				rotate_right(x->parent);
+				w=x->parent->left;
+			}
+			if(w->right->colour==BLACK && w->left->colour==BLACK){
+				w->colour=RED;
+				x=x->parent;
+			}
+			else{
+				if(w->left->colour==BLACK){
+					w->right->colour=BLACK;
+					w->colour=RED;
+					rotate_left(w);
+					w=x->parent->left;
+				}
+				w->colour=x->parent->colour;
+				x->parent->colour=BLACK;
+				w->left->colour=BLACK;
+				rotate_right(x->parent);
+				x=rb_root;
+			}
+		}
+	}
+	x->colour=BLACK;
+}
+
+
+
+// sets up an empty tree
+void rb_init(){
+	rb_root=NIL;
+	rb_counter=0;
+	rb_rots=0;
+}
+
+// adds a value to the tree, returns 1 if added
+int rb_add(int new_val){
+	RB_NODE *parent=NIL, *temp;
+
+	pthread_rwlock_wrlock(&rb_lock);
+	// finds the leaf to hang it off (or the value already in the tree)
+	temp=rb_root;
+	while(temp!=NIL){
+		parent=temp;
+		if(new_val<temp->val){temp=temp->left;}
+		else if(new_val>temp->val){temp=temp->right;}
+		else{
+			pthread_rwlock_unlock(&rb_lock);
+			return 0;
+		}
+	}
+
+	// adds it as a red leaf
+	RB_NODE *new_node=(RB_NODE *)malloc(sizeof(RB_NODE));
+	new_node->val=new_val;
+	new_node->colour=RED;
+	new_node->left=NIL;
+	new_node->right=NIL;
+	new_node->parent=parent;
+	if(parent==NIL){rb_root=new_node;}
+	else if(new_val<parent->val){parent->left=new_node;}
+	else{parent->right=new_node;}
+
+	add_fixup(new_node);
+	rb_counter++;
+	pthread_rwlock_unlock(&rb_lock);
+	return 1;
+}
+
+// deletes a value from the tree, returns 1 if deleted
+int rb_delete(int del_val){
+	RB_NODE *z, *y, *x;
+	int y_colour;
+
+	pthread_rwlock_wrlock(&rb_lock);
+	z=rb_root;
+	while(z!=NIL && z->val!=del_val){
+		if(del_val<z->val){z=z->left;}
+		else{z=z->right;}
+	}
+	if(z==NIL){
+		pthread_rwlock_unlock(&rb_lock);
+		return 0;
+	}
+
+	// removes z (or its successor y if it has two children) and notes the colour lost
+	y=z;
+	y_colour=y->colour;
+	if(z->left==NIL){
+		x=z->right;
+		transplant(z,z->right);
+	}
+	else if(z->right==NIL){
+		x=z->left;
+		transplant(z,z->left);
+	}
+	else{
+		y=z->right;
+		while(y->left!=NIL){y=y->left;}
+		y_colour=y->colour;
+		x=y->right;
+		if(y->parent==z){x->parent=y;}
+		else{
+			transplant(y,y->right);
+			y->right=z->right;
+			y->right->parent=y;
+		}
+		transplant(z,y);
+		y->left=z->left;
+		y->left->parent=y;
+		y->colour=z->colour;
+	}
+	if(y_colour==BLACK){delete_fixup(x);}
+
+	free(z);
+	rb_counter--;
+	pthread_rwlock_unlock(&rb_lock);
+	return 1;
+}
+
+// returns 1 if val is in the tree
+int rb_lookup(int val){
+	RB_NODE *temp;
+	pthread_rwlock_rdlock(&rb_lock);
+	temp=rb_root;
+	while(temp!=NIL && temp->val!=val){
+		if(val<temp->val){temp=temp->left;}
+		else{temp=temp->right;}
+	}
+	pthread_rwlock_unlock(&rb_lock);
+	return (temp!=NIL);
+}
+
+// number of values in the tree
+long rb_count(){
+	return rb_counter;
+}
+
+// bytes used by the tree's nodes
+long rb_bytes(){
+	return rb_counter*sizeof(RB_NODE);
+}
+
+// rotations done so far
+long rb_rotations(){
+	return rb_rots;
+}
+
+// height of a subtree
+static int subtree_height(RB_NODE *node){
+	int left, right;
+	if(node==NIL){return 0;}
+	left=subtree_height(node->left);
+	right=subtree_height(node->right);
+	return (left>right)?left+1:right+1;
+}
+
+// height of the tree (no other threads updating)
+int rb_height(){
+	return subtree_height(rb_root);
+}
+
+// frees the tree (no other threads may be running)
+void rb_destroy(){
+	RB_NODE *node=rb_root, *parent;
+	// frees leaves bottom up using the parent pointers instead of a stack
+	while(node!=NIL){
+		if(node->left!=NIL){node=node->left;}
+		else if(node->right!=NIL){node=node->right;}
+		else{
+			parent=node->parent;
+			if(parent!=NIL){
+				if(parent->left==node){parent->left=NIL;}
+				else{parent->right=NIL;}
+			}
+			free(node);
+			node=parent;
+		}
+	}
+	rb_root=NIL;
+}
+
+
+ENGINE rb_engine={"red-black (global lock)",rb_init,rb_add,rb_delete,rb_lookup,NULL,NULL,rb_count,rb_bytes,rb_rotations,rb_destroy,rb_height};
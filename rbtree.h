@@ -0,0 +1,21 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+// Red-black tree engine under one global lock, the baseline for chromatic.c
+// Each add fixes the tree with at most 2 rotations and each delete with at most
+// 3, done inside the update itself, so there's no balancer thread and no pass
+// over the whole tree like rebalance(). Lookups can be up to twice as deep as a
+// perfectly balanced tree. Lookups share a read lock, but every update takes it
+// exclusively, fix-up included, so updates never run in parallel.
+
+void rb_init();									// sets up an empty tree
+int rb_add(int new_val);							// adds a value, returns 1 if added
+int rb_delete(int del_val);							// deletes a value, returns 1 if deleted
+int rb_lookup(int val);								// returns 1 if val is in the tree
+long rb_count();								// number of values in the tree
+long rb_bytes();								// bytes used by the tree's nodes
+long rb_rotations();								// rotations done so far
+int rb_height();								// height of the tree (no other threads updating)
+void rb_destroy();								// frees the tree (no other threads may be running)
+
+#endif
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
+#include "skiplist.h"
+#include "engine.h"
+#include "ebr.h"
+
+// set up node structure
+typedef struct sl_node{
+	int val;			// node's value
+	int top_level;			// highest level the node is linked on
+	int marked;			// set once the node is logically deleted
+	int fully_linked;		// set once the node is linked on every level
+	pthread_mutex_t lock;		// individual lock
+	struct sl_node *next[];		// next pointer for each level (top_level+1 of them)
+}SL_NODE;
+
+
+// sentinels at either end of every level (searches stop at tail itself, so every int is a valid key)
+static SL_NODE *head, *tail;
+
+static long sl_counter=0;		// number of values in the list
+static long sl_mem=0;			// bytes allocated to nodes in the list
+
+static __thread unsigned int level_seed=0;	// per thread seed for random levels
+
+
+
+// allocates a node with a given number of levels
+static SL_NODE *new_node(int val, int top_level){
+	size_t size=sizeof(SL_NODE)+(top_level+1)*sizeof(SL_NODE *);
+	SL_NODE *node=(SL_NODE *)malloc(size);
+	node->val=val;
+	node->top_level=top_level;
+	node->marked=0;
+	node->fully_linked=0;
+	pthread_mutex_init(&(node->lock),NULL);
+	__sync_fetch_and_add(&sl_mem,size);
+	return node;
+}
+
+// retires a node that has been unlinked from every level
+static void retire_node(SL_NODE *node){
+	__sync_fetch_and_sub(&sl_mem,sizeof(SL_NODE)+(node->top_level+1)*sizeof(SL_NODE *));
+	ebr_retire(node);
+}
+
+// picks a level with probability 1/2 of going up each time
+static int random_level(){
+	int level=0;
+	// seeds from rand() the first time so runs with the same seed are comparable
+	if(level_seed==0){level_seed=rand()|1;}
+	while(level<SL_MAX_LEVEL-1 && (rand_r(&level_seed)&1)){
+		level++;
+	}
+	return level;
+}
+
+// fills in the predecessor and successor of val on every level
+// returns the highest level val was found on (-1 if not found)
+static int find_node(int val, SL_NODE **preds, SL_NODE **succs){
+	int level, found=-1;
+	SL_NODE *pred=head, *curr;
+
+	for(level=SL_MAX_LEVEL-1;level>=0;level--){
+		curr=__atomic_load_n(&(pred->next[level]),__ATOMIC_ACQUIRE);
+		while(curr!=tail && val>curr->val){
+			pred=curr;
+			curr=__atomic_load_n(&(pred->next[level]),__ATOMIC_ACQUIRE);
+		}
+		if(found==-1 && curr!=tail && val==curr->val){found=level;}
+		preds[level]=pred;
+		succs[level]=curr;
+	}
+	return found;
+}
+
+// unlocks the distinct predecessors locked on levels 0 to highest
+static void unlock_preds(SL_NODE **preds, int highest){
+	int level;
+	SL_NODE *prev=NULL;
+	for(level=0;level<=highest;level++){
+		if(preds[level]!=prev){
+			pthread_mutex_unlock(&(preds[level]->lock));
+			prev=preds[level];
+		}
+	}
+}
+
+
+
+// sets up an empty list
+void sl_init(){
+	int level;
+	head=new_node(INT_MIN,SL_MAX_LEVEL-1);
+	tail=new_node(INT_MAX,SL_MAX_LEVEL-1);
+	for(level=0;level<SL_MAX_LEVEL;level++){
+		head->next[level]=tail;
+		tail->next[level]=NULL;
+	}
+	head->fully_linked=tail->fully_linked=1;
+	sl_counter=0;
+}
+
+// adds a value to the list, returns 1 if added
+int sl_add(int new_val){
+	SL_NODE *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	SL_NODE *pred, *succ, *prev, *node;
+	int top_level=random_level();
+	int found, highest, level, valid;
+
+	ebr_enter();
+	while(1){
+		found=find_node(new_val,preds,succs);
+
+		// if it's already there it waits for it to be linked in (unless it's being deleted)
+		if(found!=-1){
+			node=succs[found];
+			if(!__atomic_load_n(&(node->marked),__ATOMIC_ACQUIRE)){
+				while(!__atomic_load_n(&(node->fully_linked),__ATOMIC_ACQUIRE)){}
+				ebr_exit();
+				return 0;
+			}
+			continue;
+		}
+
+		// locks each distinct predecessor bottom up and checks it still points at its successor
+		highest=-1;
+		valid=1;
+		prev=NULL;
+		for(level=0;valid && level<=top_level;level++){
+			pred=preds[level];
+			succ=succs[level];
+			if(pred!=prev){
+				pthread_mutex_lock(&(pred->lock));
+				highest=level;
+				prev=pred;
+			}
+			valid=!pred->marked && !succ->marked && pred->next[level]==succ;
+		}
+		if(!valid){
+			unlock_preds(preds,highest);
+			continue;
+		}
+
+		// links in the new node bottom up
+		node=new_node(new_val,top_level);
+		for(level=0;level<=top_level;level++){
+			node->next[level]=succs[level];
+		}
+		for(level=0;level<=top_level;level++){
+			__atomic_store_n(&(preds[level]->next[level]),node,__ATOMIC_RELEASE);
+		}
+		__atomic_store_n(&(node->fully_linked),1,__ATOMIC_RELEASE);	// this is where the add takes effect
+
+		unlock_preds(preds,highest);
+		__sync_fetch_and_add(&sl_counter,1);
+		ebr_exit();
+		return 1;
+	}
+}
+
+// deletes a value from the list, returns 1 if deleted
+int sl_delete(int del_val){
+	SL_NODE *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	SL_NODE *victim=NULL, *pred, *prev;
+	int is_marked=0, top_level=-1;
+	int found, highest, level, valid;
+
+	ebr_enter();
+	while(1){
+		found=find_node(del_val,preds,succs);
+
+		// only deletes a fully linked node found at its top level that nobody else has marked
+		if(!is_marked){
+			if(found==-1){break;}
+			victim=succs[found];
+			if(!victim->fully_linked || victim->top_level!=found || victim->marked){break;}
+
+			top_level=victim->top_level;
+			pthread_mutex_lock(&(victim->lock));
+			if(victim->marked){
+				pthread_mutex_unlock(&(victim->lock));
+				break;
+			}
+			__atomic_store_n(&(victim->marked),1,__ATOMIC_RELEASE);	// this is where the delete takes effect
+			is_marked=1;
+		}
+
+		// locks the predecessors and checks they still point at the victim
+		highest=-1;
+		valid=1;
+		prev=NULL;
+		for(level=0;valid && level<=top_level;level++){
+			pred=preds[level];
+			if(pred!=prev){
+				pthread_mutex_lock(&(pred->lock));
+				highest=level;
+				prev=pred;
+			}
+			valid=!pred->marked && pred->next[level]==victim;
+		}
+		if(!valid){
+			unlock_preds(preds,highest);
+			continue;
+		}
+
+		// unlinks the victim top down
+		for(level=top_level;level>=0;level--){
+			__atomic_store_n(&(preds[level]->next[level]),victim->next[level],__ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&(victim->lock));
+		unlock_preds(preds,highest);
+		retire_node(victim);
+
+		__sync_fetch_and_sub(&sl_counter,1);
+		ebr_exit();
+		return 1;
+	}
+	ebr_exit();
+	return 0;
+}
+
+// returns 1 if val is in the list
+int sl_lookup(int val){
+	SL_NODE *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	int found, in_list=0;
+
+	ebr_enter();
+	found=find_node(val,preds,succs);
+	if(found!=-1){
+		in_list=__atomic_load_n(&(succs[found]->fully_linked),__ATOMIC_ACQUIRE) && !__atomic_load_n(&(succs[found]->marked),__ATOMIC_ACQUIRE);
+	}
+	ebr_exit();
+	return in_list;
+}
+
+// calls callback on each key in [lo,hi] in order, returns how many
+// walks the bottom level without locks, so it sees each key as it was when it got there
+long sl_scan(int lo, int hi, void (*callback)(int val, void *arg), void *arg){
+	SL_NODE *preds[SL_MAX_LEVEL], *succs[SL_MAX_LEVEL];
+	SL_NODE *node;
+	long keys=0;
+
+	ebr_enter();
+	find_node(lo,preds,succs);
+	for(node=succs[0];node!=tail && node->val<=hi;node=__atomic_load_n(&(node->next[0]),__ATOMIC_ACQUIRE)){
+		if(__atomic_load_n(&(node->fully_linked),__ATOMIC_ACQUIRE) && !__atomic_load_n(&(node->marked),__ATOMIC_ACQUIRE)){
+			callback(node->val,arg);
+			keys++;
+		}
+	}
+	ebr_exit();
+	return keys;
+}
+
+// number of values in the list
+long sl_count(){
+	return __atomic_load_n(&sl_counter,__ATOMIC_ACQUIRE);
+}
+
+// bytes used by the list's nodes
+long sl_bytes(){
+	return __atomic_load_n(&sl_mem,__ATOMIC_ACQUIRE);
+}
+
+// frees the list (no other threads may be running)
+void sl_destroy(){
+	SL_NODE *node=head, *next;
+	// the bottom level links every node
+	while(node!=NULL){
+		next=node->next[0];
+		free(node);
+		node=next;
+	}
+	ebr_flush();
+	head=tail=NULL;
+	sl_mem=0;
+}
+
+
+ENGINE sl_engine={"lazy skip list",sl_init,sl_add,sl_delete,sl_lookup,NULL,NULL,sl_count,sl_bytes,NULL,sl_destroy,NULL};
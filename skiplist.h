@@ -0,0 +1,22 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+// Concurrent lazy skip list (Herlihy, Lev, Luchangco and Shavit, 2006)
+// Lookups never lock. Adds and deletes find their place without locks, then lock
+// only the predecessors they change and check nothing moved underneath them.
+// Deletes mark a node before unlinking it, so a node that is linked at every
+// level and unmarked is in the set. Random levels keep it balanced without a
+// balancer thread.
+
+#define SL_MAX_LEVEL 32							// levels in the head node
+
+void sl_init();									// sets up an empty list
+int sl_add(int new_val);							// adds a value, returns 1 if added
+int sl_delete(int del_val);							// deletes a value, returns 1 if deleted
+int sl_lookup(int val);								// returns 1 if val is in the list
+long sl_scan(int lo, int hi, void (*callback)(int val, void *arg), void *arg);	// calls callback on each key in [lo,hi] in order, returns how many
+long sl_count();								// number of values in the list
+long sl_bytes();								// bytes used by the list's nodes
+void sl_destroy();								// frees the list (no other threads may be running)
+
+#endif
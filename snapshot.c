@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+#define SNAP_MAGIC "AVLSNAP"
+#define SNAP_VERSION 1
+#define SNAP_SEED 14695981039346656037UL	// FNV-1a offset basis
+#define SNAP_PRIME 1099511628211UL		// FNV-1a prime
+
+unsigned long snap_checksum(unsigned long sum, int key);			// folds a key into an FNV-1a style checksum (a key at a time)
+
+
+
+// folds a key into an FNV-1a style checksum (a key at a time rather than a byte, to keep up with the disk)
+unsigned long snap_checksum(unsigned long sum, int key){
+	return (sum^(unsigned int)key)*SNAP_PRIME;
+}
+
+// starts writing a snapshot, NULL on error
+SNAP_WRITER *snap_create(char *path){
+	SNAP_HEADER header;
+	SNAP_WRITER *writer=malloc(sizeof(SNAP_WRITER));
+	writer->path=strdup(path);
+	writer->temp=malloc(strlen(path)+5);
+	sprintf(writer->temp,"%s.tmp",path);
+	writer->count=0;
+	writer->checksum=SNAP_SEED;
+	writer->file=fopen(writer->temp,"wb");
+	if(writer->file==NULL){
+		free(writer->temp);
+		free(writer->path);
+		free(writer);
+		return NULL;
+	}
+	// the header is written again once the count and checksum are known
+	memset(&header,0,sizeof(header));
+	fwrite(&header,sizeof(header),1,writer->file);
+	return writer;
+}
+
+// adds the next key (each must be bigger than the last)
+void snap_put(SNAP_WRITER *writer, int key){
+	fwrite(&key,sizeof(key),1,writer->file);
+	writer->checksum=snap_checksum(writer->checksum,key);
+	writer->count++;
+}
+
+// fills in the header and renames it into place, returns the count (-1 on error)
+long snap_finish(SNAP_WRITER *writer){
+	SNAP_HEADER header;
+	long count=writer->count;
+	int failed;
+
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,SNAP_MAGIC,8);
+	header.version=SNAP_VERSION;
+	header.width=sizeof(int);
+	header.count=count;
+	header.checksum=writer->checksum;
+	failed=(fseek(writer->file,0,SEEK_SET)!=0 || fwrite(&header,sizeof(header),1,writer->file)!=1);
+	failed|=(fflush(writer->file)!=0 || fsync(fileno(writer->file))!=0);
+	failed|=(fclose(writer->file)!=0);
+	if(!failed){failed=(rename(writer->temp,writer->path)!=0);}
+	if(failed){
+		unlink(writer->temp);
+		count=-1;
+	}
+	free(writer->temp);
+	free(writer->path);
+	free(writer);
+	return count;
+}
+
+// maps a snapshot and checks it, NULL if it's missing or bad
+// the check reads every key, which also brings the file into memory for whoever uses it next
+SNAP *snap_open(char *path){
+	struct stat st;
+	SNAP_HEADER *header;
+	unsigned long sum=SNAP_SEED;
+	long i;
+	int fd=open(path,O_RDONLY), ok;
+	if(fd<0){return NULL;}
+	if(fstat(fd,&st)!=0 || st.st_size<(long)sizeof(SNAP_HEADER)){
+		close(fd);
+		return NULL;
+	}
+	void *map=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	close(fd);
+	if(map==MAP_FAILED){return NULL;}
+	madvise(map,st.st_size,MADV_WILLNEED);
+
+	SNAP *snap=malloc(sizeof(SNAP));
+	header=(SNAP_HEADER *)map;
+	snap->map=map;
+	snap->bytes=st.st_size;
+	snap->n=header->count;
+	snap->keys=(int *)((char *)map+sizeof(SNAP_HEADER));
+
+	ok=(memcmp(header->magic,SNAP_MAGIC,8)==0 && header->version==SNAP_VERSION && header->width==sizeof(int));
+	ok=ok && header->count>=0 && (long)sizeof(SNAP_HEADER)+header->count*(long)sizeof(int)==st.st_size;
+	// a torn or reordered file fails the checksum or the order
+	for(i=0;ok && i<snap->n;i++){
+		if(i>0 && snap->keys[i]<=snap->keys[i-1]){ok=0;}
+		sum=snap_checksum(sum,snap->keys[i]);
+	}
+	if(!ok || sum!=header->checksum){
+		snap_close(snap);
+		return NULL;
+	}
+	madvise(map,st.st_size,MADV_RANDOM);
+	return snap;
+}
+
+// returns 1 if val is in the snapshot
+int snap_search(SNAP *snap, int val){
+	long lo=0, hi=snap->n-1, mid;
+	while(lo<=hi){
+		mid=lo+(hi-lo)/2;
+		if(snap->keys[mid]==val){return 1;}
+		if(snap->keys[mid]<val){lo=mid+1;}
+		else{hi=mid-1;}
+	}
+	return 0;
+}
+
+// unmaps a snapshot
+void snap_close(SNAP *snap){
+	munmap(snap->map,snap->bytes);
+	free(snap);
+}
@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Sorted snapshot files, written by save_tree() and mapped back in by load_tree()
+// A 64 byte header (magic, version, bytes per key, count and a checksum of the
+// keys) and then every key in ascending order at a fixed width, so a loaded file
+// is already a sorted array: it can be binary searched where it's mapped or built
+// straight into a balanced tree. Files are written under a temporary name and
+// renamed at the end, so a crash mid save leaves the old snapshot in place
+
+typedef struct snap_header{
+	char magic[8];			// "AVLSNAP" and a 0
+	unsigned int version;
+	unsigned int width;		// bytes per key
+	long count;			// keys in the file
+	unsigned long checksum;		// snap_checksum() of the keys
+	char pad[32];			// keeps the keys on a cache line boundary
+}SNAP_HEADER;
+
+// a snapshot being written
+typedef struct snap_writer{
+	FILE *file;
+	char *path;			// name to give it once it's complete
+	char *temp;			// name it has until then
+	long count;
+	unsigned long checksum;
+}SNAP_WRITER;
+
+// a snapshot mapped into memory
+typedef struct snap{
+	void *map;
+	long bytes;			// length of the mapping
+	long n;				// number of keys
+	int *keys;			// keys[0..n-1] in ascending order (in the mapping)
+}SNAP;
+
+SNAP_WRITER *snap_create(char *path);						// starts writing a snapshot, NULL on error
+void snap_put(SNAP_WRITER *writer, int key);					// adds the next key (each must be bigger than the last)
+long snap_finish(SNAP_WRITER *writer);						// fills in the header and renames it into place, returns the count (-1 on error)
+SNAP *snap_open(char *path);							// maps a snapshot and checks it, NULL if it's missing or bad
+int snap_search(SNAP *snap, int val);						// returns 1 if val is in the snapshot
+void snap_close(SNAP *snap);							// unmaps a snapshot
+
+#endif
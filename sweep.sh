@@ -0,0 +1,26 @@
+#!/bin/sh
+# Runs pthreads.out -p over tree sizes from 1K to 100M keys for each engine and
+# prints one CSV (make sweep), to show where each falls off the caches
+# Override with SWEEP_SIZES, SWEEP_ENGINES, SWEEP_OPS and SWEEP_SEED. A size is
+# skipped (with a note on stderr) if SWEEP_BYTES_PER_KEY per key won't fit in
+# the memory available, rather than timing swap
+
+sizes=${SWEEP_SIZES:-"1000 10000 100000 1000000 10000000 100000000"}
+engines=${SWEEP_ENGINES:-"0 1 2 3 4 5 7"}
+ops=${SWEEP_OPS:-100000}
+seed=${SWEEP_SEED:-1}
+per_key=${SWEEP_BYTES_PER_KEY:-128}
+
+{
+	for keys in $sizes; do
+		available=$(awk '/^MemAvailable:/ {print int($2/1024)}' /proc/meminfo 2>/dev/null)
+		needed=$((keys*per_key/1048576))
+		if [ -n "$available" ] && [ "$needed" -gt "$available" ]; then
+			echo "skipping $keys keys: needs about ${needed}MB, ${available}MB available" >&2
+			continue
+		fi
+		for engine in $engines; do
+			./pthreads.out -p "$keys" -n "$ops" -s "$seed" -e "$engine"
+		done
+	done
+} | awk 'NR==1 || !/^engine,/'
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include "tpool.h"
+
+// a thread's tasks, stolen from the top and pushed/popped at the bottom
+// top and bottom only change under the lock, but with atomic stores so steal() can peek at them without it
+typedef struct deque{
+	pthread_mutex_t lock;
+	int used;			// set while a thread owns the deque
+	TASK **tasks;
+	int top;
+	int bottom;
+	int cap;
+}DEQUE;
+
+
+static DEQUE deques[TPOOL_MAX_DEQUES];
+static int num_deques=0;			// deques handed out so far
+static pthread_mutex_t deques_lock=PTHREAD_MUTEX_INITIALIZER;
+static __thread DEQUE *my_deque=NULL;
+static pthread_key_t deque_key;			// used to release a deque when its thread exits
+static pthread_once_t key_once=PTHREAD_ONCE_INIT;
+static __thread unsigned int steal_seed=0;	// per thread seed for picking victims
+
+static pthread_t *workers;
+static int num_workers=0;
+static int running=0;				// set while the workers should keep going
+static long pending=0;				// tasks sitting in deques
+
+// workers with nothing to steal sleep here
+static pthread_mutex_t idle_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond=PTHREAD_COND_INITIALIZER;
+static int sleeping=0;
+
+
+
+// releases a thread's (empty) deque when the thread exits
+static void release_deque(void *arg){
+	DEQUE *d=(DEQUE *)arg;
+	pthread_mutex_lock(&deques_lock);
+	d->used=0;
+	pthread_mutex_unlock(&deques_lock);
+}
+
+static void make_key(){
+	pthread_key_create(&deque_key,release_deque);
+}
+
+// finds (or hands out) the calling thread's deque
+static DEQUE *get_deque(){
+	int i;
+	if(my_deque!=NULL){return my_deque;}
+	pthread_once(&key_once,make_key);
+
+	pthread_mutex_lock(&deques_lock);
+	// reuses a deque from a thread that has exited
+	for(i=0;i<num_deques;i++){
+		if(!deques[i].used){
+			my_deque=&deques[i];
+			break;
+		}
+	}
+	if(my_deque==NULL){
+		if(num_deques==TPOOL_MAX_DEQUES){
+			fprintf(stderr,"tpool: more than %d spawning threads\n",TPOOL_MAX_DEQUES);
+			exit(EXIT_FAILURE);
+		}
+		my_deque=&deques[num_deques];
+		pthread_mutex_init(&(my_deque->lock),NULL);
+		my_deque->cap=64;
+		my_deque->tasks=malloc(my_deque->cap*sizeof(TASK *));
+		my_deque->top=my_deque->bottom=0;
+		__atomic_store_n(&num_deques,num_deques+1,__ATOMIC_RELEASE);
+	}
+	my_deque->used=1;
+	pthread_setspecific(deque_key,my_deque);
+	pthread_mutex_unlock(&deques_lock);
+	return my_deque;
+}
+
+// takes the newest task from the calling thread's own deque
+static TASK *pop(){
+	DEQUE *d=get_deque();
+	TASK *task=NULL;
+	pthread_mutex_lock(&(d->lock));
+	if(d->bottom>d->top){
+		__atomic_store_n(&(d->bottom),d->bottom-1,__ATOMIC_RELAXED);
+		task=d->tasks[d->bottom];
+		__sync_fetch_and_sub(&pending,1);
+	}
+	pthread_mutex_unlock(&(d->lock));
+	return task;
+}
+
+// takes the oldest task from any other thread's deque
+static TASK *steal(){
+	int n=__atomic_load_n(&num_deques,__ATOMIC_ACQUIRE), start, i;
+	DEQUE *d;
+	TASK *task=NULL;
+
+	if(n==0){return NULL;}
+	if(steal_seed==0){steal_seed=(unsigned int)(size_t)&steal_seed|1;}
+	start=rand_r(&steal_seed)%n;		// starts at a random victim to spread the stealing out
+	for(i=0;i<n && task==NULL;i++){
+		d=&deques[(start+i)%n];
+		// skips deques that look empty without locking them (checked again under the lock)
+		if(d==my_deque || __atomic_load_n(&(d->bottom),__ATOMIC_RELAXED)<=__atomic_load_n(&(d->top),__ATOMIC_RELAXED)){continue;}
+		pthread_mutex_lock(&(d->lock));
+		if(d->bottom>d->top){
+			task=d->tasks[d->top];
+			__atomic_store_n(&(d->top),d->top+1,__ATOMIC_RELAXED);
+			__sync_fetch_and_sub(&pending,1);
+		}
+		pthread_mutex_unlock(&(d->lock));
+	}
+	return task;
+}
+
+// runs a task and marks it done
+static void run(TASK *task){
+	task->fn(task->arg);
+	__atomic_store_n(&(task->done),1,__ATOMIC_RELEASE);
+}
+
+// pthreads function for a worker: steals tasks until the pool is destroyed
+static void *p_worker(){
+	TASK *task;
+	while(__atomic_load_n(&running,__ATOMIC_ACQUIRE)){
+		task=pop();
+		if(task==NULL){task=steal();}
+		if(task!=NULL){
+			run(task);
+			continue;
+		}
+		// sleeps until something is spawned
+		pthread_mutex_lock(&idle_lock);
+		while(__atomic_load_n(&pending,__ATOMIC_ACQUIRE)==0 && __atomic_load_n(&running,__ATOMIC_ACQUIRE)){
+			sleeping++;
+			pthread_cond_wait(&idle_cond,&idle_lock);
+			sleeping--;
+		}
+		pthread_mutex_unlock(&idle_lock);
+	}
+	return NULL;
+}
+
+
+
+// starts the worker threads (0 runs every task inline)
+void tpool_init(int workers_wanted){
+	int i;
+	num_workers=workers_wanted;
+	if(num_workers<=0){
+		num_workers=0;
+		return;
+	}
+	running=1;
+	workers=malloc(num_workers*sizeof(pthread_t));
+	for(i=0;i<num_workers;i++){
+		pthread_create(&workers[i],NULL,p_worker,NULL);
+	}
+}
+
+// queues fn(arg) to run on any thread
+void tpool_spawn(TASK *task, void (*fn)(void *), void *arg){
+	task->fn=fn;
+	task->arg=arg;
+	task->done=0;
+
+	// with no workers there's nobody to hand it to
+	if(num_workers==0){
+		run(task);
+		return;
+	}
+
+	DEQUE *d=get_deque();
+	pthread_mutex_lock(&(d->lock));
+	// slides the deque back to the start of its array, or grows it, if it's hit the end
+	if(d->bottom==d->cap){
+		if(d->top>0){
+			int i;
+			for(i=d->top;i<d->bottom;i++){d->tasks[i-d->top]=d->tasks[i];}
+			__atomic_store_n(&(d->bottom),d->bottom-d->top,__ATOMIC_RELAXED);
+			__atomic_store_n(&(d->top),0,__ATOMIC_RELAXED);
+		}
+		else{
+			d->cap*=2;
+			d->tasks=realloc(d->tasks,d->cap*sizeof(TASK *));
+		}
+	}
+	d->tasks[d->bottom]=task;
+	__atomic_store_n(&(d->bottom),d->bottom+1,__ATOMIC_RELAXED);
+	__sync_fetch_and_add(&pending,1);
+	pthread_mutex_unlock(&(d->lock));
+
+	// wakes a sleeping worker to steal it
+	pthread_mutex_lock(&idle_lock);
+	if(sleeping>0){pthread_cond_signal(&idle_cond);}
+	pthread_mutex_unlock(&idle_lock);
+}
+
+// waits for a spawned task, running others meanwhile
+void tpool_sync(TASK *task){
+	TASK *other;
+	while(!__atomic_load_n(&(task->done),__ATOMIC_ACQUIRE)){
+		other=pop();
+		if(other==NULL){other=steal();}
+		if(other!=NULL){run(other);}
+		else{sched_yield();}
+	}
+}
+
+// number of threads that can run tasks (workers plus caller)
+int tpool_size(){
+	return num_workers+1;
+}
+
+// stops the workers (no tasks may be outstanding)
+void tpool_destroy(){
+	int i;
+	if(num_workers==0){return;}
+
+	pthread_mutex_lock(&idle_lock);
+	__atomic_store_n(&running,0,__ATOMIC_RELEASE);
+	pthread_cond_broadcast(&idle_cond);
+	pthread_mutex_unlock(&idle_lock);
+
+	for(i=0;i<num_workers;i++){
+		pthread_join(workers[i],NULL);
+	}
+	free(workers);
+	num_workers=0;
+}
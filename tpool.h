@@ -0,0 +1,25 @@
+#ifndef TPOOL_H
+#define TPOOL_H
+
+// Work stealing thread pool for fork-join jobs over the tree
+// Every thread that spawns gets its own deque: it pushes and pops at the bottom,
+// idle threads steal from the top of someone else's, so the biggest (oldest)
+// pieces of work are the ones that move. A thread waiting in tpool_sync runs
+// other tasks instead of sleeping. Tasks must not wait on anything that only a
+// spawning thread further up can release.
+
+#define TPOOL_MAX_DEQUES 128							// max number of threads that can spawn tasks
+
+typedef struct task{
+	void (*fn)(void *arg);			// function to run
+	void *arg;
+	int done;				// set once fn has returned
+}TASK;
+
+void tpool_init(int num_workers);						// starts the worker threads (0 runs every task inline)
+void tpool_spawn(TASK *task, void (*fn)(void *), void *arg);			// queues fn(arg) to run on any thread
+void tpool_sync(TASK *task);							// waits for a spawned task, running others meanwhile
+int tpool_size();								// number of threads that can run tasks (workers plus caller)
+void tpool_destroy();								// stops the workers (no tasks may be outstanding)
+
+#endif
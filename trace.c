@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "trace.h"
+#include "bench.h"
+
+#define TRACE_MAGIC "AVLTRACE"
+#define TRACE_VERSION 1
+
+// one thread's ops
+typedef struct trace_buf{
+	TRACE_OP *ops;
+	long n;
+	long cap;
+	struct trace_buf *next;		// next thread's buffer
+}TRACE_BUF;
+
+static TRACE_BUF *buffers=NULL;			// every thread's buffer
+static pthread_mutex_t buffers_lock=PTHREAD_MUTEX_INITIALIZER;
+static __thread TRACE_BUF *my_buf=NULL;		// calling thread's buffer
+static long trace_begin=0;			// bench_now() when capturing started
+static int trace_epoch=0;			// bumped by trace_start so old thread buffers get replaced
+static __thread int my_epoch=-1;
+
+int compare_time(const void *a, const void *b);					// qsort comparison for ops by time
+void put_varint(FILE *out, unsigned long val);					// writes 7 bits a byte, low first, top bit set on all but the last
+int get_varint(FILE *in, unsigned long *val);					// reads one back, returns 0 at the end of the file
+TRACE_OP *read_text(FILE *in, long *n);						// reads a text trace
+
+
+
+// starts capturing (drops anything recorded before)
+void trace_start(){
+	TRACE_BUF *buf, *next;
+	pthread_mutex_lock(&buffers_lock);
+	for(buf=buffers;buf!=NULL;buf=next){
+		next=buf->next;
+		free(buf->ops);
+		free(buf);
+	}
+	buffers=NULL;
+	trace_epoch++;
+	trace_begin=bench_now();
+	pthread_mutex_unlock(&buffers_lock);
+}
+
+// records an op on the calling thread's buffer
+void trace_record(int type, int key, int width){
+	TRACE_BUF *buf=my_buf;
+	// a thread's first op since trace_start gets it a buffer
+	if(buf==NULL || my_epoch!=__atomic_load_n(&trace_epoch,__ATOMIC_ACQUIRE)){
+		buf=malloc(sizeof(TRACE_BUF));
+		buf->cap=1024;
+		buf->n=0;
+		buf->ops=malloc(buf->cap*sizeof(TRACE_OP));
+		pthread_mutex_lock(&buffers_lock);
+		buf->next=buffers;
+		buffers=buf;
+		my_epoch=trace_epoch;
+		pthread_mutex_unlock(&buffers_lock);
+		my_buf=buf;
+	}
+	if(buf->n==buf->cap){
+		buf->cap*=2;
+		buf->ops=realloc(buf->ops,buf->cap*sizeof(TRACE_OP));
+	}
+	buf->ops[buf->n].time=bench_now()-trace_begin;
+	buf->ops[buf->n].key=key;
+	buf->ops[buf->n].width=width;
+	buf->ops[buf->n].type=type;
+	buf->n++;
+}
+
+// qsort comparison for ops by time
+int compare_time(const void *a, const void *b){
+	long x=((const TRACE_OP *)a)->time, y=((const TRACE_OP *)b)->time;
+	return (x>y)-(x<y);
+}
+
+// writes 7 bits a byte, low first, top bit set on all but the last
+void put_varint(FILE *out, unsigned long val){
+	while(val>=0x80){
+		fputc((int)(val&0x7f)|0x80,out);
+		val>>=7;
+	}
+	fputc((int)val,out);
+}
+
+// reads one back, returns 0 at the end of the file
+int get_varint(FILE *in, unsigned long *val){
+	int c, shift=0;
+	*val=0;
+	while((c=fgetc(in))!=EOF){
+		*val|=(unsigned long)(c&0x7f)<<shift;
+		if((c&0x80)==0){return 1;}
+		shift+=7;
+		if(shift>63){return 0;}
+	}
+	return 0;
+}
+
+// merges every thread's ops and writes them, returns how many (-1 on error)
+// only call once the threads recording have finished
+long trace_write(char *path){
+	TRACE_BUF *buf;
+	TRACE_OP *ops;
+	long n=0, i, last=0;
+	unsigned int version=TRACE_VERSION;
+	FILE *out=fopen(path,"wb");
+	if(out==NULL){return -1;}
+
+	// merges the buffers into one run in time order
+	for(buf=buffers;buf!=NULL;buf=buf->next){n+=buf->n;}
+	ops=malloc((n>0?n:1)*sizeof(TRACE_OP));
+	n=0;
+	for(buf=buffers;buf!=NULL;buf=buf->next){
+		memcpy(ops+n,buf->ops,buf->n*sizeof(TRACE_OP));
+		n+=buf->n;
+	}
+	qsort(ops,n,sizeof(TRACE_OP),compare_time);
+
+	fwrite(TRACE_MAGIC,1,8,out);
+	fwrite(&version,sizeof(version),1,out);
+	fwrite(&n,sizeof(n),1,out);
+	for(i=0;i<n;i++){
+		fputc(ops[i].type,out);
+		put_varint(out,(unsigned int)ops[i].key);
+		put_varint(out,ops[i].time-last);
+		if(ops[i].type==TRACE_RANGE){put_varint(out,(unsigned int)ops[i].width);}
+		last=ops[i].time;
+	}
+	free(ops);
+	if(fclose(out)!=0){return -1;}
+	return n;
+}
+
+// reads a binary or text trace (free it after), NULL on error
+TRACE_OP *trace_read(char *path, long *n){
+	TRACE_OP *ops;
+	char magic[8];
+	unsigned int version;
+	unsigned long key, delta, width;
+	long i, time=0;
+	int type;
+	FILE *in=fopen(path,"rb");
+	if(in==NULL){return NULL;}
+
+	// anything without the header is taken as text
+	if(fread(magic,1,8,in)!=8 || memcmp(magic,TRACE_MAGIC,8)!=0){
+		rewind(in);
+		ops=read_text(in,n);
+		fclose(in);
+		return ops;
+	}
+	if(fread(&version,sizeof(version),1,in)!=1 || version!=TRACE_VERSION || fread(n,sizeof(*n),1,in)!=1 || *n<0){
+		fclose(in);
+		return NULL;
+	}
+
+	ops=malloc((*n>0?*n:1)*sizeof(TRACE_OP));
+	for(i=0;i<*n;i++){
+		type=fgetc(in);
+		width=0;
+		if(type<TRACE_ADD || type>TRACE_RANGE || !get_varint(in,&key) || !get_varint(in,&delta)
+				|| (type==TRACE_RANGE && !get_varint(in,&width))){
+			free(ops);
+			fclose(in);
+			return NULL;
+		}
+		time+=delta;
+		ops[i].time=time;
+		ops[i].key=(int)key;
+		ops[i].width=(int)width;
+		ops[i].type=type;
+	}
+	fclose(in);
+	return ops;
+}
+
+// reads a text trace (ops without a time are spaced 1us apart)
+TRACE_OP *read_text(FILE *in, long *n){
+	char line[256], name[16];
+	long cap=1024, time, last=0;
+	int key, width, fields;
+	TRACE_OP *ops=malloc(cap*sizeof(TRACE_OP));
+
+	*n=0;
+	while(fgets(line,sizeof(line),in)!=NULL){
+		if(line[0]=='#' || line[0]=='\n'){continue;}
+		width=0;
+		time=last+1000;
+		if(strncmp(line,"range",5)==0){
+			fields=sscanf(line,"%15s %d %d %ld",name,&key,&width,&time);
+			if(fields<3){free(ops);return NULL;}
+		}
+		else{
+			fields=sscanf(line,"%15s %d %ld",name,&key,&time);
+			if(fields<2){free(ops);return NULL;}
+		}
+		if(*n==cap){
+			cap*=2;
+			ops=realloc(ops,cap*sizeof(TRACE_OP));
+		}
+		if(strcmp(name,"add")==0){ops[*n].type=TRACE_ADD;}
+		else if(strcmp(name,"del")==0){ops[*n].type=TRACE_DEL;}
+		else if(strcmp(name,"get")==0){ops[*n].type=TRACE_LOOKUP;}
+		else if(strcmp(name,"range")==0){ops[*n].type=TRACE_RANGE;}
+		else{free(ops);return NULL;}
+		ops[*n].key=key;
+		ops[*n].width=width;
+		ops[*n].time=time;
+		last=time;
+		(*n)++;
+	}
+	return ops;
+}
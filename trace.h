@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Operation traces: captured from live runs, replayed by pthreads.out -y
+// Each thread records into its own buffer so capturing costs no locks. The
+// buffers are merged by time when the trace is written. On disk a trace is a
+// header and then one record per op: a type byte, the key as a varint and the
+// nanoseconds since the op before as a varint (plus the width for ranges), so
+// an op usually takes 4-6 bytes. trace_read() also takes text, one op a line:
+//	add|del|get KEY [NANOSECONDS SINCE START]
+//	range LO WIDTH [NANOSECONDS SINCE START]
+// so traffic logged elsewhere can be replayed
+
+#define TRACE_ADD 0
+#define TRACE_DEL 1
+#define TRACE_LOOKUP 2
+#define TRACE_RANGE 3		// delete_range(key,key+width-1)
+
+typedef struct trace_op{
+	long time;		// nanoseconds since the trace started
+	int key;
+	int width;		// TRACE_RANGE only
+	int type;
+}TRACE_OP;
+
+void trace_start();								// starts capturing (drops anything recorded before)
+void trace_record(int type, int key, int width);				// records an op on the calling thread's buffer
+long trace_write(char *path);							// merges every thread's ops and writes them, returns how many (-1 on error)
+TRACE_OP *trace_read(char *path, long *n);					// reads a binary or text trace (free it after), NULL on error
+
+#endif
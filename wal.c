@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "wal.h"
+
+#define WAL_MAGIC "AVLWAL"
+#define WAL_VERSION 1
+#define WAL_SEED 14695981039346656037UL	// FNV-1a offset basis
+#define WAL_PRIME 1099511628211UL		// FNV-1a prime
+
+typedef struct wal_header{
+	char magic[8];			// "AVLWAL" and two 0s
+	unsigned int version;
+	unsigned int pad;
+	long base;			// LSN of the first op in the log
+}WAL_HEADER;
+
+// written ahead of each group commit's ops
+typedef struct wal_batch{
+	unsigned int count;
+	unsigned int pad;
+	unsigned long checksum;		// wal_checksum() of the ops
+}WAL_BATCH;
+
+// one thread's ops waiting for the commit thread
+typedef struct wal_buf{
+	pthread_mutex_t lock;
+	WAL_REC *recs;
+	long n;
+	long cap;
+	struct wal_buf *next;		// next thread's buffer
+}WAL_BUF;
+
+static int fd=-1;
+static long next_lsn=0;				// LSN the next op gets
+static long durable=-1;				// every op up to this LSN is synced
+static long *held=NULL;				// LSNs synced past a gap (waiting for the ops before them)
+static long num_held=0, held_cap=0;
+static WAL_REC *batch_recs=NULL;		// ops gathered for the commit in progress
+static long batch_cap=0;
+static pthread_mutex_t file_lock=PTHREAD_MUTEX_INITIALIZER;	// held to write the file
+
+static WAL_BUF *buffers=NULL;			// every thread's buffer
+static pthread_mutex_t buffers_lock=PTHREAD_MUTEX_INITIALIZER;
+static __thread WAL_BUF *my_buf=NULL;		// calling thread's buffer
+static __thread long my_lsn=-1;			// LSN of its last op
+static __thread int my_epoch=-1;
+static int wal_epoch=0;				// bumped by wal_open so buffers from an old log get replaced
+
+static pthread_t committer;
+static pthread_mutex_t commit_lock=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t commit_cond;		// wakes the commit thread early
+static pthread_cond_t durable_cond;		// wakes threads in wal_sync
+static long commit_interval=WAL_INTERVAL;
+static long commit_batch=WAL_BATCH_OPS;
+static long pending=0;				// ops buffered since the last commit
+static int stopping=0;
+static long committed_ops=0, commits=0;
+
+unsigned long wal_checksum(WAL_REC *recs, long n);				// FNV-1a style checksum of some ops, a word at a time
+int compare_lsn(const void *a, const void *b);					// qsort comparison for ops by LSN
+int write_all(int out, void *data, long bytes);					// writes all of data, returns 0 on error
+long read_log(void (*replay)(int type, int key, int hi));			// replays the log and trims anything after the last good batch
+long wal_commit();								// writes and syncs every buffered op, returns how many
+void *p_commit(void *arg);							// pthreads function for the group commit thread
+
+
+
+// FNV-1a style checksum of some ops, a word at a time
+unsigned long wal_checksum(WAL_REC *recs, long n){
+	unsigned long sum=WAL_SEED, *words=(unsigned long *)recs;
+	long i;
+	for(i=0;i<n*(long)(sizeof(WAL_REC)/sizeof(long));i++){
+		sum=(sum^words[i])*WAL_PRIME;
+	}
+	return sum;
+}
+
+// qsort comparison for ops by LSN
+int compare_lsn(const void *a, const void *b){
+	long x=((WAL_REC *)a)->lsn, y=((WAL_REC *)b)->lsn;
+	return (x>y)-(x<y);
+}
+
+// writes all of data, returns 0 on error
+int write_all(int out, void *data, long bytes){
+	long done=0, n;
+	while(done<bytes){
+		n=write(out,(char *)data+done,bytes-done);
+		if(n<0){
+			if(errno==EINTR){continue;}
+			return 0;
+		}
+		done+=n;
+	}
+	return 1;
+}
+
+// replays the log at path then logs to it, returns ops replayed (-1 on error)
+long wal_open(char *path, long interval, long batch, void (*replay)(int type, int key, int hi)){
+	pthread_condattr_t attr;
+	long replayed;
+
+	fd=open(path,O_RDWR|O_CREAT,0644);
+	if(fd<0){return -1;}
+	replayed=read_log(replay);
+	if(replayed<0){
+		close(fd);
+		fd=-1;
+		return -1;
+	}
+
+	commit_interval=(interval>=0)?interval:WAL_INTERVAL;
+	commit_batch=(batch>0)?batch:WAL_BATCH_OPS;
+	pending=0;
+	stopping=0;
+	committed_ops=commits=0;
+	__atomic_fetch_add(&wal_epoch,1,__ATOMIC_RELEASE);
+
+	// the commit thread's deadlines are on the monotonic clock
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr,CLOCK_MONOTONIC);
+	pthread_cond_init(&commit_cond,&attr);
+	pthread_cond_init(&durable_cond,NULL);
+	pthread_condattr_destroy(&attr);
+	pthread_create(&committer,NULL,p_commit,NULL);
+	return replayed;
+}
+
+// replays the log and trims anything after the last good batch
+// ops are replayed in LSN order from the base up to the first one missing (it never
+// got synced, so nothing after it was ever reported durable). If any synced ops are
+// past that gap the log is rewritten with just the ops replayed, so their LSNs can be
+// given out again
+long read_log(void (*replay)(int type, int key, int hi)){
+	WAL_HEADER header;
+	WAL_BATCH batch;
+	WAL_REC *recs=NULL;
+	long n=0, cap=0, good, i, expect;
+	off_t end;
+
+	// a new log just gets a header
+	if(read(fd,&header,sizeof(header))!=sizeof(header)){
+		memset(&header,0,sizeof(header));
+		memcpy(header.magic,WAL_MAGIC,6);
+		header.version=WAL_VERSION;
+		header.base=0;
+		if(ftruncate(fd,0)!=0 || lseek(fd,0,SEEK_SET)!=0){return -1;}
+		if(!write_all(fd,&header,sizeof(header)) || fdatasync(fd)!=0){return -1;}
+		next_lsn=0;
+		durable=-1;
+		return 0;
+	}
+	if(memcmp(header.magic,WAL_MAGIC,6)!=0 || header.version!=WAL_VERSION){return -1;}
+
+	// reads batches until the end or one that didn't make it to disk whole
+	good=sizeof(header);
+	while(read(fd,&batch,sizeof(batch))==sizeof(batch)){
+		if(n+batch.count>cap){
+			cap=2*(n+batch.count);
+			recs=realloc(recs,cap*sizeof(WAL_REC));
+		}
+		if(read(fd,recs+n,batch.count*sizeof(WAL_REC))!=(long)(batch.count*sizeof(WAL_REC))){break;}
+		if(wal_checksum(recs+n,batch.count)!=batch.checksum){break;}
+		n+=batch.count;
+		good+=sizeof(batch)+batch.count*sizeof(WAL_REC);
+	}
+
+	qsort(recs,n,sizeof(WAL_REC),compare_lsn);
+	expect=header.base;
+	for(i=0;i<n && recs[i].lsn==expect;i++){
+		replay(recs[i].type,recs[i].key,recs[i].hi);
+		expect++;
+	}
+	next_lsn=expect;
+	durable=expect-1;
+
+	if(i<n){
+		// drops the ops past the gap by writing what was replayed as one batch
+		batch.count=i;
+		batch.pad=0;
+		batch.checksum=wal_checksum(recs,i);
+		good=sizeof(header)+sizeof(batch)+i*sizeof(WAL_REC);
+		if(lseek(fd,sizeof(header),SEEK_SET)<0 || !write_all(fd,&batch,sizeof(batch)) || !write_all(fd,recs,i*sizeof(WAL_REC))){
+			free(recs);
+			return -1;
+		}
+	}
+	free(recs);
+	if(ftruncate(fd,good)!=0 || fdatasync(fd)!=0){return -1;}
+	end=lseek(fd,0,SEEK_END);
+	if(end!=good){return -1;}
+	return expect-header.base;
+}
+
+// adds an op to the calling thread's buffer, returns its LSN
+// the LSN is taken under the buffer's lock so the commit thread never
+// gathers a buffer with an LSN handed out but not yet in it
+long wal_log(int type, int key, int hi){
+	WAL_BUF *buf=my_buf;
+	long lsn, n;
+
+	// a thread's first op since wal_open gets it a buffer
+	if(buf==NULL || my_epoch!=__atomic_load_n(&wal_epoch,__ATOMIC_ACQUIRE)){
+		buf=malloc(sizeof(WAL_BUF));
+		pthread_mutex_init(&(buf->lock),NULL);
+		buf->cap=1024;
+		buf->n=0;
+		buf->recs=malloc(buf->cap*sizeof(WAL_REC));
+		pthread_mutex_lock(&buffers_lock);
+		buf->next=buffers;
+		buffers=buf;
+		my_epoch=wal_epoch;
+		pthread_mutex_unlock(&buffers_lock);
+		my_buf=buf;
+	}
+
+	pthread_mutex_lock(&(buf->lock));
+	if(buf->n==buf->cap){
+		buf->cap*=2;
+		buf->recs=realloc(buf->recs,buf->cap*sizeof(WAL_REC));
+	}
+	lsn=__atomic_fetch_add(&next_lsn,1,__ATOMIC_SEQ_CST);
+	buf->recs[buf->n].lsn=lsn;
+	buf->recs[buf->n].type=type;
+	buf->recs[buf->n].key=key;
+	buf->recs[buf->n].hi=hi;
+	buf->recs[buf->n].pad=0;
+	buf->n++;
+	pthread_mutex_unlock(&(buf->lock));
+	my_lsn=lsn;
+
+	// a full batch doesn't wait for the interval (and with no interval the first op doesn't wait)
+	n=__atomic_add_fetch(&pending,1,__ATOMIC_RELAXED);
+	if(n==commit_batch || (n==1 && commit_interval==0)){
+		pthread_mutex_lock(&commit_lock);
+		pthread_cond_signal(&commit_cond);
+		pthread_mutex_unlock(&commit_lock);
+	}
+	return lsn;
+}
+
+// waits until the calling thread's last op is durable
+void wal_sync(){
+	long lsn=my_lsn;
+	if(lsn<0 || my_epoch!=__atomic_load_n(&wal_epoch,__ATOMIC_ACQUIRE)){return;}
+	if(__atomic_load_n(&durable,__ATOMIC_ACQUIRE)>=lsn){return;}
+	pthread_mutex_lock(&commit_lock);
+	while(durable<lsn){
+		pthread_cond_wait(&durable_cond,&commit_lock);
+	}
+	pthread_mutex_unlock(&commit_lock);
+}
+
+// writes and syncs every buffered op, returns how many
+long wal_commit(){
+	WAL_BUF *buf;
+	WAL_BATCH batch;
+	long n=0, i, j, k, merged, *all;
+
+	// takes everything out of the buffers
+	pthread_mutex_lock(&file_lock);
+	pthread_mutex_lock(&buffers_lock);
+	for(buf=buffers;buf!=NULL;buf=buf->next){
+		pthread_mutex_lock(&(buf->lock));
+		if(n+buf->n>batch_cap){
+			batch_cap=2*(n+buf->n);
+			batch_recs=realloc(batch_recs,batch_cap*sizeof(WAL_REC));
+		}
+		memcpy(batch_recs+n,buf->recs,buf->n*sizeof(WAL_REC));
+		n+=buf->n;
+		buf->n=0;
+		pthread_mutex_unlock(&(buf->lock));
+	}
+	pthread_mutex_unlock(&buffers_lock);
+	if(n==0){
+		pthread_mutex_unlock(&file_lock);
+		return 0;
+	}
+	__atomic_sub_fetch(&pending,n,__ATOMIC_RELAXED);
+
+	qsort(batch_recs,n,sizeof(WAL_REC),compare_lsn);
+	batch.count=n;
+	batch.pad=0;
+	batch.checksum=wal_checksum(batch_recs,n);
+	if(!write_all(fd,&batch,sizeof(batch)) || !write_all(fd,batch_recs,n*sizeof(WAL_REC)) || fdatasync(fd)!=0){
+		perror("wal");
+		exit(EXIT_FAILURE);
+	}
+
+	// an op still in another thread's hands can leave a gap, so only the run
+	// up to the first missing LSN becomes durable and the rest is held
+	all=malloc((num_held+n)*sizeof(long));
+	for(i=j=merged=0;i<num_held || j<n;){
+		if(j==n || (i<num_held && held[i]<batch_recs[j].lsn)){all[merged++]=held[i++];}
+		else{all[merged++]=batch_recs[j++].lsn;}
+	}
+	for(k=0;k<merged && all[k]==durable+1+k;k++);
+	num_held=merged-k;
+	if(num_held>held_cap){
+		held_cap=2*num_held;
+		held=realloc(held,held_cap*sizeof(long));
+	}
+	memcpy(held,all+k,num_held*sizeof(long));
+	free(all);
+
+	pthread_mutex_lock(&commit_lock);
+	__atomic_store_n(&durable,durable+k,__ATOMIC_RELEASE);
+	committed_ops+=n;
+	commits++;
+	pthread_cond_broadcast(&durable_cond);
+	pthread_mutex_unlock(&commit_lock);
+	pthread_mutex_unlock(&file_lock);
+	return n;
+}
+
+// pthreads function for the group commit thread
+// commits every interval, or as soon as a batch is waiting, until wal_close
+// with no interval it commits whenever anything is waiting, so a batch is whatever
+// came in during the fsync before
+void *p_commit(void *arg){
+	struct timespec deadline;
+	int done;
+	(void)arg;
+
+	pthread_mutex_lock(&commit_lock);
+	while(1){
+		clock_gettime(CLOCK_MONOTONIC,&deadline);
+		deadline.tv_nsec+=commit_interval*1000;
+		deadline.tv_sec+=deadline.tv_nsec/1000000000;
+		deadline.tv_nsec%=1000000000;
+		while(!stopping && __atomic_load_n(&pending,__ATOMIC_RELAXED)<commit_batch){
+			if(commit_interval==0){
+				if(__atomic_load_n(&pending,__ATOMIC_RELAXED)>0){break;}
+				pthread_cond_wait(&commit_cond,&commit_lock);
+			}
+			else if(pthread_cond_timedwait(&commit_cond,&commit_lock,&deadline)==ETIMEDOUT){break;}
+		}
+		done=stopping;
+		pthread_mutex_unlock(&commit_lock);
+		// once stopping it keeps going until a commit finds nothing left
+		if(wal_commit()==0 && done){return NULL;}
+		pthread_mutex_lock(&commit_lock);
+	}
+}
+
+// empties the log once a snapshot covers it (nothing else may be logging), 0 on error
+int wal_truncate(){
+	WAL_HEADER header;
+	int ok;
+	// makes sure nothing is left buffered to land after the cut
+	while(wal_commit()>0);
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,WAL_MAGIC,6);
+	header.version=WAL_VERSION;
+	header.base=next_lsn;
+	pthread_mutex_lock(&file_lock);
+	ok=(ftruncate(fd,0)==0 && lseek(fd,0,SEEK_SET)==0);
+	ok=ok && write_all(fd,&header,sizeof(header)) && fdatasync(fd)==0;
+	pthread_mutex_unlock(&file_lock);
+	return ok;
+}
+
+// ops committed and group commits (fsyncs) so far
+void wal_stats(long *ops, long *num_commits){
+	pthread_mutex_lock(&commit_lock);
+	*ops=committed_ops;
+	*num_commits=commits;
+	pthread_mutex_unlock(&commit_lock);
+}
+
+// commits everything still buffered and stops the commit thread
+void wal_close(){
+	WAL_BUF *buf, *next;
+	pthread_mutex_lock(&commit_lock);
+	stopping=1;
+	pthread_cond_signal(&commit_cond);
+	pthread_mutex_unlock(&commit_lock);
+	pthread_join(committer,NULL);
+	close(fd);
+	fd=-1;
+
+	for(buf=buffers;buf!=NULL;buf=next){
+		next=buf->next;
+		free(buf->recs);
+		free(buf);
+	}
+	buffers=NULL;
+	free(held);
+	held=NULL;
+	num_held=held_cap=0;
+	free(batch_recs);
+	batch_recs=NULL;
+	batch_cap=0;
+}
@@ -0,0 +1,39 @@
+#ifndef WAL_H
+#define WAL_H
+
+// Write ahead log with group commit
+// Each thread appends its ops to a buffer of its own, taking a log sequence
+// number (LSN) from one shared counter. A commit thread gathers every buffer
+// each interval (or sooner once batch ops are waiting, or as soon as anything
+// is with an interval of 0), sorts what it got by
+// LSN, writes it as one checksummed batch and syncs it, so one fsync covers every
+// op in the batch. An op is durable once it and every op before it has been
+// synced; wal_sync() waits for that. wal_open() replays a log that's already
+// there, up to a torn batch or a missing LSN, before carrying on from the end
+// of it. The caller takes the LSN while it holds the lock that orders the op in
+// the tree, so the log replays in the same order the tree saw
+
+#define WAL_ADD 0
+#define WAL_DEL 1
+#define WAL_RANGE 2		// delete_range(key,hi)
+
+#define WAL_INTERVAL 1000	// default microseconds between group commits
+#define WAL_BATCH_OPS 4096	// default ops waiting that start a group commit early
+
+// one logged op as it's stored
+typedef struct wal_rec{
+	long lsn;
+	int type;		// WAL_ADD, WAL_DEL or WAL_RANGE
+	int key;
+	int hi;			// WAL_RANGE only
+	int pad;
+}WAL_REC;
+
+long wal_open(char *path, long interval, long batch, void (*replay)(int type, int key, int hi));	// replays the log at path then logs to it (interval in microseconds), returns ops replayed (-1 on error)
+long wal_log(int type, int key, int hi);					// adds an op to the calling thread's buffer, returns its LSN
+void wal_sync();								// waits until the calling thread's last op is durable
+int wal_truncate();								// empties the log once a snapshot covers it (nothing else may be logging), 0 on error
+void wal_stats(long *ops, long *commits);					// ops committed and group commits (fsyncs) so far
+void wal_close();								// commits everything still buffered and stops the commit thread
+
+#endif